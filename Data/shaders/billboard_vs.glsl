@@ -0,0 +1,107 @@
+#version 400
+
+/**
+ * Vertex shader used to draw a single particle as a camera facing quad.
+ * Every quad is one instance, its particle is read from the buffer texture
+ * (one texel of the render stream per particle) and the corner comes from gl_VertexID.
+ * (c) 2014 Damian Nowakowski
+ */
+
+out vec4 inoutColor;
+
+/**
+* Matrices of the camera, written once per frame right before drawing.
+*/
+layout(std140) uniform CameraParams
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+};
+
+uniform usamplerBuffer particles;		// Render stream, position bits and packed color
+uniform samplerBuffer simulation;		// Simulation stream, five floats per particle (used when analytic is true)
+uniform usamplerBuffer order;		// Sorted particles indices (used when sorted is true)
+uniform bool sorted;
+uniform int firstId;					// Id of the first particle of the drawn chunk (ids keep sizes)
+uniform float pointSize;
+uniform vec2 viewportSize;
+uniform float attenuationDistance;
+uniform float sizeVariation;
+
+/**
+* In analytic mode particles store only the spawn state and
+* others.x is the spawn time (the same as in point_analytic_vs.glsl).
+*/
+uniform bool analytic;
+uniform float time;
+uniform float timePeriod;
+uniform float lifeTime;
+uniform float gravity;
+
+/**
+* Corners of the quad in the triangle strip order.
+*/
+const vec2 corners[4] = vec2[4](vec2(-1, -1), vec2(1, -1), vec2(-1, 1), vec2(1, 1));
+
+/**
+* Integer hash of the particle id, so every particle keeps its own size.
+* @param id - id of the particle.
+* @returns value in <0;1>.
+*/
+float hash(uint id)
+{
+	id = (id ^ 61u) ^ (id >> 16);
+	id *= 9u;
+	id = id ^ (id >> 4);
+	id *= 0x27d4eb2du;
+	id = id ^ (id >> 15);
+	return float(id) / 4294967295.0;
+}
+
+void main()
+{
+	int id = sorted ? int(texelFetch(order, gl_InstanceID).r) : gl_InstanceID;
+
+	/// Render stream is read as integers, so the packed color keeps its exact bits
+	uvec4 particle	= texelFetch(particles, id);
+	vec3 position	= uintBitsToFloat(particle.xyz);
+	vec4 color		= unpackUnorm4x8(particle.w);
+
+	if (analytic)
+	{
+		/// Simulation stream is velocity and others
+		int base		= id * 5;
+		vec3 velocity	= vec3(texelFetch(simulation, base + 0).r, texelFetch(simulation, base + 1).r, texelFetch(simulation, base + 2).r);
+		vec2 others		= vec2(texelFetch(simulation, base + 3).r, texelFetch(simulation, base + 4).r);
+		float age		= mod(time - others.x + timePeriod, timePeriod);
+		if (others.y == 0.0 || age >= lifeTime)
+		{
+			color.a = 0.0;
+		}
+		position	= position + velocity * age;
+		position.y	-= 0.5 * gravity * age * age;
+		color.a		= max(color.a - max(0.0, age - max(lifeTime - 1.0, 0.0)), 0.0);
+	}
+
+	/// Invisible particles are moved outside of the clip space, so they aren't rasterised.
+	if (color.a < 0.01)
+	{
+		inoutColor = vec4(0.0);
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		return;
+	}
+
+	vec4 center = viewProjectionMatrix * vec4(position, 1.0);
+
+	/// Size in pixels, smaller for distant particles when the attenuation is used.
+	float size = pointSize * (1.0 - sizeVariation * hash(uint(firstId + id)));
+	if (attenuationDistance > 0.0)
+	{
+		size *= attenuationDistance / max(center.w, 0.0001);
+	}
+
+	/// Offset the corner in the clip space, so the quad has the same size in pixels at any depth.
+	inoutColor = color;
+	gl_Position = center + vec4(corners[gl_VertexID] * size / viewportSize * center.w, 0.0, 0.0);
+}
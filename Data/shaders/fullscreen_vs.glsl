@@ -0,0 +1,13 @@
+#version 400
+
+/**
+ * Vertex shader of the full-screen triangle used by resolving and compositing passes.
+ * (c) 2014 Damian Nowakowski
+ */
+
+void main()
+{
+	/// Three vertices cover the whole screen: (-1,-1), (3,-1) and (-1,3).
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,64 @@
+#version 400
+
+/**
+ * Vertex shader used to draw a single particle point in analytic mode.
+ * Particles store only the spawn state, so the position and alpha
+ * are evaluated here from the age of the particle.
+ * (c) 2014 Damian Nowakowski
+ */
+
+/**
+* Use the location the same as in compute shader for
+* easy getting attribute pointers address.
+* Color is packed in four bytes (packUnorm4x8).
+* inOthers.x is the spawn time, inOthers.y tells if the particle was emitted.
+*/
+layout(location = 1) in vec3 inPosition;
+layout(location = 2) in uint inColor;
+layout(location = 3) in vec3 inVelocity;
+layout(location = 4) in vec2 inOthers;
+
+out vec4 inoutColor;
+
+/**
+* Matrices of the camera, written once per frame right before drawing.
+*/
+layout(std140) uniform CameraParams
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+};
+
+uniform float pointSize;
+uniform float time;
+uniform float timePeriod;
+uniform float lifeTime;
+uniform float gravity;
+
+void main()
+{
+	/// Time wraps, so the age is taken modulo of the wrapping period.
+	float age = mod(time - inOthers.x + timePeriod, timePeriod);
+
+	/// Move dead and not emitted particles outside of the clip space.
+	if (inOthers.y == 0.0 || age >= lifeTime)
+	{
+		inoutColor = vec4(0.0);
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		gl_PointSize = pointSize;
+		return;
+	}
+
+	/// Constant velocity with the gravity on the y axis.
+	vec3 position = inPosition + inVelocity * age;
+	position.y -= 0.5 * gravity * age * age;
+
+	/// Fade out in the last second of life, the same as in update shader.
+	float fade = max(0.0, age - max(lifeTime - 1.0, 0.0));
+
+	vec4 color = unpackUnorm4x8(inColor);
+	inoutColor = vec4(color.rgb, max(color.a - fade, 0.0));
+	gl_Position = viewProjectionMatrix * vec4(position, 1.0);
+	gl_PointSize = pointSize;
+}
@@ -1,4 +1,5 @@
 #version 400
+#extension GL_ARB_shader_atomic_counters : enable
 
 /**
  * Vertex shader used to update perticles point location, color and velocity.
@@ -7,11 +8,13 @@
 
 /**
 * These are input variables with arranged locations.
+* Position and color come from the render stream, velocity and others from the simulation stream.
+* Color is packed in four bytes (packUnorm4x8).
 * Others.x = time life left.
-* Others.y = 1-particle was emitted, 0-particle is waiting for it's emission.
+* Others.y = emit mark of the cycle in which the particle was emitted (1 or 2), 0-particle is waiting for it's emission.
 */
 layout(location = 1) in vec3 inPosition;
-layout(location = 2) in vec4 inColor;
+layout(location = 2) in uint inColor;
 layout(location = 3) in vec3 inVelocity;
 layout(location = 4) in vec2 inOthers;
 
@@ -19,7 +22,7 @@ layout(location = 4) in vec2 inOthers;
 * Output variables (the same order as input variables!)
 */
 out vec3 outPosition;
-out vec4 outColor;
+flat out uint outColor;
 out vec3 outVelocity;
 out vec2 outOthers;
 
@@ -39,8 +42,67 @@ layout( shared ) uniform ParticlesParams
 	float	colorSaturation;
 	float	speed;
 	float	gravity;
+	uint	randomEpoch;
 };
 
+/**
+* Sampled vector fields (the maximum must match VECTOR_FIELDS_MAX in VectorField.h).
+* Type 0 - the vector is the acceleration, type 1 - velocity is pulled to the vector.
+*/
+#define MAX_VECTOR_FIELDS 4
+uniform int			vectorFieldsCount;
+uniform sampler3D	vectorFields[MAX_VECTOR_FIELDS];
+uniform vec3		vectorFieldsMin[MAX_VECTOR_FIELDS];
+uniform vec3		vectorFieldsMax[MAX_VECTOR_FIELDS];
+uniform float		vectorFieldsStrength[MAX_VECTOR_FIELDS];
+uniform int			vectorFieldsType[MAX_VECTOR_FIELDS];
+
+/**
+* Only every emitStride-th group of four particles (one of every stream) is emitted.
+* It is bigger than 1 for distant systems.
+*/
+uniform int emitStride;
+
+/**
+* Particles are stored in chunks updated with separate draws, so the id of the particle
+* is gl_VertexID moved by the id of the first particle of the chunk.
+*/
+uniform int firstId;
+
+/**
+* The emit mark changes every time the emission counter is zeroed. Particles emitted in this
+* cycle are flagged with it, so particles flagged with the previous one can be emitted again.
+*/
+uniform float emitMark;
+
+/**
+* Portions of emitAtOnce particles emitted in this update (from the particle emitFrom) were
+* due every emitPeriod, the first one emitAge before the end of the update. Every particle
+* is spawned where the emitter was at that time and moved by its age, so the emission
+* doesn't depend on the update rate.
+*/
+uniform int		emitFrom;
+uniform int		emitAtOnce;
+uniform float	emitAge;
+uniform float	emitPeriod;
+uniform vec3	emitterVelocity;
+uniform float	emitterRotationSpeed;
+
+/**
+* Statistics of this update: alive particles, particles emitted and particles that died.
+* Counters are incremented only when collectStats is set, so the buffer doesn't have to be
+* bound otherwise (and the shader still compiles without atomic counters).
+*/
+uniform bool collectStats;
+#ifdef GL_ARB_shader_atomic_counters
+layout(binding = 0, offset = 0) uniform atomic_uint aliveCount;
+layout(binding = 0, offset = 4) uniform atomic_uint emittedCount;
+layout(binding = 0, offset = 8) uniform atomic_uint diedCount;
+#define COUNT(counter) if (collectStats) atomicCounterIncrement(counter)
+#else
+#define COUNT(counter)
+#endif
+
 /**
 * Variable for seting the random seed for random numbers
 * pseudo generator.
@@ -69,27 +131,32 @@ float randhash(float b)
 
 void main()
 {
+	int id = firstId + gl_VertexID;
+
 	/// First of all set the default output values
 	outPosition		= inPosition;
-    outColor		= inColor;
 	outVelocity		= inVelocity;
 	outOthers		= inOthers;
 
+	// Work on the unpacked color, it is packed back at the end
+	vec4 color		= unpackUnorm4x8(inColor);
+
 
 	// If particle is not alive
 	if (outOthers.x <= 0)
 	{
 		// Dead particle has to have 0 color, so it will be invisible.
-		outColor = vec4(0);
+		color = vec4(0);
 
 		// Can this particle be emitted?
-		if (particlesEmitted > gl_VertexID)
+		if (particlesEmitted > id)
 		{
-			// Hasn't this particle been already emitted
-			if (outOthers.y == 0)
+			// Hasn't this particle been already emitted in this cycle
+			if (outOthers.y != emitMark && (id / 4) % emitStride == 0)
 			{
 				// Particle can be emitted, because the emission counter is higher than the particle id.
-				// It also wasn't emitted yet, we know it from outOthers.y value.
+				// It also wasn't emitted in this cycle yet, we know it from outOthers.y value (the flag
+				// of the previous cycle doesn't stop it, even if the particle died in this update).
 				// Emit the particle.
 
 				// Set how long the particle will live
@@ -97,40 +164,48 @@ void main()
 
 				// Set flag that this particle was emited, so it has to wait
 				// with it's next emission until the emission counter is zeroed.
-				outOthers.y = 1;
+				outOthers.y = emitMark;
+
+				// How long before the end of this update the particle was due
+				float age = 0;
+				if (id >= emitFrom && emitPeriod > 0)
+				{
+					age = max(emitAge - float((id - emitFrom) / emitAtOnce) * emitPeriod, 0.0);
+				}
+				float rotation = emitterRotation - emitterRotationSpeed * age;
 
-				// Set the position in the center of the emitter. If the stream is not
-				// in the center it will be edited soon
-				outPosition = emitterPosition;
+				// Set the position in the center of the emitter (where it was when the particle
+				// was due). If the stream is not in the center it will be edited soon
+				outPosition = emitterPosition - emitterVelocity * age;
 		
 				// Remember the modulo of vertex id, so we can know in which stream it is.
-				int mod = gl_VertexID % 4;
+				int mod = id % 4;
 
-				// Set the rand seed
-				randSeed = uint((outOthers.x+1) * 1000.0) + uint(gl_VertexID);
+				// Set the rand seed (mixed with the random epoch, so every emission is different)
+				randSeed = (uint((outOthers.x+1) * 1000.0) + uint(id)) ^ (randomEpoch * 2654435769u);
 
 				// Set the base color (the center stream) using the randomized saturation
 				float deltaSaturation = randhash(colorSaturation);
-				outColor = vec4(deltaSaturation, deltaSaturation, deltaSaturation, 1);
+				color = vec4(deltaSaturation, deltaSaturation, deltaSaturation, 1);
 		
 				// If this is not a center stream
 				if (mod > 0)
 				{
 					// Set the proper position on the edges of the circle with current emitter
 					// rotation position.
-					outPosition.x += (emitterRadius * sin(mod * D120 + emitterRotation));
-					outPosition.z -= (emitterRadius * cos(mod * D120 + emitterRotation));
+					outPosition.x += (emitterRadius * sin(mod * D120 + rotation));
+					outPosition.z -= (emitterRadius * cos(mod * D120 + rotation));
 
 					// Set the proper color on one channel (the saturation from base color should
 					// remains intact).
 					switch (mod)
 					{
 						case 1:
-							outColor.r = 1; break;
+							color.r = 1; break;
 						case 2:
-							outColor.g = 1; break;
+							color.g = 1; break;
 						case 3:
-							outColor.b = 1; break;
+							color.b = 1; break;
 					}
 				}		
 
@@ -141,6 +216,14 @@ void main()
 				// Set the y-axis velocity based on the speed. It has to be little randomized for
 				// better visual effect.
 				outVelocity.y = randhash(0.5) + speed;
+
+				// Move the particle by the time passed since it was due
+				outPosition		+= outVelocity * age;
+				outVelocity.y	-= gravity * age;
+				outOthers.x		-= age;
+
+				COUNT(emittedCount);
+				COUNT(aliveCount);
 			}
 		}
 		else
@@ -161,13 +244,44 @@ void main()
 		// Apply the gravity to the y-axis velocity
 		outVelocity.y	-= gravity*deltaTime;
 
+		// Apply vector fields which contain the particle
+		for (int i = 0; i < vectorFieldsCount; i++)
+		{
+			vec3 uvw = (outPosition - vectorFieldsMin[i]) / (vectorFieldsMax[i] - vectorFieldsMin[i]);
+			if (all(greaterThanEqual(uvw, vec3(0))) && all(lessThanEqual(uvw, vec3(1))))
+			{
+				vec3 value = textureLod(vectorFields[i], uvw, 0).xyz;
+				if (vectorFieldsType[i] == 0)
+				{
+					outVelocity += value * vectorFieldsStrength[i] * deltaTime;
+				}
+				else
+				{
+					outVelocity += (value - outVelocity) * min(vectorFieldsStrength[i] * deltaTime, 1.0);
+				}
+			}
+		}
+
 		// Update life time left
 		outOthers.x		-= deltaTime;
 
-		// If there is just one second left to die fade it nicely out.
+		// Count the particle as alive or as died in this update
+		if (outOthers.x <= 0)
+		{
+			COUNT(diedCount);
+		}
+		else
+		{
+			COUNT(aliveCount);
+		}
+
+		// If there is just one second left to die fade it nicely out. Alpha is taken from
+		// the life time left, so the byte precision of the packed color doesn't add up.
 		if (outOthers.x < 1)
 		{
-			outColor.a -= deltaTime;
+			color.a = outOthers.x;
 		}
 	}
+
+	outColor = packUnorm4x8(color);
 }
\ No newline at end of file
@@ -8,19 +8,29 @@
 /**
 * Use the location the same as in compute shader for
 * easy getting attribute pointers address.
+* Color is packed in four bytes (packUnorm4x8).
 */
 layout(location = 1) in vec3 inPosition;
-layout(location = 2) in vec4 inColor;
+layout(location = 2) in uint inColor;
 
 out vec4 inoutColor;
 
-uniform mat4 viewProjectionMatrix;
+/**
+* Matrices of the camera, written once per frame right before drawing.
+*/
+layout(std140) uniform CameraParams
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+};
+
 uniform float pointSize;
 
 void main()
 {
 	/// Simply pass the color next and set the vertex position and size.
-	inoutColor = inColor;
+	inoutColor = unpackUnorm4x8(inColor);
 	gl_Position = viewProjectionMatrix * vec4(inPosition, 1.0);
 	gl_PointSize = pointSize;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 430
+
+/**
+ * Compute shader scanning digits counts of the radix sort pass into offsets.
+ * It runs as one work group: every thread sums its range of counts, sums are
+ * scanned in the shared memory, then every thread writes offsets of its range.
+ * (c) 2014 Damian Nowakowski
+ */
+
+#define GROUP_SIZE 1024
+
+layout(local_size_x = GROUP_SIZE) in;
+
+/**
+* Counts of every (digit, group) pair in this order, replaced with exclusive offsets.
+*/
+layout(std430, binding = 4) buffer HistogramBuffer
+{
+	uint histogram[];
+};
+
+uniform int size;
+
+shared uint sums[GROUP_SIZE];
+
+void main()
+{
+	uint tid	= gl_LocalInvocationID.x;
+	uint range	= (uint(size) + GROUP_SIZE - 1) / GROUP_SIZE;
+	uint from	= min(tid * range, uint(size));
+	uint to		= min(from + range, uint(size));
+
+	uint sum = 0;
+	for (uint i = from; i < to; i++)
+	{
+		sum += histogram[i];
+	}
+	sums[tid] = sum;
+	barrier();
+
+	/// Inclusive scan of ranges sums
+	for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1)
+	{
+		uint value = (tid >= offset) ? sums[tid - offset] : 0u;
+		barrier();
+		sums[tid] += value;
+		barrier();
+	}
+
+	uint running = (tid == 0) ? 0u : sums[tid - 1];
+	for (uint i = from; i < to; i++)
+	{
+		uint value		= histogram[i];
+		histogram[i]	= running;
+		running			+= value;
+	}
+}
@@ -0,0 +1,148 @@
+#version 430
+
+/**
+ * Compute shader of one radix sort pass (8-bit digit of 32-bit keys).
+ * Stage 0 counts digits of the tile of every work group.
+ * Stage 1 scatters the tile to offsets scanned from these counts. The tile is processed
+ * in blocks of GROUP_SIZE elements, every block is sorted locally by the digit with
+ * 1-bit splits, so elements with the same digit keep their order (the sort is stable).
+ * (c) 2014 Damian Nowakowski
+ */
+
+#define GROUP_SIZE			256
+#define ITEMS_PER_THREAD	16
+#define RADIX				256
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer KeysInBuffer
+{
+	uint keysIn[];
+};
+
+layout(std430, binding = 1) readonly buffer ValuesInBuffer
+{
+	uint valuesIn[];
+};
+
+layout(std430, binding = 2) writeonly buffer KeysOutBuffer
+{
+	uint keysOut[];
+};
+
+layout(std430, binding = 3) writeonly buffer ValuesOutBuffer
+{
+	uint valuesOut[];
+};
+
+/**
+* Counts of every (digit, group) pair in this order (offsets after the scan).
+*/
+layout(std430, binding = 4) buffer HistogramBuffer
+{
+	uint histogram[];
+};
+
+uniform int count;
+uniform int shift;
+uniform int stage;
+
+shared uint digitOffsets[RADIX];	// Digits counts in stage 0, next free slot of every digit in stage 1
+shared uint digitStarts[RADIX];		// First position of every digit in the locally sorted block
+shared uint scan[GROUP_SIZE];
+shared uint blockKeys[GROUP_SIZE];
+shared uint blockValues[GROUP_SIZE];
+
+void main()
+{
+	uint tid			= gl_LocalInvocationID.x;
+	uint group			= gl_WorkGroupID.x;
+	uint groupsCount	= gl_NumWorkGroups.x;
+	uint tileStart		= group * GROUP_SIZE * ITEMS_PER_THREAD;
+
+	if (stage == 0)
+	{
+		digitOffsets[tid] = 0;
+		barrier();
+
+		for (uint i = 0; i < ITEMS_PER_THREAD; i++)
+		{
+			uint index = tileStart + i * GROUP_SIZE + tid;
+			if (index < uint(count))
+			{
+				atomicAdd(digitOffsets[(keysIn[index] >> shift) & (RADIX - 1)], 1u);
+			}
+		}
+		barrier();
+
+		histogram[tid * groupsCount + group] = digitOffsets[tid];
+		return;
+	}
+
+	digitOffsets[tid] = histogram[tid * groupsCount + group];
+	barrier();
+
+	for (uint i = 0; i < ITEMS_PER_THREAD; i++)
+	{
+		uint blockStart	= tileStart + i * GROUP_SIZE;
+		uint index		= blockStart + tid;
+		uint validCount	= uint(clamp(count - int(blockStart), 0, GROUP_SIZE));
+
+		/// Elements out of range get the biggest digit, so they end up behind all valid ones.
+		uint key	= (index < uint(count)) ? keysIn[index] : 0xFFFFFFFFu;
+		uint value	= (index < uint(count)) ? valuesIn[index] : 0u;
+		uint digit	= (key >> shift) & (RADIX - 1);
+
+		/// Sort the block by the digit, one bit at once: zeros go to the front,
+		/// ones behind them, both in their current order.
+		for (uint bit = 0; bit < 8; bit++)
+		{
+			uint isZero = ((digit >> bit) & 1u) ^ 1u;
+			scan[tid] = isZero;
+			barrier();
+			for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1)
+			{
+				uint previous = (tid >= offset) ? scan[tid - offset] : 0u;
+				barrier();
+				scan[tid] += previous;
+				barrier();
+			}
+			uint zerosBefore	= scan[tid] - isZero;
+			uint zerosCount		= scan[GROUP_SIZE - 1];
+			uint destination	= (isZero == 1u) ? zerosBefore : zerosCount + tid - zerosBefore;
+
+			blockKeys[destination]		= key;
+			blockValues[destination]	= value;
+			barrier();
+			key		= blockKeys[tid];
+			value	= blockValues[tid];
+			digit	= (key >> shift) & (RADIX - 1);
+			barrier();
+		}
+
+		/// Rank of the element among the same digits is its distance from the first one.
+		scan[tid] = digit;
+		barrier();
+		if (tid == 0 || scan[tid - 1] != digit)
+		{
+			digitStarts[digit] = tid;
+		}
+		barrier();
+		uint rank = tid - digitStarts[digit];
+
+		if (tid < validCount)
+		{
+			uint destination			= digitOffsets[digit] + rank;
+			keysOut[destination]		= key;
+			valuesOut[destination]		= value;
+		}
+		barrier();
+
+		// The last element of every digit moves its next free slot
+		if (tid < validCount && (tid == validCount - 1 || scan[tid + 1] != digit))
+		{
+			digitOffsets[digit] += rank + 1;
+		}
+		barrier();
+	}
+}
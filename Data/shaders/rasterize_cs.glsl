@@ -0,0 +1,125 @@
+#version 430
+
+/**
+ * Compute shader rasterizing one pixel particles into the integer framebuffer.
+ * Every invocation projects one particle and accumulates its color with atomics.
+ * (c) 2014 Damian Nowakowski
+ */
+
+layout(local_size_x = 256) in;
+
+/**
+* Render stream of particles, position bits and the packed color (ParticleRender).
+*/
+layout(std430, binding = 0) readonly buffer ParticlesBuffer
+{
+	uvec4 particles[];
+};
+
+/**
+* Integer framebuffer, four uints per pixel (see ComputeRasterizer.h).
+*/
+layout(std430, binding = 1) buffer FrameBuffer
+{
+	uint pixels[];
+};
+
+/**
+* Simulation stream of particles, 5 floats per particle (velocity, others).
+* It is read only in analytic mode.
+*/
+layout(std430, binding = 2) readonly buffer SimulationBuffer
+{
+	float simulation[];
+};
+
+uniform mat4 viewProjectionMatrix;
+uniform ivec2 viewportSize;
+uniform int particlesCount;
+
+/**
+* 0 - additive blend.
+* 1 - front-most blend, finding the closest depth.
+* 2 - front-most blend, writing the color of the closest particle.
+*/
+uniform int stage;
+
+/**
+* In analytic mode particles store only the spawn state and
+* others.x is the spawn time (the same as in point_analytic_vs.glsl).
+*/
+uniform bool analytic;
+uniform float time;
+uniform float timePeriod;
+uniform float lifeTime;
+uniform float gravity;
+
+void main()
+{
+	int id = int(gl_GlobalInvocationID.x);
+	if (id >= particlesCount)
+	{
+		return;
+	}
+
+	vec3 position	= uintBitsToFloat(particles[id].xyz);
+	vec4 color		= unpackUnorm4x8(particles[id].w);
+
+	if (analytic)
+	{
+		int base		= id * 5;
+		vec3 velocity	= vec3(simulation[base + 0], simulation[base + 1], simulation[base + 2]);
+		float age		= mod(time - simulation[base + 3] + timePeriod, timePeriod);
+		if (simulation[base + 4] == 0.0 || age >= lifeTime)
+		{
+			return;
+		}
+		position	= position + velocity * age;
+		position.y	-= 0.5 * gravity * age * age;
+		color.a		= max(color.a - max(0.0, age - max(lifeTime - 1.0, 0.0)), 0.0);
+	}
+
+	// Skip the barely visible particles, the same as the point fragment shader.
+	if (color.a < 0.01)
+	{
+		return;
+	}
+
+	/// Project the particle and skip it when it is outside of the view.
+	vec4 clip = viewProjectionMatrix * vec4(position, 1.0);
+	if (clip.w <= 0.0)
+	{
+		return;
+	}
+	vec3 ndc = clip.xyz / clip.w;
+	if (any(lessThan(ndc, vec3(-1.0))) || any(greaterThan(ndc, vec3(1.0))))
+	{
+		return;
+	}
+
+	ivec2 pixel = min(ivec2((ndc.xy * 0.5 + 0.5) * vec2(viewportSize)), viewportSize - 1);
+	int offset = (pixel.y * viewportSize.x + pixel.x) * 4;
+
+	if (stage == 0)
+	{
+		/// Sum premultiplied colors in fixed point.
+		uvec4 value = uvec4(vec4(color.rgb * color.a, color.a) * 255.0 + 0.5);
+		atomicAdd(pixels[offset + 0], value.r);
+		atomicAdd(pixels[offset + 1], value.g);
+		atomicAdd(pixels[offset + 2], value.b);
+		atomicAdd(pixels[offset + 3], value.a);
+		return;
+	}
+
+	/// Positive floats keep their order as uints, so the depth can be compared with integer atomics.
+	/// It is inverted, so the empty pixel (zero) is behind everything.
+	uint depth = 0xFFFFFFFFu - floatBitsToUint(ndc.z * 0.5 + 0.5);
+	if (stage == 1)
+	{
+		atomicMax(pixels[offset], depth);
+	}
+	else if (pixels[offset] == depth)
+	{
+		pixels[offset + 1] = packUnorm4x8(color);
+	}
+}
@@ -0,0 +1,41 @@
+#version 430
+
+/**
+ * Fragment shader resolving the compute rasterizer framebuffer into premultiplied colors.
+ * (c) 2014 Damian Nowakowski
+ */
+
+layout(std430, binding = 1) readonly buffer FrameBuffer
+{
+	uint pixels[];
+};
+
+uniform ivec2 viewportSize;
+uniform bool additive;
+
+out vec4 outColor;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	int offset = (pixel.y * viewportSize.x + pixel.x) * 4;
+
+	if (additive)
+	{
+		vec4 sum = vec4(pixels[offset + 0], pixels[offset + 1], pixels[offset + 2], pixels[offset + 3]) / 255.0;
+		if (sum.a < 0.01)
+		{
+			discard;
+		}
+		outColor = min(sum, vec4(1.0));
+	}
+	else
+	{
+		if (pixels[offset] == 0u)
+		{
+			discard;
+		}
+		vec4 color = unpackUnorm4x8(pixels[offset + 1]);
+		outColor = vec4(color.rgb * color.a, color.a);
+	}
+}
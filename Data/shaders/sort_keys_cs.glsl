@@ -0,0 +1,80 @@
+#version 430
+
+/**
+ * Compute shader computing keys for sorting particles by their distance from the camera.
+ * Far particles get small keys, so they are drawn first. Dead and not visible particles
+ * get the biggest key, so they are drawn last.
+ * (c) 2014 Damian Nowakowski
+ */
+
+layout(local_size_x = 256) in;
+
+/**
+* Render stream of particles, position bits and the packed color (ParticleRender).
+*/
+layout(std430, binding = 0) readonly buffer ParticlesBuffer
+{
+	uvec4 particles[];
+};
+
+layout(std430, binding = 1) writeonly buffer KeysBuffer
+{
+	uint keys[];
+};
+
+layout(std430, binding = 2) writeonly buffer ValuesBuffer
+{
+	uint values[];
+};
+
+/**
+* Simulation stream of particles, 5 floats per particle (velocity, others).
+* It is read only in analytic mode.
+*/
+layout(std430, binding = 3) readonly buffer SimulationBuffer
+{
+	float simulation[];
+};
+
+uniform mat4 viewMatrix;
+uniform int particlesCount;
+
+/**
+* In analytic mode particles store only the spawn state and
+* others.x is the spawn time (the same as in point_analytic_vs.glsl).
+*/
+uniform bool analytic;
+uniform float time;
+uniform float timePeriod;
+uniform float lifeTime;
+uniform float gravity;
+
+void main()
+{
+	int id = int(gl_GlobalInvocationID.x);
+	if (id >= particlesCount)
+	{
+		return;
+	}
+
+	vec3 position	= uintBitsToFloat(particles[id].xyz);
+	float alpha		= unpackUnorm4x8(particles[id].w).a;
+
+	if (analytic)
+	{
+		int base		= id * 5;
+		vec3 velocity	= vec3(simulation[base + 0], simulation[base + 1], simulation[base + 2]);
+		float age		= mod(time - simulation[base + 3] + timePeriod, timePeriod);
+		if (simulation[base + 4] == 0.0 || age >= lifeTime)
+		{
+			alpha = 0.0;
+		}
+		position	= position + velocity * age;
+		position.y	-= 0.5 * gravity * age * age;
+	}
+
+	/// Positive floats keep their order as uints, so the inverted bits sort far particles first.
+	float depth = -(viewMatrix * vec4(position, 1.0)).z;
+	keys[id]	= (alpha < 0.01 || depth <= 0.0) ? 0xFFFFFFFFu : 0xFFFFFFFFu - floatBitsToUint(depth);
+	values[id]	= uint(id);
+}
@@ -0,0 +1,85 @@
+#version 400
+
+/**
+ * Fragment shader upsampling the reduced resolution particles target.
+ * Four closest texels are blended bilinearly, but covered texels much farther than
+ * the closest covered one get lower weights, so far particles don't bleed over
+ * the edges of near ones.
+ * (c) 2014 Damian Nowakowski
+ */
+
+uniform sampler2D colorTexture;
+uniform sampler2D depthTexture;
+
+uniform ivec2 targetSize;	// Used part of the target in pixels
+uniform vec2 targetScale;	// Target size divided by the main framebuffer size
+uniform vec2 projection;	// projection[2][2] and projection[3][2] for linearizing depth
+
+out vec4 outColor;
+
+/**
+* How fast the weight falls with the relative distance from the closest covered texel.
+*/
+const float DEPTH_SHARPNESS = 32.0;
+
+/**
+* Convert the depth buffer value to the distance from the camera.
+*/
+float LinearDepth(float depth)
+{
+	return projection.y / (depth * 2.0 - 1.0 + projection.x);
+}
+
+void main()
+{
+	/// Position in the target texels, where texel centers are at .5
+	vec2 position	= gl_FragCoord.xy * targetScale - 0.5;
+	ivec2 base		= ivec2(floor(position));
+	vec2 fraction	= position - vec2(base);
+
+	vec4 colors[4];
+	float depths[4];
+	float bilinear[4] = float[4](
+		(1.0 - fraction.x) * (1.0 - fraction.y),
+		fraction.x * (1.0 - fraction.y),
+		(1.0 - fraction.x) * fraction.y,
+		fraction.x * fraction.y);
+
+	/// Find the closest covered texel
+	float closest = 1.0;
+	for (int i = 0; i < 4; i++)
+	{
+		ivec2 texel	= clamp(base + ivec2(i & 1, i >> 1), ivec2(0), targetSize - 1);
+		colors[i]	= texelFetch(colorTexture, texel, 0);
+		depths[i]	= texelFetch(depthTexture, texel, 0).r;
+		if (colors[i].a > 0.0)
+		{
+			closest = min(closest, depths[i]);
+		}
+	}
+
+	if (closest == 1.0)
+	{
+		discard;
+	}
+
+	/// Empty texels keep their bilinear weight (they fade particles out),
+	/// covered ones are weighted by their relative distance to the closest one.
+	float closestDistance = LinearDepth(closest);
+	vec4 color = vec4(0.0);
+	float weights = 0.0;
+	for (int i = 0; i < 4; i++)
+	{
+		float weight = bilinear[i];
+		if (colors[i].a > 0.0)
+		{
+			float difference = (LinearDepth(depths[i]) - closestDistance) / closestDistance;
+			weight /= 1.0 + difference * DEPTH_SHARPNESS;
+		}
+		color	+= colors[i] * weight;
+		weights	+= weight;
+	}
+
+	outColor		= color / max(weights, 0.0001);
+	gl_FragDepth	= closest;
+}
@@ -0,0 +1,158 @@
+/**
+* GPU Particles example.
+*
+* This is a memory arena class. It reserves one big block of memory straight from
+* the system and serves aligned allocations from it.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Arena.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+/**
+* Simple constructor
+*/
+Arena::Arena()
+{
+	memory		= NULL;
+	mapping		= NULL;
+	mappingSize	= 0;
+	capacity	= 0;
+	used		= 0;
+	pages		= ARENA_PAGES_NORMAL;
+}
+
+/**
+* Reserve the memory of the arena. When explicit huge pages aren't available
+* the arena falls back to transparent and then to normal pages.
+* @param capacity	- size of the arena in bytes.
+* @param pages		- which pages should back the memory.
+* @returns true if the memory was reserved.
+*/
+bool Arena::Init(size_t capacity, ArenaPages pages)
+{
+	this->capacity	= capacity;
+	this->pages		= pages;
+	used			= 0;
+
+#ifdef _WIN32
+	/// Large pages need the "Lock pages in memory" privilege and the size rounded to the large page
+	if (pages == ARENA_PAGES_EXPLICIT)
+	{
+		size_t largePageSize = GetLargePageMinimum();
+		if (largePageSize > 0)
+		{
+			mappingSize	= (capacity + largePageSize - 1) / largePageSize * largePageSize;
+			mapping		= VirtualAlloc(NULL, mappingSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		}
+		if (mapping == NULL)
+		{
+			printf("Large pages are not available (the privilege to lock pages is needed), normal pages are used\n");
+		}
+	}
+
+	/// Windows has no transparent huge pages, normal pages are committed lazily on the first touch
+	if (mapping == NULL)
+	{
+		this->pages	= ARENA_PAGES_NORMAL;
+		mappingSize	= capacity;
+		mapping		= VirtualAlloc(NULL, mappingSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	memory = (char*)mapping;
+#else
+	/// Explicit huge pages come from the pool reserved by the system (vm.nr_hugepages)
+#ifdef MAP_HUGETLB
+	if (pages == ARENA_PAGES_EXPLICIT)
+	{
+		mappingSize	= (capacity + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE * ARENA_HUGE_PAGE_SIZE;
+		mapping		= mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			printf("Explicit huge pages are not available (see vm.nr_hugepages), transparent huge pages are used\n");
+			mapping = NULL;
+		}
+		memory = (char*)mapping;
+	}
+#endif
+
+	/// Other memory is mapped with the spare huge page, so the arena can start on the huge page
+	/// boundary, and marked as the candidate for transparent huge pages
+	if (mapping == NULL)
+	{
+		if (this->pages == ARENA_PAGES_EXPLICIT)
+		{
+			this->pages = ARENA_PAGES_TRANSPARENT;
+		}
+		mappingSize	= capacity + ARENA_HUGE_PAGE_SIZE;
+		mapping		= mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			mapping = NULL;
+		}
+		else
+		{
+			uintptr_t address	= ((uintptr_t)mapping + ARENA_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1);
+			memory				= (char*)address;
+#ifdef MADV_HUGEPAGE
+			if (this->pages == ARENA_PAGES_TRANSPARENT)
+			{
+				madvise(memory, capacity, MADV_HUGEPAGE);
+			}
+#else
+			this->pages = ARENA_PAGES_NORMAL;
+#endif
+		}
+	}
+#endif
+
+	if (mapping == NULL)
+	{
+		printf("Can't reserve %llu MB of memory\n", (unsigned long long)(capacity >> 20));
+		memory			= NULL;
+		mappingSize		= 0;
+		this->capacity	= 0;
+		return false;
+	}
+	return true;
+}
+
+/**
+* Take the aligned block of memory from the arena.
+* @param size		- size of the block in bytes.
+* @param alignment	- alignment of the block (power of two).
+* @returns pointer to the block or NULL if the arena is too small.
+*/
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	size_t offset = (used + alignment - 1) & ~(alignment - 1);
+	if (memory == NULL || offset > capacity || size > capacity - offset)
+	{
+		return NULL;
+	}
+	used = offset + size;
+	return memory + offset;
+}
+
+/**
+* Simple destructor releasing the whole memory.
+*/
+Arena::~Arena()
+{
+	if (mapping != NULL)
+	{
+#ifdef _WIN32
+		VirtualFree(mapping, 0, MEM_RELEASE);
+#else
+		munmap(mapping, mappingSize);
+#endif
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a memory arena class. It reserves one big block of memory straight from
+* the system and serves aligned allocations from it, so pools of hundreds of millions
+* of particles can be backed by huge pages (fewer TLB misses when the update streams
+* through gigabytes). Pages aren't touched by the arena, so they are placed in the NUMA
+* node of the thread which touches them first, and the system gives them zeroed. Allocations are freed all at once when
+* the arena is destroyed.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <cstddef>
+
+// Define the default alignment of allocations (the cache line)
+#define ARENA_ALIGNMENT			64
+
+// Define the size of the huge page the transparent arena is aligned to
+#define ARENA_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+/**
+* Which pages back the memory of the arena.
+*/
+enum ArenaPages
+{
+	ARENA_PAGES_NORMAL		= 0,	///< Normal pages of the system.
+	ARENA_PAGES_TRANSPARENT	= 1,	///< Normal pages which the system may merge into huge pages (Linux THP).
+	ARENA_PAGES_EXPLICIT	= 2		///< Huge pages reserved by the system (hugetlbfs pool, Windows large pages).
+};
+
+class Arena
+{
+public:
+	/**
+	* Simple constructor and destructor. The destructor releases the whole memory.
+	*/
+	Arena();
+	~Arena();
+
+	/**
+	* Reserve the memory of the arena. When explicit huge pages aren't available
+	* the arena falls back to transparent and then to normal pages.
+	* @param capacity	- size of the arena in bytes.
+	* @param pages		- which pages should back the memory.
+	* @returns true if the memory was reserved.
+	*/
+	bool Init(size_t capacity, ArenaPages pages);
+
+	/**
+	* Take the aligned block of memory from the arena.
+	* @param size		- size of the block in bytes.
+	* @param alignment	- alignment of the block (power of two).
+	* @returns pointer to the block or NULL if the arena is too small.
+	*/
+	void* Allocate(size_t size, size_t alignment = ARENA_ALIGNMENT);
+
+	/**
+	* Get the size of the arena in bytes.
+	*/
+	size_t GetCapacity() { return capacity; }
+
+	/**
+	* Get pages which really back the memory (after fallbacks).
+	*/
+	ArenaPages GetPages() { return pages; }
+
+private:
+	char* memory;			///< Aligned beginning of the arena.
+	void* mapping;			///< Memory returned by the system (freed in the destructor).
+	size_t mappingSize;		///< Size of the memory returned by the system.
+	size_t capacity;		///< Size of the arena in bytes.
+	size_t used;			///< How many bytes were already allocated.
+	ArenaPages pages;		///< Pages which back the memory.
+};
@@ -11,6 +11,7 @@
 #include "Window.h"
 #include <GLM/gtc/matrix_transform.hpp>
 #include <GLM/gtc/constants.hpp>
+#include <GLM/gtc/type_ptr.hpp>
 
 // Shortcut for transforming vec3 using mat4
 #define TRANSFORM(v,m) (glm::vec3)(glm::vec4(v, 1.0f) * m)
@@ -61,6 +62,18 @@ Camera::Camera()
 	// Set the projection matrix, we will use it many times after that.
 	projectionMatrix = glm::mat4() * glm::perspective(FOV, ratio, fnear, ffar); 
 
+	/// Matrices are passed to render shaders through the uniform buffer, so they are
+	/// written once per frame for all programs.
+	UseLateLatch	= localINIReader->GetBoolean("Camera", "LateLatch", true);
+	glGenBuffers(1, &UBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UNIFORM_BINDING, UBO);
+
+	// Always remember the mouse position, so the first late latch won't see a jump
+	glfwGetCursorPos(ENGINE->window->glfwWindow, &oldMouseX, &oldMouseY);
+
 	// Run update method once so few properties will be set at the beginning
 	Update(0);
 }
@@ -78,33 +91,127 @@ void Camera::Update(float deltaTime)
 	rotationAngle.y = glm::clamp(rotationAngle.y, -glm::half_pi<GLfloat>(), glm::half_pi<GLfloat>());
 	
 	// Create camera rotation matrix
-	glm::mat4 cameraRotation = 
-		glm::rotate(glm::mat4(1.0f), this->rotationAngle.y,  glm::vec3(1.0f, 0.0f, 0.0f))*
-		glm::rotate(glm::mat4(1.0f), this->rotationAngle.x,  glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 cameraRotation = GetRotationMatrix(rotationAngle);
 
 	// Move camera in correct direction rotated by the angle (rotation matrix)
 	position	+= TRANSFORM(moveDir*moveSpeed*deltaTime, cameraRotation);
 
+	SetMatrices(position, cameraRotation);
+}
+
+/**
+ * Sample the newest input right before drawing and predict matrices of this camera
+ * as if it was updated with that input for the time passed since the last update.
+ * The position and rotation of the camera aren't changed, the next update applies
+ * the input again. Matrices are written to the uniform buffer of this camera.
+ * @param deltaTime - the time passed since the last update.
+ */
+void Camera::LateLatch(float deltaTime)
+{
+	if (UseLateLatch == false)
+	{
+		return;
+	}
+
+	/// The mouse movement isn't consumed, so the next update applies all of it
+	/// to the real rotation and nothing is lost.
+	if (HandleInput(false) == true)
+	{
+		glm::vec2 angle = rotationAngle + rotateDir*rotateSpeed*deltaTime;
+		angle.y = glm::clamp(angle.y, -glm::half_pi<GLfloat>(), glm::half_pi<GLfloat>());
+		glm::mat4 cameraRotation = GetRotationMatrix(angle);
+		SetMatrices(position + TRANSFORM(moveDir*moveSpeed*deltaTime, cameraRotation), cameraRotation);
+	}
+	else
+	{
+		SetMatrices(position, GetRotationMatrix(rotationAngle));
+	}
+}
+
+/**
+ * Bind the CameraParams uniform block of the program to the uniform buffer of the camera.
+ * @param program - the program using the CameraParams uniform block.
+ */
+void Camera::BindUniformBlock(GLuint program)
+{
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "CameraParams"), CAMERA_UNIFORM_BINDING);
+}
+
+/**
+ * Get the rotation matrix of this camera.
+ * @param angle - XY angle of camera rotation in radians.
+ */
+glm::mat4 Camera::GetRotationMatrix(const glm::vec2& angle)
+{
+	return	glm::rotate(glm::mat4(1.0f), angle.y,  glm::vec3(1.0f, 0.0f, 0.0f))*
+			glm::rotate(glm::mat4(1.0f), angle.x,  glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+/**
+ * Set view and view projection matrices and write all matrices to the uniform buffer.
+ * @param eye				- position of the camera.
+ * @param cameraRotation	- rotation matrix of the camera.
+ */
+void Camera::SetMatrices(const glm::vec3& eye, const glm::mat4& cameraRotation)
+{
 	// Set the point where camera is looking based on camera position and rotated original look.
-	look		= position + TRANSFORM(originalLook, cameraRotation);
+	look		= eye + TRANSFORM(originalLook, cameraRotation);
 
 	// Set the camera's up, simply rotate the original up.
 	up			= TRANSFORM(originalUp, cameraRotation);
 
 	// Set the new camera view matrix based on new position and direction
-	viewMatrix = glm::mat4() * glm::lookAt(position, look, up);
+	viewMatrix = glm::mat4() * glm::lookAt(eye, look, up);
 
 	// Multiply projection and view matrix to get complete ViewProjectionMatrix.
 	// This matrix is commonly used in transforming verticies based on camera position
 	// and perspective.
 	viewProjectionMatrix = projectionMatrix * viewMatrix;
+
+	// Write matrices in the order of the CameraParams uniform block
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(viewMatrix));
+	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(projectionMatrix));
+	glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(viewProjectionMatrix));
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/**
+ * Check if the axis aligned box is at least partially inside the frustum of this camera.
+ * The test is conservative, so some boxes close to frustum corners are reported as visible.
+ * @param min - minimum corner of the box.
+ * @param max - maximum corner of the box.
+ * @returns true if the box can be visible.
+ */
+bool Camera::IsBoxVisible(const glm::vec3& min, const glm::vec3& max)
+{
+	/// Frustum planes are sums and differences of the last row of the view projection
+	/// matrix with other rows (rows are columns of the transposed matrix).
+	glm::mat4 rows = glm::transpose(viewProjectionMatrix);
+	glm::vec4 planes[6] = {	rows[3] + rows[0], rows[3] - rows[0],
+							rows[3] + rows[1], rows[3] - rows[1],
+							rows[3] + rows[2], rows[3] - rows[2] };
+
+	/// The box is outside when its corner farthest along the plane normal is behind the plane.
+	for (int i = 0; i < 6; i++)
+	{
+		glm::vec3 corner(	planes[i].x > 0 ? max.x : min.x,
+							planes[i].y > 0 ? max.y : min.y,
+							planes[i].z > 0 ? max.z : min.z);
+		if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 /**
  * Handle the input controlling this camera
+ * @param consumeMouse - false if the mouse movement has to be applied again in the next call.
  * @returns true if there was an input.
  */
-bool Camera::HandleInput()
+bool Camera::HandleInput(bool consumeMouse)
 {
 	// Remember the local glfw Window so we won't have to get it all the time
 	// (do not change the name of this variable, used in Macro!)
@@ -129,12 +236,15 @@ bool Camera::HandleInput()
 		rotateDir.x = (float)(mouseX - oldMouseX);
 		rotateDir.y = (float)(mouseY - oldMouseY);
 
-		oldMouseX = mouseX;
-		oldMouseY = mouseY;
+		if (consumeMouse == true)
+		{
+			oldMouseX = mouseX;
+			oldMouseY = mouseY;
+		}
 
 		isMoving = true;	
 	}
-	else
+	else if (consumeMouse == true)
 	{
 		// Always remember the mouse position so when the mouse will be clicked
 		// there won't be jump in camera rotation.
@@ -157,4 +267,12 @@ bool Camera::HandleInput()
 
 	// Return if camera is moving and has to be updated
 	return isMoving;
+}
+
+/**
+ * Simple destructor
+ */
+Camera::~Camera()
+{
+	glDeleteBuffers(1, &UBO);
 }
\ No newline at end of file
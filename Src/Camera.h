@@ -16,13 +16,17 @@
 #include <GL/glew.h>
 #include <GLM/glm.hpp>
 
+// Define the binding point of the CameraParams uniform block (0 is used by particles update)
+#define CAMERA_UNIFORM_BINDING	1
+
 class Camera
 {
 public:
 	/**
-	 * Simple constructor
+	 * Simple constructor and destructor
 	 */
 	Camera();
+	~Camera();
 
 	int renderWidth;	///< Width of render target and camera
 	int renderHeight;	///< Height of render target and camera
@@ -54,14 +58,52 @@ public:
 	 */
 	void Update(float deltaTime);
 
+	/**
+	 * Sample the newest input right before drawing and predict matrices of this camera
+	 * as if it was updated with that input for the time passed since the last update.
+	 * The position and rotation of the camera aren't changed, the next update applies
+	 * the input again. Matrices are written to the uniform buffer of this camera.
+	 * @param deltaTime - the time passed since the last update.
+	 */
+	void LateLatch(float deltaTime);
+
+	/**
+	 * Bind the CameraParams uniform block of the program to the uniform buffer of the camera.
+	 * @param program - the program using the CameraParams uniform block.
+	 */
+	static void BindUniformBlock(GLuint program);
+
+	/**
+	 * Check if the axis aligned box is at least partially inside the frustum of this camera.
+	 * The test is conservative, so some boxes close to frustum corners are reported as visible.
+	 * @param min - minimum corner of the box.
+	 * @param max - maximum corner of the box.
+	 * @returns true if the box can be visible.
+	 */
+	bool IsBoxVisible(const glm::vec3& min, const glm::vec3& max);
+
 	/**
 	 * Handle the input controlling this camera.
+	 * @param consumeMouse - false if the mouse movement has to be applied again in the next call.
 	 * @returns true if there was an input.
 	 */
-	bool HandleInput();
+	bool HandleInput(bool consumeMouse = true);
 
 private:
 
+	/**
+	 * Get the rotation matrix of this camera.
+	 * @param angle - XY angle of camera rotation in radians.
+	 */
+	glm::mat4 GetRotationMatrix(const glm::vec2& angle);
+
+	/**
+	 * Set view and view projection matrices and write all matrices to the uniform buffer.
+	 * @param eye				- position of the camera.
+	 * @param cameraRotation	- rotation matrix of the camera.
+	 */
+	void SetMatrices(const glm::vec3& eye, const glm::mat4& cameraRotation);
+
 	GLfloat FOV;					///< Field Of View
 	GLfloat ratio;					///< Aspect ratio
 	GLfloat fnear;					///< Near plane of camera frustum
@@ -87,4 +129,7 @@ private:
 
 	double oldMouseX;				///< Remembered the previous X position of mouse for checking camera's rotation directory
 	double oldMouseY;				///< Remembered the previous Y position of mouse for checking camera's rotation directory
+
+	bool UseLateLatch;				///< Tells if matrices are predicted from the newest input right before drawing
+	GLuint UBO;						///< Uniform buffer with view, projection and view projection matrices
 };
\ No newline at end of file
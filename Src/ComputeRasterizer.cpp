@@ -0,0 +1,154 @@
+/**
+* GPU Particles example.
+*
+* This is a compute rasterizer class. It draws one pixel particles without the
+* fixed-function pipeline: the compute shader projects every particle and accumulates
+* its color into the integer framebuffer (shader storage buffer) with atomics, then
+* the full-screen pass resolves the framebuffer and blends it over the scene.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "ComputeRasterizer.h"
+#include "Shaders.h"
+
+#include <GLM/gtc/type_ptr.hpp>
+
+/**
+* Simple constructor
+*/
+ComputeRasterizer::ComputeRasterizer()
+{
+	width				= 0;
+	height				= 0;
+	blend				= COMPUTE_RASTERIZER_ADDITIVE;
+	shader_rasterize	= 0;
+	shader_resolve		= 0;
+	framebuffer			= 0;
+	VAO					= 0;
+}
+
+/**
+* Check if the current OpenGL context supports the compute rasterizer.
+*/
+bool ComputeRasterizer::IsSupported()
+{
+	return GLEW_VERSION_4_3 == GL_TRUE;
+}
+
+/**
+* Create shaders and the framebuffer.
+* @param width	- width of the framebuffer in pixels.
+* @param height	- height of the framebuffer in pixels.
+* @param blend	- how colors of particles in the same pixel are combined.
+*/
+void ComputeRasterizer::Init(int width, int height, ComputeRasterizerBlend blend)
+{
+	this->width		= width;
+	this->height	= height;
+	this->blend		= blend;
+
+	Shaders::AttachShader(shader_rasterize, GL_COMPUTE_SHADER, "data/shaders/rasterize_cs.glsl");
+	Shaders::LinkProgram(shader_rasterize);
+
+	Shaders::AttachShader(shader_resolve, GL_VERTEX_SHADER, "data/shaders/fullscreen_vs.glsl");
+	Shaders::AttachShader(shader_resolve, GL_FRAGMENT_SHADER, "data/shaders/rasterize_resolve_fs.glsl");
+	Shaders::LinkProgram(shader_resolve);
+
+	/// Uniforms which never change are set only once
+	glUseProgram(shader_rasterize);
+	glUniform2i(glGetUniformLocation(shader_rasterize, "viewportSize"), width, height);
+	glUseProgram(shader_resolve);
+	glUniform2i(glGetUniformLocation(shader_resolve, "viewportSize"), width, height);
+	glUniform1i(glGetUniformLocation(shader_resolve, "additive"), blend == COMPUTE_RASTERIZER_ADDITIVE ? 1 : 0);
+	glUseProgram(0);
+
+	glGenBuffers(1, &framebuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, framebuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)width * height * 4 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenVertexArrays(1, &VAO);
+}
+
+/**
+* Rasterize particles and blend the result over the current framebuffer.
+* @param renderBuffer		- buffer with the render stream of particles (ParticleRender).
+* @param simulationBuffer	- buffer with the simulation stream of particles (used only in analytic mode).
+* @param count				- how many particles (from the first one) to draw.
+* @param viewProjection		- view projection matrix of the camera.
+* @param analytic			- true if particles store the spawn state (analytic mode).
+*/
+void ComputeRasterizer::Draw(const GLuint* renderBuffers, const GLuint* simulationBuffers, const int* counts, int buffersCount, const glm::mat4& viewProjection, bool analytic)
+{
+	/// Zero is empty pixel in both blend modes (depth is stored inverted)
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, framebuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, framebuffer);
+
+	glUseProgram(shader_rasterize);
+	glUniformMatrix4fv(glGetUniformLocation(shader_rasterize, "viewProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+	glUniform1i(glGetUniformLocation(shader_rasterize, "analytic"), analytic == true ? 1 : 0);
+
+	/// Front-most blend needs two passes: the first one finds the closest depth of every
+	/// pixel, the second one writes the color of the particle with that depth. Every pass
+	/// goes over all buffers, so the closest depth is found among all particles.
+	int firstStage	= (blend == COMPUTE_RASTERIZER_ADDITIVE) ? 0 : 1;
+	int lastStage	= (blend == COMPUTE_RASTERIZER_ADDITIVE) ? 0 : 2;
+	for (int stage = firstStage; stage <= lastStage; stage++)
+	{
+		glUniform1i(glGetUniformLocation(shader_rasterize, "stage"), stage);
+		for (int i = 0; i < buffersCount; i++)
+		{
+			if (counts[i] <= 0)
+			{
+				continue;
+			}
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, renderBuffers[i]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, simulationBuffers[i]);
+			glUniform1i(glGetUniformLocation(shader_rasterize, "particlesCount"), counts[i]);
+			glDispatchCompute((GLuint)((counts[i] + COMPUTE_RASTERIZER_GROUP_SIZE - 1) / COMPUTE_RASTERIZER_GROUP_SIZE), 1, 1);
+		}
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	/// Resolve produces premultiplied colors, so blend them over the scene without depth test
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(shader_resolve);
+	glBindVertexArray(VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (depthTest == GL_TRUE)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+}
+
+/**
+* Simple destructor clearing all data.
+*/
+ComputeRasterizer::~ComputeRasterizer()
+{
+	if (shader_rasterize != 0)
+	{
+		Shaders::DeleteShaders(shader_rasterize);
+		glDeleteProgram(shader_rasterize);
+		Shaders::DeleteShaders(shader_resolve);
+		glDeleteProgram(shader_resolve);
+		glDeleteBuffers(1, &framebuffer);
+		glDeleteVertexArrays(1, &VAO);
+	}
+}
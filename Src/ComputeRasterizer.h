@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a compute rasterizer class. It draws one pixel particles without the
+* fixed-function pipeline: the compute shader projects every particle and accumulates
+* its color into the integer framebuffer (shader storage buffer) with atomics, then
+* the full-screen pass resolves the framebuffer and blends it over the scene.
+* There is no per-primitive setup, blending or discard, so huge particles counts cost
+* about as much as reading particles data once.
+*
+* Framebuffer layout (four uints per pixel):
+* - Additive blend:	sums of r*a, g*a, b*a and a (scaled by 255).
+* - Front-most:		inverted depth (atomicMax), packed RGBA8 color of the front-most particle.
+*
+* It needs OpenGL 4.3 (compute shaders and shader storage buffers).
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <GL/glew.h>
+#include <GLM/glm.hpp>
+
+// Define the number of particles processed by one compute shader work group
+// (must match local_size_x in rasterize_cs.glsl)
+#define COMPUTE_RASTERIZER_GROUP_SIZE	256
+
+/**
+* How colors of particles falling into the same pixel are combined.
+*/
+enum ComputeRasterizerBlend
+{
+	COMPUTE_RASTERIZER_ADDITIVE		= 0,	///< Premultiplied colors are summed.
+	COMPUTE_RASTERIZER_FRONT_MOST	= 1		///< Only the particle closest to the camera is visible.
+};
+
+class ComputeRasterizer
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	ComputeRasterizer();
+	~ComputeRasterizer();
+
+	/**
+	* Check if the current OpenGL context supports the compute rasterizer.
+	*/
+	static bool IsSupported();
+
+	/**
+	* Create shaders and the framebuffer.
+	* @param width	- width of the framebuffer in pixels.
+	* @param height	- height of the framebuffer in pixels.
+	* @param blend	- how colors of particles in the same pixel are combined.
+	*/
+	void Init(int width, int height, ComputeRasterizerBlend blend);
+
+	/**
+	* Get the program of the rasterizing compute shader, so the caller can set its
+	* particles specific uniforms (like the analytic mode ones) before drawing.
+	*/
+	GLuint GetProgram() { return shader_rasterize; }
+
+	/**
+	* Rasterize particles from all buffers into one framebuffer and blend the result over
+	* the current framebuffer.
+	* @param renderBuffers		- buffers with the render stream of particles (ParticleRender).
+	* @param simulationBuffers	- buffers with the simulation stream of particles (used only in analytic mode).
+	* @param counts				- how many particles (from the first one) to draw from every buffer.
+	* @param buffersCount		- number of buffers.
+	* @param viewProjection		- view projection matrix of the camera.
+	* @param analytic			- true if particles store the spawn state (analytic mode).
+	*/
+	void Draw(const GLuint* renderBuffers, const GLuint* simulationBuffers, const int* counts, int buffersCount, const glm::mat4& viewProjection, bool analytic);
+
+private:
+	int width;						///< Width of the framebuffer in pixels.
+	int height;						///< Height of the framebuffer in pixels.
+	ComputeRasterizerBlend blend;	///< How colors of particles in the same pixel are combined.
+
+	GLuint shader_rasterize;		///< Id of the compute shader projecting and accumulating particles.
+	GLuint shader_resolve;			///< Id of the full-screen shader blending the framebuffer over the scene.
+	GLuint framebuffer;				///< Shader storage buffer with the integer framebuffer.
+	GLuint VAO;						///< Empty vertex array object for the full-screen pass.
+};
@@ -0,0 +1,220 @@
+/**
+* GPU Particles example.
+*
+* This is a depth sorter class. It sorts particles by their distance from the camera
+* on the GPU, so they can be drawn back to front and alpha blending is correct without
+* the depth writes. The result is the index buffer used for drawing.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "DepthSorter.h"
+#include "Shaders.h"
+
+#include <GLM/gtc/type_ptr.hpp>
+
+#include <cstdio>
+
+/**
+* Simple constructor
+*/
+DepthSorter::DepthSorter()
+{
+	count			= 0;
+	groupsCount		= 0;
+	shader_keys		= 0;
+	shader_sort		= 0;
+	shader_scan		= 0;
+	keys[0]			= keys[1]	= 0;
+	values[0]		= values[1]	= 0;
+	histogram		= 0;
+	query			= 0;
+	isQueryPending	= false;
+	measuredTime	= 0;
+	measuredCount	= 0;
+}
+
+/**
+* Check if the current OpenGL context supports the depth sorter.
+*/
+bool DepthSorter::IsSupported()
+{
+	return GLEW_VERSION_4_3 == GL_TRUE;
+}
+
+/**
+* Create shaders and buffers.
+* @param count - how many particles will be sorted.
+*/
+void DepthSorter::Init(int count)
+{
+	Shaders::AttachShader(shader_keys, GL_COMPUTE_SHADER, "data/shaders/sort_keys_cs.glsl");
+	Shaders::LinkProgram(shader_keys);
+	Shaders::AttachShader(shader_sort, GL_COMPUTE_SHADER, "data/shaders/radix_sort_cs.glsl");
+	Shaders::LinkProgram(shader_sort);
+	Shaders::AttachShader(shader_scan, GL_COMPUTE_SHADER, "data/shaders/radix_scan_cs.glsl");
+	Shaders::LinkProgram(shader_scan);
+
+	glGenBuffers(2, keys);
+	glGenBuffers(2, values);
+	glGenBuffers(1, &histogram);
+	glGenQueries(1, &query);
+
+	Resize(count);
+}
+
+/**
+* Reallocate buffers for the new count of particles. Shaders are kept and the index
+* buffer keeps its name, so textures reading it don't have to be updated.
+* @param count - how many particles will be sorted.
+*/
+void DepthSorter::Resize(int count)
+{
+	this->count	= count;
+	groupsCount	= (GLuint)((count + DEPTH_SORTER_TILE_SIZE - 1) / DEPTH_SORTER_TILE_SIZE);
+
+	/// Uniforms which depend only on the count are set only once
+	glUseProgram(shader_keys);
+	glUniform1i(glGetUniformLocation(shader_keys, "particlesCount"), count);
+	glUseProgram(shader_sort);
+	glUniform1i(glGetUniformLocation(shader_sort, "count"), count);
+	glUseProgram(shader_scan);
+	glUniform1i(glGetUniformLocation(shader_scan, "size"), (GLint)(groupsCount * DEPTH_SORTER_RADIX));
+	glUseProgram(0);
+
+	for (int i = 0; i < 2; i++)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, keys[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)count * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, values[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)count * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogram);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)groupsCount * DEPTH_SORTER_RADIX * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/**
+* Collect the time of the previous sort if it is ready and print the average cost
+* every DEPTH_SORTER_REPORT_PERIOD sorts.
+* @returns true if the query can be used for the next sort.
+*/
+bool DepthSorter::CollectTime()
+{
+	if (isQueryPending == false)
+	{
+		return true;
+	}
+
+	/// Don't wait for the GPU, skip measuring of this sort instead
+	GLuint isAvailable = GL_FALSE;
+	glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+	if (isAvailable == GL_FALSE)
+	{
+		return false;
+	}
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+	isQueryPending = false;
+	measuredTime += elapsed / 1000000.0;
+	measuredCount++;
+
+	if (measuredCount == DEPTH_SORTER_REPORT_PERIOD)
+	{
+		double averageTime = measuredTime / measuredCount;
+		printf("Depth sort of %d particles: %.3f ms (%.3f ms per million particles)\n", count, averageTime, averageTime * 1000000.0 / count);
+		measuredTime	= 0;
+		measuredCount	= 0;
+	}
+	return true;
+}
+
+/**
+* Sort particles by their distance from the camera, far ones first.
+* @param renderBuffer		- buffer with the render stream of particles (ParticleRender).
+* @param simulationBuffer	- buffer with the simulation stream of particles (used only in analytic mode).
+* @param view				- view matrix of the camera.
+* @param analytic			- true if particles store the spawn state (analytic mode).
+*/
+void DepthSorter::Sort(GLuint renderBuffer, GLuint simulationBuffer, const glm::mat4& view, bool analytic)
+{
+	bool isMeasured = CollectTime();
+	if (isMeasured == true)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, query);
+	}
+
+	/// Compute keys and initial indices
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, renderBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, values[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, simulationBuffer);
+
+	glUseProgram(shader_keys);
+	glUniformMatrix4fv(glGetUniformLocation(shader_keys, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
+	glUniform1i(glGetUniformLocation(shader_keys, "analytic"), analytic == true ? 1 : 0);
+	glDispatchCompute((GLuint)((count + DEPTH_SORTER_GROUP_SIZE - 1) / DEPTH_SORTER_GROUP_SIZE), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	/// Four passes of 8-bit digits, so the result ends in the first buffers
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, histogram);
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		int source = (shift / 8) % 2;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, keys[source]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, values[source]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, keys[1 - source]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, values[1 - source]);
+
+		glUseProgram(shader_sort);
+		glUniform1i(glGetUniformLocation(shader_sort, "shift"), shift);
+		glUniform1i(glGetUniformLocation(shader_sort, "stage"), 0);
+		glDispatchCompute(groupsCount, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(shader_scan);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(shader_sort);
+		glUniform1i(glGetUniformLocation(shader_sort, "stage"), 1);
+		glDispatchCompute(groupsCount, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	glUseProgram(0);
+
+	// Sorted indices are used as the element buffer
+	glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	for (GLuint i = 0; i < 5; i++)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+	}
+
+	if (isMeasured == true)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		isQueryPending = true;
+	}
+}
+
+/**
+* Simple destructor clearing all data.
+*/
+DepthSorter::~DepthSorter()
+{
+	if (shader_keys != 0)
+	{
+		Shaders::DeleteShaders(shader_keys);
+		glDeleteProgram(shader_keys);
+		Shaders::DeleteShaders(shader_sort);
+		glDeleteProgram(shader_sort);
+		Shaders::DeleteShaders(shader_scan);
+		glDeleteProgram(shader_scan);
+		glDeleteBuffers(2, keys);
+		glDeleteBuffers(2, values);
+		glDeleteBuffers(1, &histogram);
+		glDeleteQueries(1, &query);
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a depth sorter class. It sorts particles by their distance from the camera
+* on the GPU, so they can be drawn back to front and alpha blending is correct without
+* the depth writes. The result is the index buffer used for drawing.
+*
+* Sorting is the LSD radix sort of 32-bit keys with 8-bit digits in compute shaders:
+* - sort_keys_cs.glsl: key of every particle is its inverted view depth (far first),
+*   dead particles get the biggest key, so they are drawn last.
+* - radix_sort_cs.glsl (histogram stage): every work group counts digits of its tile.
+* - radix_scan_cs.glsl: counts are scanned in (digit, group) order into offsets.
+* - radix_sort_cs.glsl (scatter stage): every work group sorts its tile locally with
+*   1-bit splits and scatters it to the offsets, so the sort is stable.
+*
+* It needs OpenGL 4.3 (compute shaders and shader storage buffers).
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <GL/glew.h>
+#include <GLM/glm.hpp>
+
+// Define the number of threads of sorting work groups and the tile of one group
+// (must match GROUP_SIZE and ITEMS_PER_THREAD in radix_sort_cs.glsl)
+#define DEPTH_SORTER_GROUP_SIZE			256
+#define DEPTH_SORTER_ITEMS_PER_THREAD	16
+#define DEPTH_SORTER_TILE_SIZE			(DEPTH_SORTER_GROUP_SIZE * DEPTH_SORTER_ITEMS_PER_THREAD)
+
+// Define the number of digits of one radix sort pass
+#define DEPTH_SORTER_RADIX				256
+
+// Define after how many measured sorts the average cost is printed
+#define DEPTH_SORTER_REPORT_PERIOD		100
+
+class DepthSorter
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	DepthSorter();
+	~DepthSorter();
+
+	/**
+	* Check if the current OpenGL context supports the depth sorter.
+	*/
+	static bool IsSupported();
+
+	/**
+	* Create shaders and buffers.
+	* @param count - how many particles will be sorted.
+	*/
+	void Init(int count);
+
+	/**
+	* Reallocate buffers for the new count of particles. Shaders are kept and the index
+	* buffer keeps its name, so textures reading it don't have to be updated.
+	* @param count - how many particles will be sorted.
+	*/
+	void Resize(int count);
+
+	/**
+	* Get the program computing sorting keys, so the caller can set its particles
+	* specific uniforms (like the analytic mode ones) before sorting.
+	*/
+	GLuint GetKeysProgram() { return shader_keys; }
+
+	/**
+	* Sort particles by their distance from the camera, far ones first.
+	* @param renderBuffer		- buffer with the render stream of particles (ParticleRender).
+	* @param simulationBuffer	- buffer with the simulation stream of particles (used only in analytic mode).
+	* @param view				- view matrix of the camera.
+	* @param analytic			- true if particles store the spawn state (analytic mode).
+	*/
+	void Sort(GLuint renderBuffer, GLuint simulationBuffer, const glm::mat4& view, bool analytic);
+
+	/**
+	* Get the buffer with sorted particles indices (unsigned ints).
+	*/
+	GLuint GetIndexBuffer() { return values[0]; }
+
+private:
+	/**
+	* Collect the time of the previous sort if it is ready and print the average cost
+	* every DEPTH_SORTER_REPORT_PERIOD sorts.
+	* @returns true if the query can be used for the next sort.
+	*/
+	bool CollectTime();
+
+	int count;						///< How many particles are sorted.
+	GLuint groupsCount;				///< Number of work groups of sorting passes.
+
+	GLuint shader_keys;				///< Id of the compute shader computing keys.
+	GLuint shader_sort;				///< Id of the compute shader counting and scattering digits.
+	GLuint shader_scan;				///< Id of the compute shader scanning digits counts.
+
+	GLuint keys[2];					///< Keys buffers (source and destination of the sorting pass).
+	GLuint values[2];				///< Particles indices buffers moved together with keys.
+	GLuint histogram;				///< Digits counts of every work group, scanned into offsets.
+
+	GLuint query;					///< Time elapsed query measuring the sort.
+	bool isQueryPending;			///< Tells if the query result wasn't collected yet.
+	double measuredTime;			///< Sum of measured sorts times in milliseconds.
+	int measuredCount;				///< Number of measured sorts.
+};
@@ -8,16 +8,25 @@
 */
 
 #include "Engine.h"
+#include "JobSystem.h"
 #include "Scene.h"
 #include "Window.h"
 
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
 // Set the default value of instance pointer to avoid memory ridings
 Engine * Engine::engine = NULL;
 
 /**
  * Definition of key listener inside the engine that is listening for
  * the Esc button. The Esc button stops the engine and thus the application
- * starts to nicely close.
+ * starts to nicely close. All other keys are passed to the scene.
  */
 void OnKey(GLFWwindow * window, int key, int scancode, int action, int mods)
 {	
@@ -25,6 +34,10 @@ void OnKey(GLFWwindow * window, int key, int scancode, int action, int mods)
 	{
 		ENGINE->StopEngine();
 	}
+	else
+	{
+		ENGINE->scene->OnKey(key, action);
+	}
 }
 
 /**
@@ -66,6 +79,27 @@ void Engine::Init()
 		return;
 	}
 
+	/// Start the job system before the scene, because scene objects use it. It uses all
+	/// hardware threads (together with the main thread), unless configured otherwise.
+	/// Threads are pinned to CPUs only when the affinity policy is set.
+	int threadsCount = (int)config->GetInteger("System", "Threads", 0);
+	if (threadsCount <= 0)
+	{
+		threadsCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	std::string affinityName = config->Get("System", "Affinity", "None");
+	JobAffinity affinity = JOB_AFFINITY_NONE;
+	if (affinityName == "Compact")
+	{
+		affinity = JOB_AFFINITY_COMPACT;
+	}
+	else if (affinityName == "Scatter")
+	{
+		affinity = JOB_AFFINITY_SCATTER;
+	}
+	jobs = new JobSystem();
+	jobs->Init(threadsCount, affinity);
+
 	// Create and init the scene with all objects inside
 	// Init cannot be inside constructor, because many objects
 	// inside scene needs an access to scene during creation.
@@ -90,6 +124,44 @@ void Engine::Init()
 		glfwSwapInterval(0);
 	}
 
+	/// The frame limiter sleeps until the next deadline instead of spinning in the main loop.
+	/// With VSync off every loop still renders, so it sleeps only until the next update.
+	UseFrameLimiter	= config->GetBoolean("System", "FrameLimiter", true);
+	spinTime		= std::max(0.0, config->GetReal("System", "SpinTime", 0.002));
+#ifdef _WIN32
+	// Ask for the 1 ms scheduler resolution, so sleeping doesn't overshoot the whole system tick
+	if (UseFrameLimiter == true)
+	{
+		timeBeginPeriod(1);
+	}
+#endif
+
+	MeasureJitter			= config->GetBoolean("System", "MeasureJitter", false);
+	jitterReportInterval	= std::max(1, (int)config->GetInteger("System", "JitterReportInterval", 120));
+	prevDrawTime			= 0;
+	frameTimeSum			= 0;
+	frameTimeSquaresSum		= 0;
+	frameTimeMax			= 0;
+	frameTimeSamples		= 0;
+
+	/// The latency is measured on the GPU clock from sampling the input for the frame
+	/// to the moment the GPU finishes presenting it.
+	MeasureLatency			= config->GetBoolean("System", "MeasureLatency", false);
+	latencyReportInterval	= config->GetInteger("System", "LatencyReportInterval", 120);
+	if (latencyReportInterval < 1)
+	{
+		latencyReportInterval = 1;
+	}
+	latencyQueryIndex	= 0;
+	latencySum			= 0;
+	latencyMax			= 0;
+	latencySamples		= 0;
+	for (int i = 0; i < LATENCY_QUERIES; i++)
+	{
+		latencyPending[i] = false;
+	}
+	glGenQueries(LATENCY_QUERIES, latencyQueries);
+
 	// Say that engine is currently running
 	isRunning = true;
 }
@@ -129,6 +201,10 @@ void Engine::StopEngine()
  */
 void Engine::Poll()
 {
+	// Poll every glfw events, so the input is as fresh as possible
+	// for both updating and drawing.
+	glfwPollEvents();
+
 	// Calculate the one tick time
 	double time = glfwGetTime();
 	double deltaTime = time - prevTime;
@@ -143,7 +219,8 @@ void Engine::Poll()
 	if (updateTimer >= UPDATE_PERIOD)
 	{
 		// Update it as many times as the update periods passed 
-		// from the previous tick.
+		// from the previous tick. They are merged into one update, the CPU
+		// particles take them as substeps in one pass over their memory.
 		double updateDeltaTime = 0;
 		while (updateTimer >= UPDATE_PERIOD)
 		{
@@ -174,6 +251,77 @@ void Engine::Poll()
 	
 	// Remember current time for calculating next tick time.
 	prevTime = time;
+
+	// Don't spin the loop until there is anything to do
+	if (UseFrameLimiter == true && isRunning == true)
+	{
+		WaitForNextTick();
+	}
+}
+
+/**
+ * Sleep until the nearer of the next update and render deadlines (only the update one when
+ * VSync is off, because every loop renders then). The thread sleeps in glfwWaitEventsTimeout
+ * (so it wakes up on any input) until spinTime before the deadline, then it yields in the loop
+ * until the deadline, so oversleeping doesn't delay the frame.
+ */
+void Engine::WaitForNextTick()
+{
+	/// Timers are from the beginning of this poll, so the time of the work done is subtracted.
+	double now = glfwGetTime();
+	double untilDeadline = (VSync == true) ? std::min(UPDATE_PERIOD - updateTimer, RENDER_PERIOD - renderTimer) : UPDATE_PERIOD - updateTimer;
+	double wait = untilDeadline - (now - prevTime);
+	double deadline = now + wait;
+	if (wait <= 0)
+	{
+		return;
+	}
+
+	if (wait > spinTime)
+	{
+		glfwWaitEventsTimeout(wait - spinTime);
+
+		// Woken up by an event, the next poll handles it and waits again
+		if (glfwGetTime() < deadline - spinTime)
+		{
+			return;
+		}
+	}
+
+	while (glfwGetTime() < deadline)
+	{
+		std::this_thread::yield();
+	}
+}
+
+/**
+ * Measure the interval between this frame and the previous one and print the average
+ * frame time and its jitter every jitterReportInterval frames.
+ */
+void Engine::MeasureFrameTime()
+{
+	double now = glfwGetTime();
+	if (prevDrawTime > 0)
+	{
+		double frameTime = (now - prevDrawTime) * 1000.0;
+		frameTimeSum		+= frameTime;
+		frameTimeSquaresSum	+= frameTime * frameTime;
+		frameTimeMax		= std::max(frameTimeMax, frameTime);
+		frameTimeSamples++;
+	}
+	prevDrawTime = now;
+
+	/// The jitter is the standard deviation of frame times
+	if (frameTimeSamples >= jitterReportInterval)
+	{
+		double average = frameTimeSum / frameTimeSamples;
+		double jitter = sqrt(std::max(0.0, frameTimeSquaresSum / frameTimeSamples - average * average));
+		printf("Frame time: %.3f ms average, %.3f ms jitter, %.3f ms max\n", average, jitter, frameTimeMax);
+		frameTimeSum		= 0;
+		frameTimeSquaresSum	= 0;
+		frameTimeMax		= 0;
+		frameTimeSamples	= 0;
+	}
 }
 
 /**
@@ -184,9 +332,6 @@ void Engine::Update(double updateDeltaTime)
 {
 	// Update scene
 	scene->OnRun(updateDeltaTime);
-
-	// Poll every glfw events
-	glfwPollEvents();
 }
 
 /**
@@ -194,12 +339,77 @@ void Engine::Update(double updateDeltaTime)
  */
 void Engine::Draw()
 {
-	// Draw scene
-	scene->OnDraw();
+	/// Remember when the input of this frame is sampled. When all queries still wait
+	/// for their results this frame isn't measured.
+	bool isMeasured = MeasureLatency == true && latencyPending[latencyQueryIndex] == false;
+	if (isMeasured == true)
+	{
+		glGetInteger64v(GL_TIMESTAMP, &latencyInputTimes[latencyQueryIndex]);
+	}
+
+	// Draw scene with the camera sampled from the newest input
+	// (the time passed since the last update is the update timer)
+	scene->OnDraw(updateTimer);
 
 	// At the end flush opengl and swap buffers.
 	glFlush();
 	glfwSwapBuffers(window->glfwWindow);
+
+	if (isMeasured == true)
+	{
+		glQueryCounter(latencyQueries[latencyQueryIndex], GL_TIMESTAMP);
+		latencyPending[latencyQueryIndex] = true;
+		latencyQueryIndex = (latencyQueryIndex + 1) % LATENCY_QUERIES;
+	}
+	if (MeasureLatency == true)
+	{
+		ReadLatency();
+	}
+	if (MeasureJitter == true)
+	{
+		MeasureFrameTime();
+	}
+}
+
+/**
+ * Read results of finished latency measurements (without waiting for the GPU)
+ * and print the average and maximum latency every latencyReportInterval frames.
+ */
+void Engine::ReadLatency()
+{
+	/// Queries finish in order, so start from the oldest one and stop at the first unfinished
+	for (int i = 0; i < LATENCY_QUERIES; i++)
+	{
+		int query = (latencyQueryIndex + i) % LATENCY_QUERIES;
+		if (latencyPending[query] == false)
+		{
+			continue;
+		}
+
+		GLint isAvailable = 0;
+		glGetQueryObjectiv(latencyQueries[query], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+		if (isAvailable == 0)
+		{
+			break;
+		}
+
+		GLint64 presentTime = 0;
+		glGetQueryObjecti64v(latencyQueries[query], GL_QUERY_RESULT, &presentTime);
+		latencyPending[query] = false;
+
+		double latency = (double)(presentTime - latencyInputTimes[query]) / 1000000.0;
+		latencySum += latency;
+		latencyMax = latency > latencyMax ? latency : latencyMax;
+		latencySamples++;
+	}
+
+	if (latencySamples >= latencyReportInterval)
+	{
+		printf("Input to present latency: %.2f ms average, %.2f ms max\n", latencySum / latencySamples, latencyMax);
+		latencySum		= 0;
+		latencyMax		= 0;
+		latencySamples	= 0;
+	}
 }
 
 /**
@@ -207,7 +417,18 @@ void Engine::Draw()
  */
 Engine::~Engine()
 {
+#ifdef _WIN32
+	if (UseFrameLimiter == true)
+	{
+		timeEndPeriod(1);
+	}
+#endif
+	if (window != NULL && window->glfwWindow != NULL)
+	{
+		glDeleteQueries(LATENCY_QUERIES, latencyQueries);
+	}
 	delete config;
 	delete window;
 	delete scene;
+	delete jobs;
 }
\ No newline at end of file
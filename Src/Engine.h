@@ -38,8 +38,12 @@
 // Define the minimum render period (1/60 seconds)
 #define RENDER_PERIOD	(double)0.016666667
 
+// Define the number of frames measured for the latency at once (results are read when ready)
+#define LATENCY_QUERIES	4
+
 
 // Predefine classes for visibility
+class JobSystem;
 class Scene;
 class Window;
 
@@ -50,6 +54,7 @@ public:
 	INIReader*	config;	///< The configuration ini file reader
 	Window*		window;	///< The glfw window (and opengl initializator)
 	Scene*		scene;	///< The scene where all fun stuff happens
+	JobSystem*	jobs;	///< The job system running CPU tasks of every frame
 
 	/**
 	 * Get the engine instance (singleton).
@@ -108,6 +113,26 @@ private:
 	 */
 	void Draw();
 
+	/**
+	 * Read results of finished latency measurements (without waiting for the GPU)
+	 * and print the average and maximum latency every latencyReportInterval frames.
+	 */
+	void ReadLatency();
+
+	/**
+	 * Sleep until the nearer of the next update and render deadlines (only the update one when
+	 * VSync is off, because every loop renders then). The thread sleeps in glfwWaitEventsTimeout
+	 * (so it wakes up on any input) until spinTime before the deadline, then it yields in the loop
+	 * until the deadline, so oversleeping doesn't delay the frame.
+	 */
+	void WaitForNextTick();
+
+	/**
+	 * Measure the interval between this frame and the previous one and print the average
+	 * frame time and its jitter every jitterReportInterval frames.
+	 */
+	void MeasureFrameTime();
+
 	static Engine* engine;	///< The handler of the engine instance
 	bool isRunning;			///< Flag telling if the engine is running
 	bool VSync;				///< Tells if VSync is on
@@ -116,5 +141,25 @@ private:
 
 	double updateTimer;		///< Time of the one update tick
 	double renderTimer;		///< Time of the one render tick	
+
+	bool UseFrameLimiter;	///< Tells if the loop sleeps until the next deadline instead of spinning
+	double spinTime;		///< Time before the deadline when the sleep changes to the spin
+	bool MeasureJitter;		///< Tells if the frame time jitter is measured
+	int jitterReportInterval;	///< Every how many frames the frame time jitter is printed
+	double prevDrawTime;	///< Time of the previous frame (0 before the first one)
+	double frameTimeSum;	///< Sum of frame times since the last report
+	double frameTimeSquaresSum;	///< Sum of squares of frame times since the last report
+	double frameTimeMax;	///< Maximum frame time since the last report
+	int frameTimeSamples;	///< Number of frame times since the last report
+
+	bool MeasureLatency;	///< Tells if the input to present latency is measured
+	int latencyReportInterval;	///< Every how many measured frames the latency is printed
+	GLuint latencyQueries[LATENCY_QUERIES];		///< Timestamp queries issued after presenting frames
+	GLint64 latencyInputTimes[LATENCY_QUERIES];	///< GPU times at which the input of frames was sampled
+	bool latencyPending[LATENCY_QUERIES];		///< Tells if the query waits for its result
+	int latencyQueryIndex;	///< Query which will be used in the next frame
+	double latencySum;		///< Sum of latencies (in milliseconds) since the last report
+	double latencyMax;		///< Maximum latency (in milliseconds) since the last report
+	int latencySamples;		///< Number of latencies since the last report
 };
 
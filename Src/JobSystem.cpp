@@ -0,0 +1,388 @@
+/**
+* GPU Particles example.
+*
+* This is a job system class. It runs tasks of the task graph on the pool of worker
+* threads with per-thread deques and work stealing, optionally pinned to CPUs.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "JobSystem.h"
+#include "Topology.h"
+
+#include <cstdio>
+
+// Set the default value of instance pointer to avoid memory ridings
+JobSystem * JobSystem::instance = NULL;
+
+// Index of the deque of the current thread (0 for the main thread and all non-worker threads)
+static thread_local int threadIndex = 0;
+
+/**
+* Add the task to the graph.
+* @param function	- the work of the task.
+* @param mainThread	- true if the task has to run on the thread which runs the graph.
+* @returns id of the task.
+*/
+int TaskGraph::Add(std::function<void()> function, bool mainThread)
+{
+	tasks.emplace_back();
+	Task& task				= tasks.back();
+	task.function			= function;
+	task.mainThread			= mainThread;
+	task.thread				= -1;
+	task.dependenciesCount	= 0;
+	task.graph				= this;
+	return (int)tasks.size() - 1;
+}
+
+/**
+* Add the task which runs only on the given thread of the job system. It isn't stolen,
+* so the data it touches stays in the memory of that thread's NUMA node.
+* @param function	- the work of the task.
+* @param thread		- index of the thread (0 is the thread running the graph).
+* @returns id of the task.
+*/
+int TaskGraph::AddOnThread(std::function<void()> function, int thread)
+{
+	int task = Add(function);
+	tasks[task].thread = thread;
+	return task;
+}
+
+/**
+* Make the task run after the other one.
+* @param task		- id of the task which has to wait.
+* @param dependency	- id of the task it waits for.
+*/
+void TaskGraph::Depend(int task, int dependency)
+{
+	tasks[dependency].successors.push_back(task);
+	tasks[task].dependenciesCount++;
+}
+
+/**
+* Remove all tasks from the graph.
+*/
+void TaskGraph::Clear()
+{
+	tasks.clear();
+	mainThreadTasks.clear();
+}
+
+/**
+* Simple constructor
+*/
+JobSystem::JobSystem()
+{
+	readyCount	= 0;
+	affinity	= JOB_AFFINITY_NONE;
+	nodesCount	= 1;
+	isStopping	= false;
+}
+
+/**
+* Get the index of the calling thread (0 for the thread running graphs).
+*/
+int JobSystem::GetThreadIndex()
+{
+	return threadIndex;
+}
+
+/**
+* Start worker threads and pin them (and the calling thread) to CPUs. This job system
+* becomes the instance.
+* @param threadsCount	- number of threads running tasks (together with the calling thread).
+* @param affinity		- how threads are pinned to CPUs.
+*/
+void JobSystem::Init(int threadsCount, JobAffinity affinity)
+{
+	if (threadsCount < 1)
+	{
+		threadsCount = 1;
+	}
+	this->affinity = affinity;
+
+	/// Choose the CPU of every thread. Compact fills nodes one after another, scatter
+	/// takes the next CPU of every node in turns. More threads than CPUs wrap around.
+	std::vector<int> threadCpus(threadsCount, -1);
+	threadNodes.assign(threadsCount, 0);
+	if (affinity != JOB_AFFINITY_NONE)
+	{
+		Topology topology;
+		topology.Detect();
+		nodesCount = topology.GetNodesCount();
+
+		std::vector<std::pair<int, int>> cpus;
+		if (affinity == JOB_AFFINITY_COMPACT)
+		{
+			for (int node = 0; node < nodesCount; node++)
+			{
+				for (size_t i = 0; i < topology.GetNodeCpus(node).size(); i++)
+				{
+					cpus.push_back(std::make_pair(topology.GetNodeCpus(node)[i], node));
+				}
+			}
+		}
+		else
+		{
+			for (size_t i = 0; cpus.size() < (size_t)threadsCount; i++)
+			{
+				for (int node = 0; node < nodesCount; node++)
+				{
+					const std::vector<int>& nodeCpus = topology.GetNodeCpus(node);
+					cpus.push_back(std::make_pair(nodeCpus[i % nodeCpus.size()], node));
+				}
+			}
+		}
+		for (int i = 0; i < threadsCount; i++)
+		{
+			threadCpus[i]	= cpus[i % cpus.size()].first;
+			threadNodes[i]	= cpus[i % cpus.size()].second;
+		}
+		printf("Job system: %d threads pinned to %d NUMA nodes\n", threadsCount, nodesCount);
+	}
+
+	/// Every thread gets its deque, the calling thread uses the first one
+	for (int i = 0; i < threadsCount; i++)
+	{
+		queues.emplace_back();
+		queues.back().boundCount = 0;
+	}
+	if (threadCpus[0] >= 0)
+	{
+		Topology::PinCurrentThread(threadCpus[0]);
+	}
+	for (int i = 1; i < threadsCount; i++)
+	{
+		workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i, threadCpus[i]));
+	}
+
+	instance = this;
+}
+
+/**
+* Run all tasks of the graph and return when all of them are finished. The calling thread
+* runs main thread tasks and helps with others while waiting. It can be called from
+* inside of the task too, then it helps with the work until the inner graph is finished.
+* @param graph - the graph to run.
+*/
+void JobSystem::Run(TaskGraph& graph)
+{
+	if (graph.tasks.empty() == true)
+	{
+		return;
+	}
+
+	/// All counters are set before any task is started, because finished tasks decrease them
+	graph.unfinishedCount = (int)graph.tasks.size();
+	for (size_t i = 0; i < graph.tasks.size(); i++)
+	{
+		graph.tasks[i].waitingFor = graph.tasks[i].dependenciesCount;
+	}
+	for (size_t i = 0; i < graph.tasks.size(); i++)
+	{
+		if (graph.tasks[i].dependenciesCount == 0)
+		{
+			Push(&graph.tasks[i]);
+		}
+	}
+
+	/// Main thread tasks of this graph go first, they are often on the critical path (submission)
+	while (graph.unfinishedCount > 0)
+	{
+		TaskGraph::Task* task = NULL;
+		{
+			std::lock_guard<std::mutex> lock(graph.mainThreadMutex);
+			if (graph.mainThreadTasks.empty() == false)
+			{
+				task = graph.mainThreadTasks.back();
+				graph.mainThreadTasks.pop_back();
+			}
+		}
+		if (task == NULL)
+		{
+			task = Pop();
+		}
+
+		if (task != NULL)
+		{
+			Execute(task);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+/**
+* Make the task ready. Main thread tasks go to their graph, others to the deque of this thread.
+* @param task - the task which doesn't wait for anything.
+*/
+void JobSystem::Push(TaskGraph::Task* task)
+{
+	if (task->mainThread == true)
+	{
+		std::lock_guard<std::mutex> lock(task->graph->mainThreadMutex);
+		task->graph->mainThreadTasks.push_back(task);
+		return;
+	}
+
+	/// The bound task waits in the separate deque which is never robbed. Only its thread can
+	/// run it, so all workers are woken up (the condition can't wake the chosen one).
+	if (task->thread >= 0)
+	{
+		Queue& queue = queues[task->thread % queues.size()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.boundTasks.push_back(task);
+		}
+		queue.boundCount++;
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wakeUp.notify_all();
+		return;
+	}
+
+	Queue& queue = queues[threadIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+	readyCount++;
+
+	// Taking the lock orders this wake up after the check of a worker going to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wakeUp.notify_one();
+}
+
+/**
+* Take the task from the back of the deque of this thread or steal it from the front of other deques.
+* @returns the task or NULL if there are no ready tasks.
+*/
+TaskGraph::Task* JobSystem::Pop()
+{
+	/// Tasks bound to this thread go first, nobody else can run them
+	Queue& ownQueue = queues[threadIndex];
+	if (ownQueue.boundCount > 0)
+	{
+		std::lock_guard<std::mutex> lock(ownQueue.mutex);
+		if (ownQueue.boundTasks.empty() == false)
+		{
+			TaskGraph::Task* task = ownQueue.boundTasks.front();
+			ownQueue.boundTasks.pop_front();
+			ownQueue.boundCount--;
+			return task;
+		}
+	}
+
+	if (readyCount == 0)
+	{
+		return NULL;
+	}
+
+	/// The own deque is used as the stack, so the newest task (with the hot data) runs first
+	{
+		Queue& queue = queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty() == false)
+		{
+			TaskGraph::Task* task = queue.tasks.back();
+			queue.tasks.pop_back();
+			readyCount--;
+			return task;
+		}
+	}
+
+	/// Other deques are robbed from the front, where the oldest (usually the biggest) tasks are
+	for (size_t i = 1; i < queues.size(); i++)
+	{
+		Queue& queue = queues[(threadIndex + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty() == false)
+		{
+			TaskGraph::Task* task = queue.tasks.front();
+			queue.tasks.pop_front();
+			readyCount--;
+			return task;
+		}
+	}
+	return NULL;
+}
+
+/**
+* Run the task and make ready all tasks which waited only for it.
+* @param task - the task to run.
+*/
+void JobSystem::Execute(TaskGraph::Task* task)
+{
+	task->function();
+
+	TaskGraph* graph = task->graph;
+	for (size_t i = 0; i < task->successors.size(); i++)
+	{
+		TaskGraph::Task* successor = &graph->tasks[task->successors[i]];
+		if (--successor->waitingFor == 0)
+		{
+			Push(successor);
+		}
+	}
+
+	// Finish at the end, the graph can be cleared right after that
+	graph->unfinishedCount--;
+}
+
+/**
+* Main loop of the worker thread.
+* @param index	- index of the deque of the worker.
+* @param cpu	- CPU the worker is pinned to (-1 - not pinned).
+*/
+void JobSystem::WorkerLoop(int index, int cpu)
+{
+	threadIndex = index;
+	if (cpu >= 0)
+	{
+		Topology::PinCurrentThread(cpu);
+	}
+	while (true)
+	{
+		TaskGraph::Task* task = Pop();
+		if (task != NULL)
+		{
+			Execute(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [this, index]() { return readyCount > 0 || queues[index].boundCount > 0 || isStopping == true; });
+		if (isStopping == true && readyCount == 0 && queues[index].boundCount == 0)
+		{
+			return;
+		}
+	}
+}
+
+/**
+* Simple destructor stopping all workers.
+*/
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		isStopping = true;
+	}
+	wakeUp.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	if (instance == this)
+	{
+		instance = NULL;
+	}
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a job system class. It runs tasks of the task graph on the pool of worker
+* threads. Every thread has its own deque of ready tasks: the owner pushes and pops
+* at the back (the newest task, which data is still in the cache) and idle threads
+* steal from the front of other deques, so the work spreads without the central queue.
+* Tasks marked as main thread tasks (GL calls, GLFW input) run only on the thread
+* which runs the graph and tasks bound to the thread (data placed in its NUMA node)
+* run only on that thread. Threads can be pinned to CPUs with the affinity policy.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+/**
+* How threads of the job system are pinned to CPUs.
+*/
+enum JobAffinity
+{
+	JOB_AFFINITY_NONE		= 0,	///< Threads aren't pinned, the system schedules them.
+	JOB_AFFINITY_COMPACT	= 1,	///< Threads fill CPUs of the first NUMA node, then the next ones.
+	JOB_AFFINITY_SCATTER	= 2		///< Threads are spread over NUMA nodes in turns.
+};
+
+/**
+* Graph of tasks of one frame (or one step of it). Tasks run after all tasks they depend on.
+* The graph can be cleared and filled again, so it can be reused every frame.
+*/
+class TaskGraph
+{
+public:
+	/**
+	* Add the task to the graph.
+	* @param function	- the work of the task.
+	* @param mainThread	- true if the task has to run on the thread which runs the graph.
+	* @returns id of the task.
+	*/
+	int Add(std::function<void()> function, bool mainThread = false);
+
+	/**
+	* Add the task which runs only on the given thread of the job system. It isn't stolen,
+	* so the data it touches stays in the memory of that thread's NUMA node.
+	* @param function	- the work of the task.
+	* @param thread		- index of the thread (0 is the thread running the graph).
+	* @returns id of the task.
+	*/
+	int AddOnThread(std::function<void()> function, int thread);
+
+	/**
+	* Make the task run after the other one.
+	* @param task		- id of the task which has to wait.
+	* @param dependency	- id of the task it waits for.
+	*/
+	void Depend(int task, int dependency);
+
+	/**
+	* Remove all tasks from the graph.
+	*/
+	void Clear();
+
+private:
+	friend class JobSystem;
+
+	/**
+	* One task of the graph.
+	*/
+	struct Task
+	{
+		std::function<void()> function;		///< The work of the task.
+		bool mainThread;					///< Tells if the task has to run on the thread running the graph.
+		int thread;							///< Thread which has to run the task (-1 - any thread).
+		int dependenciesCount;				///< How many tasks this one waits for.
+		std::atomic<int> waitingFor;		///< How many tasks this one still waits for during the run.
+		std::vector<int> successors;		///< Tasks waiting for this one.
+		TaskGraph* graph;					///< The graph this task belongs to.
+	};
+
+	std::deque<Task> tasks;					///< Tasks of the graph (deque keeps their addresses).
+	std::atomic<int> unfinishedCount;		///< How many tasks haven't finished yet during the run.
+	std::mutex mainThreadMutex;				///< Lock of the ready main thread tasks.
+	std::vector<Task*> mainThreadTasks;		///< Ready main thread tasks.
+};
+
+class JobSystem
+{
+public:
+	/**
+	* Simple constructor and destructor. The destructor stops all workers.
+	*/
+	JobSystem();
+	~JobSystem();
+
+	/**
+	* Get the job system instance (NULL if it wasn't initialized).
+	*/
+	static JobSystem* Get() { return instance; }
+
+	/**
+	* Start worker threads and pin them (and the calling thread) to CPUs. This job system
+	* becomes the instance.
+	* @param threadsCount	- number of threads running tasks (together with the calling thread).
+	* @param affinity		- how threads are pinned to CPUs.
+	*/
+	void Init(int threadsCount, JobAffinity affinity);
+
+	/**
+	* Get the number of threads running tasks (together with the calling thread).
+	*/
+	int GetThreadsCount() { return (int)queues.size(); }
+
+	/**
+	* Get the policy with which threads were pinned to CPUs.
+	*/
+	JobAffinity GetAffinity() { return affinity; }
+
+	/**
+	* Get the number of NUMA nodes threads are pinned to (1 when threads aren't pinned).
+	*/
+	int GetNodesCount() { return nodesCount; }
+
+	/**
+	* Get the NUMA node of the thread (0 when threads aren't pinned).
+	* @param thread - index of the thread.
+	*/
+	int GetThreadNode(int thread) { return threadNodes[thread]; }
+
+	/**
+	* Get the index of the calling thread (0 for the thread running graphs).
+	*/
+	static int GetThreadIndex();
+
+	/**
+	* Run all tasks of the graph and return when all of them are finished. The calling thread
+	* runs main thread tasks and helps with others while waiting. It can be called from
+	* inside of the task too, then it helps with the work until the inner graph is finished.
+	* @param graph - the graph to run.
+	*/
+	void Run(TaskGraph& graph);
+
+private:
+	/**
+	* Deque of ready tasks of one thread.
+	*/
+	struct Queue
+	{
+		std::mutex mutex;						///< Lock of the deque.
+		std::deque<TaskGraph::Task*> tasks;		///< Ready tasks.
+		std::deque<TaskGraph::Task*> boundTasks;	///< Ready tasks which only this thread can run.
+		std::atomic<int> boundCount;			///< How many tasks wait in boundTasks.
+	};
+
+	/**
+	* Make the task ready. Main thread tasks go to their graph, others to the deque of this thread.
+	* @param task - the task which doesn't wait for anything.
+	*/
+	void Push(TaskGraph::Task* task);
+
+	/**
+	* Take the task from the back of the deque of this thread or steal it from the front of other deques.
+	* @returns the task or NULL if there are no ready tasks.
+	*/
+	TaskGraph::Task* Pop();
+
+	/**
+	* Run the task and make ready all tasks which waited only for it.
+	* @param task - the task to run.
+	*/
+	void Execute(TaskGraph::Task* task);
+
+	/**
+	* Main loop of the worker thread.
+	* @param index	- index of the deque of the worker.
+	* @param cpu	- CPU the worker is pinned to (-1 - not pinned).
+	*/
+	void WorkerLoop(int index, int cpu);
+
+	static JobSystem* instance;				///< The initialized job system.
+
+	std::deque<Queue> queues;				///< Deques of ready tasks, the first one belongs to the main thread.
+	std::vector<std::thread> workers;		///< Worker threads.
+	std::atomic<int> readyCount;			///< How many tasks any thread can run wait in all deques.
+	JobAffinity affinity;					///< How threads are pinned to CPUs.
+	std::vector<int> threadNodes;			///< NUMA node of every thread.
+	int nodesCount;							///< Number of NUMA nodes threads are pinned to.
+	std::mutex sleepMutex;					///< Lock used by sleeping workers.
+	std::condition_variable wakeUp;			///< Wakes workers up when tasks are ready.
+	bool isStopping;						///< Tells workers to finish.
+};
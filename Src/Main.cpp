@@ -7,12 +7,27 @@
  */
 
 #include "Engine.h"
+#include "Sweep.h"
+
+#include <cstring>
 
 /**
- * Start the application.
+ * Start the application. With the --sweep argument it runs the parameter
+ * sweep headless (without the window) instead.
  */
-int main()
+int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--sweep") == 0)
+	{
+		Sweep sweep;
+		if (sweep.Init(CONFIG_PATH) == false)
+		{
+			exit(EXIT_FAILURE);
+		}
+		sweep.Run();
+		exit(sweep.Save() == true ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	// Init application engine so it can run
 	ENGINE_INIT
 
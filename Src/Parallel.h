@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* Simple helper for splitting the CPU work between threads.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "JobSystem.h"
+
+/**
+* Split the range [0, count) into partsCount equal parts and run the function for every
+* part as a task of the job system (or on the calling thread when there is no job system).
+* Parts are always split the same way, so the same part id gets the same range in every call.
+* @param count		- number of elements to process.
+* @param partsCount	- number of parts.
+* @param function	- function(int from, int to, int part) processing elements [from, to).
+*/
+template<typename Function>
+void ParallelFor(int count, int partsCount, Function function)
+{
+	if (partsCount < 1)
+	{
+		partsCount = 1;
+	}
+
+	JobSystem* jobs = JobSystem::Get();
+	if (jobs == NULL || partsCount == 1)
+	{
+		for (int part = 0; part < partsCount; part++)
+		{
+			function((int)((long long)count * part / partsCount), (int)((long long)count * (part + 1) / partsCount), part);
+		}
+		return;
+	}
+
+	TaskGraph graph;
+	for (int part = 0; part < partsCount; part++)
+	{
+		int from	= (int)((long long)count * part / partsCount);
+		int to		= (int)((long long)count * (part + 1) / partsCount);
+		graph.Add([&function, from, to, part]() { function(from, to, part); });
+	}
+	jobs->Run(graph);
+}
@@ -9,130 +9,164 @@
 
 #include "Engine.h"
 #include "Window.h"
+#include "Scene.h"
 #include "Camera.h"
 #include "Particles.h"
 #include "Shaders.h"
+#include "Snapshot.h"
+#include "TrajectoryWriter.h"
+#include "VectorField.h"
+#include "ComputeRasterizer.h"
+#include "ReducedResolution.h"
+#include "DepthSorter.h"
+#include "Arena.h"
 
 #include <GLM/gtc/matrix_transform.hpp>
 #include <GLM/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstddef>
 #include <random>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <sys/resource.h>
+#endif
 
 /**
-* One particle contains:
+* One particle is stored in two streams (separate buffers):
 *
+* Render stream (ParticleRender):
 * x,	y,		z			=> Position xyz								(vec3)
-* r,	g,		b,		a	=> Color rgba								(vec4)
+* rgba						=> Color packed in four bytes				(uint)
+*
+* Simulation stream (ParticleSimulation):
 * vx,	vy,		vz			=> Velocity xyz								(vec3)
 * lt,	we					=> Life time left and "was emitted" flag	(vec2)
 *
-* So one particle is a size of 12 GLfloats
+* Drawing reads only the render stream, so it fetches 16 bytes per particle instead of 48.
+*/
+const int glFloatSize			= sizeof(GLfloat);						///< The size of GLfloat (instead of using sizeof in 
+																		///< future just remember it)
+const int renderDataSize		= sizeof(ParticleRender);				///< The size of the render data of one particle
+const int simulationDataSize	= sizeof(ParticleSimulation);			///< The size of the simulation data of one particle
+const int particleSize			= (renderDataSize + simulationDataSize) / glFloatSize;	///< The size in floats of one particle
+
+/// Names of renderers used in configuration ini file and in messages
+const char* rendererNames[PARTICLES_RENDERERS_COUNT] = { "Points", "Billboards", "Compute" };
+
+/**
+* Get the peak resident memory of the process.
+* @returns peak memory in megabytes (0 if it is unknown).
 */
-const int glFloatSize		= sizeof(GLfloat);					///< The size of GLfloat (instead of using sizeof in 
-																///< future just remember it)
-const int particleSize		= 12;								///< The size in floats of one particle
-const int particleDataSize	= particleSize * glFloatSize;		///< The size of data of the one particle
-																///< (it will be used many times, so better remember it here)
+static double GetPeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) != FALSE)
+	{
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+	return 0;
+#else
+	/// Linux reports kilobytes, macOS bytes
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	#ifdef __APPLE__
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+	#else
+		return usage.ru_maxrss / 1024.0;
+	#endif
+#endif
+}
+
 /**
 * Simple constructor with initialization.
 */
 Particles::Particles()
 {
+	// Remember when the construction started, its time is reported at the end
+	double startTime = glfwGetTime();
+
 	// Save local ini reader so we won't have to get it every time
 	INIReader * localINIReader = ENGINE->config;
 
-	/// Get all needed data from configuration ini file
-	particlesCount			= (int)localINIReader->GetInteger("Particles", "Count", 100);
-	particlesEmitAtOnce		= (int)localINIReader->GetInteger("Particles", "EmitAtOnce", 100);
+	/// Get all needed data from configuration ini file. Parameters of the simulation are read
+	/// by the core, the same way as in the parameter sweep.
+	Init(LoadParams(localINIReader));
+	bufferChunkSize			= std::max(PARTICLES_CHUNK_SIZE, (int)localINIReader->GetInteger("Particles", "BufferChunkSize", 1048576));
 	particlePointSize		= (float)localINIReader->GetReal("Particles", "PointSize", 1.f);
-	particleLifeTime		= (float)localINIReader->GetReal("Particles", "LifeTime", 1.f);
-	particleSpeed			= (float)localINIReader->GetReal("Particles", "Speed", 1.f);
-	particleColorSaturation	= (float)localINIReader->GetReal("Particles", "Saturation", 0.1f);
-	emitPeriod				= (float)localINIReader->GetReal("Particles", "Period", 0.1f);
-	emitterMoveSpeed		= (float)localINIReader->GetReal("Particles", "emitter_Speed", 1.f);
-	emitterRotationSpeed	= (float)localINIReader->GetReal("Particles", "Rot_Speed", 1.f);
-	gravity					= (float)localINIReader->GetReal("Particles", "Gravity", 0.f);
-
-	emitterPosition			= glm::vec3(	(float)localINIReader->GetReal("Particles", "emitter_X", 0.f),
-											(float)localINIReader->GetReal("Particles", "emitter_Y", 0.f),
-											(float)localINIReader->GetReal("Particles", "emitter_Z", 0.f)
-										);
-
-	emitterRadius			= (float)localINIReader->GetReal("Particles", "Radius", 1.f);
-	emitterSpread			= (float)localINIReader->GetReal("Particles", "Spread", 1.f);
 
 	UseCPU					= (bool)localINIReader->GetBoolean("System", "UseCPU", false);
+	UseInteractions			= UseInteractions == true && UseCPU == true;
 
-	/// Set initial values for some data
-	particlesEmitted		= 0;
-	timeToNextEmission		= 0;
-	emitterRotation			= 0;
+	snapshotPath			= localINIReader->Get("Snapshot", "Path", "Data/snapshot.bin");
 
-	/// Calculate the maximum life time the particle can have.
-	/// If the life time is longer there might be some bugs, because the
-	/// particle will live longer than the whole emit process.
-	float maxLifeTime = particlesCount * emitPeriod / particlesEmitAtOnce;
-	if (maxLifeTime < particleLifeTime)
-	{
-		particleLifeTime = maxLifeTime;
-	}
+	/// Set initial values for some data
+	analyticTime			= 0;
+	shader_render			= 0;
+	shader_compute			= 0;
+	shader_render_analytic	= 0;
+	shader_billboard		= 0;
+	particlesTexture		= 0;
+	simulationTexture		= 0;
 
 	/// Create a shader for rendering particles
 	Shaders::AttachShader(shader_render, GL_VERTEX_SHADER, "data/shaders/point_vs.glsl");
 	Shaders::AttachShader(shader_render, GL_FRAGMENT_SHADER, "data/shaders/point_fs.glsl");
 	Shaders::LinkProgram(shader_render);
+	Camera::BindUniformBlock(shader_render);
 
 	/// Create a shader for updating particles. Here we are defining which outputs will be transported
 	/// back to the buffer. The order of inputs, outputs and names of variables in array below must be the same!
+	/// The render stream and the simulation stream are written to separate buffers (gl_NextBuffer).
 	Shaders::AttachShader(shader_compute, GL_VERTEX_SHADER, "data/shaders/point_update_vs.glsl");
-	const char* shaderOutputs[4] = {
+	const char* shaderOutputs[5] = {
 		"outPosition",
 		"outColor",
+		"gl_NextBuffer",
 		"outVelocity",
 		"outOthers"
 	};
-	glTransformFeedbackVaryings(shader_compute, 4, shaderOutputs, GL_INTERLEAVED_ATTRIBS);
+	glTransformFeedbackVaryings(shader_compute, 5, shaderOutputs, GL_INTERLEAVED_ATTRIBS);
 	Shaders::LinkProgram(shader_compute);
 
-	/// Generate all necessary buffors for data
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(2, VBO);
+	/// Generate all necessary buffors for data (particles buffers are created with their chunks)
 	glGenBuffers(1, &UBO);
 	
-	/// Remember the size needed to store all particles data and create an empty
-	/// array. The array will be used to fill buffers.
-	int allParticlesDataSize = particlesCount * particleDataSize;
-	char * nullData = new char[allParticlesDataSize]();
-	std::fill(nullData, nullData + allParticlesDataSize, 0);
-
-	if (UseCPU == true)
+	/// Remember sizes needed to store both streams of all particles. They are 64-bit,
+	/// because streams of about 100 million particles are bigger than 2 GB.
+	size_t allRenderDataSize		= (size_t)particlesCount * renderDataSize;
+	size_t allSimulationDataSize	= (size_t)particlesCount * simulationDataSize;
+
+	/// Both CPU streams are served from one arena backed by huge pages, placed by threads
+	/// owning their chunks. Without the memory we can't go on.
+	if (UseCPU == true && AllocateCPU() == false)
 	{
-		VBOCPP = new GLfloat[particlesCount * particleSize]();
-		std::fill(VBOCPP, VBOCPP + particlesCount * particleSize, 0.f);
+		printf("Can't allocate CPU streams of %d particles, reduce [Particles] Count\n", particlesCount);
+		exit(EXIT_FAILURE);
 	}
-	
-	// Bind the vertex array object which will be used both for computing and rendering
-	glBindVertexArray(VAO);
-		
-		// Enable attribute pointers. Because locations were used in shaders they could be
-		// arranged from 1 to 4.
-		for (int i = 1; i <= 4; i++)
-		{
-			glEnableVertexAttribArray(i);
-		}
-		
-		/// Fill two buffers with zeroes so there won't be any junk data
-		glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-			glBufferData(GL_ARRAY_BUFFER, allParticlesDataSize, nullData, GL_STREAM_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO[1]);
-			glBufferData(GL_ARRAY_BUFFER, allParticlesDataSize, nullData, GL_STREAM_DRAW);
 
-	
-	// Unbind the vertex array object for now, it won't be needed for a while
-	glBindVertexArray(0);
-
-	// Clean up now unnecessary data
-	delete [] nullData;
+	/// Particles are stored on the GPU in chunks of bufferChunkSize particles, every chunk
+	/// with its own buffers filled with zeroes, so there won't be any junk data. Buffers are
+	/// immutable when possible, but the CPU path orphans its buffers with every upload.
+	UseBufferStorage = UseCPU == false && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+	ParticlesBufferResize bufferResize;
+	if (PrepareBufferChunks(particlesCount, bufferResize) == false)
+	{
+		printf("Can't allocate vertex buffers of %d particles, reduce [Particles] Count\n", particlesCount);
+		exit(EXIT_FAILURE);
+	}
+	CommitBufferChunks(bufferResize);
 
 
 	/// Declare the space in uniform buffer for shader where particles parameter are stored.
@@ -160,7 +194,8 @@ Particles::Particles()
 		"emitterSpread",
 		"colorSaturation",
 		"speed",
-		"gravity"
+		"gravity",
+		"randomEpoch"
 	};
 
 	// Get uniform buffers parameters offsets for future easily filling and update
@@ -178,10 +213,307 @@ Particles::Particles()
 	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[7], 4, &particleColorSaturation);
 	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[8], 4, &particleSpeed);
 	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[9], 4, &gravity);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[10], 4, &randomEpoch);
 
 	// Unbind the buffer object so program won't use them unnecessarily
 	glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	/// Load all vector fields and pass their parameters to the compute shader.
+	/// Every field texture uses its own texture unit, starting from the first one.
+	LoadVectorFields(localINIReader, UseCPU == false);
+
+	if (UseCPU == false)
+	{
+		GLint units[VECTOR_FIELDS_MAX];
+		glm::vec3 boundsMin[VECTOR_FIELDS_MAX];
+		glm::vec3 boundsMax[VECTOR_FIELDS_MAX];
+		GLfloat strengths[VECTOR_FIELDS_MAX];
+		GLint types[VECTOR_FIELDS_MAX];
+		for (int i = 0; i < (int)vectorFields.size(); i++)
+		{
+			units[i]		= i + 1;
+			boundsMin[i]	= vectorFields[i]->GetBoundsMin();
+			boundsMax[i]	= vectorFields[i]->GetBoundsMax();
+			strengths[i]	= vectorFields[i]->strength;
+			types[i]		= vectorFields[i]->type;
+		}
+
+		GLsizei count = (GLsizei)vectorFields.size();
+		glUseProgram(shader_compute);
+		glUniform1i(glGetUniformLocation(shader_compute, "vectorFieldsCount"), count);
+		if (count > 0)
+		{
+			glUniform1iv(glGetUniformLocation(shader_compute, "vectorFields"), count, units);
+			glUniform3fv(glGetUniformLocation(shader_compute, "vectorFieldsMin"), count, glm::value_ptr(boundsMin[0]));
+			glUniform3fv(glGetUniformLocation(shader_compute, "vectorFieldsMax"), count, glm::value_ptr(boundsMax[0]));
+			glUniform1fv(glGetUniformLocation(shader_compute, "vectorFieldsStrength"), count, strengths);
+			glUniform1iv(glGetUniformLocation(shader_compute, "vectorFieldsType"), count, types);
+		}
+		glUseProgram(0);
+	}
+
+	/// Particles moving only with constant velocity and gravity don't have to be simulated,
+	/// their position can be evaluated from the spawn state. Other forces need the integration.
+	UseAnalytic = localINIReader->GetBoolean("Particles", "Analytic", false);
+	if (UseAnalytic == true && (vectorFields.empty() == false || UseInteractions == true))
+	{
+		printf("Analytic mode is disabled, because vector fields or interactions are enabled\n");
+		UseAnalytic = false;
+	}
+	if (UseAnalytic == true)
+	{
+		Shaders::AttachShader(shader_render_analytic, GL_VERTEX_SHADER, "data/shaders/point_analytic_vs.glsl");
+		Shaders::AttachShader(shader_render_analytic, GL_FRAGMENT_SHADER, "data/shaders/point_fs.glsl");
+		Shaders::LinkProgram(shader_render_analytic);
+		Camera::BindUniformBlock(shader_render_analytic);
+
+		analyticRenderStaging.resize(particlesEmitAtOnce);
+		analyticSimulationStaging.resize(particlesEmitAtOnce);
+	}
+
+	/// Billboards read the render stream from the buffer texture (one texel per particle) and in
+	/// analytic mode the simulation stream too, so they are available only if the full buffer
+	/// chunk fits in it (the pool can be resized up to full chunks).
+	billboardAttenuation	= (float)localINIReader->GetReal("Render", "Attenuation", 0.f);
+	billboardSizeVariation	= glm::clamp((float)localINIReader->GetReal("Render", "SizeVariation", 0.f), 0.f, 1.f);
+
+	GLint maxTextureBufferSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+	long long billboardTexels = (long long)bufferChunkSize * (UseAnalytic == true ? simulationDataSize / glFloatSize : 1);
+	if (billboardTexels <= maxTextureBufferSize)
+	{
+		Shaders::AttachShader(shader_billboard, GL_VERTEX_SHADER, "data/shaders/billboard_vs.glsl");
+		Shaders::AttachShader(shader_billboard, GL_FRAGMENT_SHADER, "data/shaders/point_fs.glsl");
+		Shaders::LinkProgram(shader_billboard);
+		Camera::BindUniformBlock(shader_billboard);
+
+		glUseProgram(shader_billboard);
+		glUniform1i(glGetUniformLocation(shader_billboard, "particles"), 0);
+		glUniform1i(glGetUniformLocation(shader_billboard, "simulation"), 2);
+		glUseProgram(0);
+
+		glGenTextures(1, &particlesTexture);
+		glGenTextures(1, &simulationTexture);
+	}
+	else
+	{
+		printf("Billboards are disabled, %d particles of the buffer chunk don't fit in the buffer texture\n", bufferChunkSize);
+	}
+
+	/// Compute rasterizer draws into the framebuffer of the camera size
+	Camera* camera = ENGINE->scene->camera;
+	renderSize = glm::ivec2(camera->renderWidth, camera->renderHeight);
+	computeRasterizer = NULL;
+	if (ComputeRasterizer::IsSupported() == true)
+	{
+		computeRasterizer = new ComputeRasterizer();
+		computeRasterizer->Init(camera->renderWidth, camera->renderHeight,
+			localINIReader->Get("Render", "ComputeBlend", "Additive") == "FrontMost" ? COMPUTE_RASTERIZER_FRONT_MOST : COMPUTE_RASTERIZER_ADDITIVE);
+	}
+	else
+	{
+		printf("Compute rasterizer is disabled, it needs OpenGL 4.3\n");
+	}
+
+	/// Particles can be drawn in the fraction of the render size when the fill rate limits them
+	reducedResolution = new ReducedResolution();
+	if (reducedResolution->Init(camera->renderWidth, camera->renderHeight, (float)localINIReader->GetReal("Render", "MinScale", 0.25f)) == true)
+	{
+		reducedResolution->SetScale((float)localINIReader->GetReal("Render", "Scale", 1.f));
+	}
+	else
+	{
+		delete reducedResolution;
+		reducedResolution = NULL;
+	}
+
+	/// Particles can be sorted by the distance from the camera for correct blending.
+	/// Billboards read sorted indices through the buffer texture. Sorted indices point
+	/// into one buffer, so all particles have to be in one chunk.
+	depthSorter				= NULL;
+	sortedIndicesTexture	= 0;
+	sortInterval			= std::max(1, (int)localINIReader->GetInteger("Sort", "Interval", 1));
+	framesToSort			= 0;
+	if (localINIReader->GetBoolean("Sort", "Enabled", false) == true)
+	{
+		if (bufferChunks.size() > 1)
+		{
+			printf("Depth sorting is disabled, it needs all particles in one buffer chunk ([Particles] BufferChunkSize)\n");
+		}
+		else if (DepthSorter::IsSupported() == true)
+		{
+			depthSorter = new DepthSorter();
+			depthSorter->Init(particlesCount);
+
+			glGenTextures(1, &sortedIndicesTexture);
+			glBindTexture(GL_TEXTURE_BUFFER, sortedIndicesTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, depthSorter->GetIndexBuffer());
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+		else
+		{
+			printf("Depth sorting is disabled, it needs OpenGL 4.3\n");
+		}
+	}
+	if (shader_billboard != 0)
+	{
+		glUseProgram(shader_billboard);
+		glUniform1i(glGetUniformLocation(shader_billboard, "order"), 1);
+		glUniform1i(glGetUniformLocation(shader_billboard, "sorted"), depthSorter != NULL ? 1 : 0);
+		glUseProgram(0);
+	}
+
+	/// Use the configured renderer, or points when it isn't available
+	std::string rendererName = localINIReader->Get("Render", "Renderer", rendererNames[PARTICLES_RENDERER_POINTS]);
+	renderer = PARTICLES_RENDERER_POINTS;
+	for (int i = 0; i < PARTICLES_RENDERERS_COUNT; i++)
+	{
+		if (rendererName == rendererNames[i] && IsRendererAvailable((ParticlesRenderer)i) == true)
+		{
+			renderer = (ParticlesRenderer)i;
+		}
+	}
+
+	/// Culling needs the bounds of all particles, which are known only for ballistic particles
+	UseCulling				= localINIReader->GetBoolean("Culling", "Enabled", false);
+	cullingMargin			= (float)localINIReader->GetReal("Culling", "Margin", 0.1f);
+	catchUpStep				= std::max(0.001f, (float)localINIReader->GetReal("Culling", "CatchUpStep", 0.1f));
+	culledTime				= 0;
+	isCatchingUp			= false;
+	emitterTrailMin			= emitterPosition;
+	emitterTrailMax			= emitterPosition;
+	emitterTrailTime		= 0;
+	if (UseCulling == true && (vectorFields.empty() == false || UseInteractions == true))
+	{
+		printf("Culling is disabled, because vector fields or interactions make particles bounds unknown\n");
+		UseCulling = false;
+	}
+
+	/// Analytic mode doesn't simulate particles anyway, only emits them
+	UseCullingSimulation	= UseCulling == true && UseAnalytic == false && localINIReader->GetBoolean("Culling", "SkipSimulation", false);
+
+	/// Distant systems are simulated less often. Distances of tiers are read in order, every
+	/// next tier doubles the update interval and the last one can also emit less particles.
+	UseLOD					= localINIReader->GetBoolean("LOD", "Enabled", false);
+	lodEmission				= glm::clamp((float)localINIReader->GetReal("LOD", "DistantEmission", 1.f), 0.01f, 1.f);
+	lodTier					= 0;
+	lodTicks				= 0;
+	lodTime					= 0;
+	lodSizeScale			= 1.f;
+	emitStride				= 1;
+	std::stringstream distances(localINIReader->Get("LOD", "Distances", "16,32,48"));
+	std::string distance;
+	while (std::getline(distances, distance, ',') && lodDistances.size() < PARTICLES_LOD_TIERS_MAX)
+	{
+		lodDistances.push_back((float)atof(distance.c_str()));
+	}
+
+	/// Read particles counts and sizes compared by the render benchmark
+	std::stringstream counts(localINIReader->Get("Benchmark", "Counts", "10000,100000,1000000"));
+	std::stringstream sizes(localINIReader->Get("Benchmark", "Sizes", "1,2,4,8,16,32"));
+	std::string value;
+	while (std::getline(counts, value, ','))
+	{
+		benchmarkCounts.push_back(std::max(1, atoi(value.c_str())));
+	}
+	while (std::getline(sizes, value, ','))
+	{
+		benchmarkSizes.push_back(std::max(1.f, (float)atof(value.c_str())));
+	}
+	benchmarkRepeats		= std::max(1, (int)localINIReader->GetInteger("Benchmark", "Repeats", 10));
+
+	/// Start streaming particles trajectories if it was requested.
+	trajectoryWriter = NULL;
+	if (localINIReader->GetBoolean("Trajectory", "Enabled", false) == true)
+	{
+		trajectoryTickInterval = std::max(1, (int)localINIReader->GetInteger("Trajectory", "TickInterval", 10));
+		trajectoryWriter = new TrajectoryWriter();
+		if (trajectoryWriter->Open(
+			localINIReader->Get("Trajectory", "Path", "Data/trajectory.bin").c_str(),
+			particlesCount,
+			trajectoryTickInterval,
+			(int)localINIReader->GetInteger("Trajectory", "FramesPerChunk", 16),
+			(int)localINIReader->GetInteger("Trajectory", "QueueSize", 4)) == false)
+		{
+			delete trajectoryWriter;
+			trajectoryWriter = NULL;
+		}
+	}
+
+	// Create buffers for reading particles data back from the GPU
+	glGenBuffers(2, trajectoryBuffers);
+	if (trajectoryWriter != NULL && UseCPU == false)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, trajectoryBuffers[i]);
+			glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(allRenderDataSize + allSimulationDataSize), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	trajectoryFences[0]		= NULL;
+	trajectoryFences[1]		= NULL;
+	trajectoryBufferIndex	= 0;
+
+	/// Gather statistics of alive, emitted and died particles. On the GPU path the update shader
+	/// increments atomic counters, which need OpenGL 4.2 and support in the vertex shader.
+	/// Analytic mode doesn't update particles, so there is nothing to count.
+	UseStats				= localINIReader->GetBoolean("Stats", "Enabled", false);
+	statsReportInterval		= std::max(0, (int)localINIReader->GetInteger("Stats", "ReportInterval", 120));
+	statsReportTick			= 0;
+	stats					= ParticlesStats();
+	statsCounters			= 0;
+	statsBufferIndex		= 0;
+	std::fill(statsBuffers, statsBuffers + PARTICLES_STATS_LATENCY, 0);
+	std::fill(statsFences, statsFences + PARTICLES_STATS_LATENCY, (GLsync)NULL);
+	if (UseStats == true && UseAnalytic == true)
+	{
+		printf("Statistics are disabled in analytic mode\n");
+		UseStats = false;
+	}
+	if (UseStats == true && UseCPU == false)
+	{
+		GLint maxVertexCounters = 0;
+		if (GLEW_VERSION_4_2 || GLEW_ARB_shader_atomic_counters)
+		{
+			glGetIntegerv(GL_MAX_VERTEX_ATOMIC_COUNTERS, &maxVertexCounters);
+		}
+		if (maxVertexCounters >= 3)
+		{
+			GLuint zeroes[3] = { 0, 0, 0 };
+			glGenBuffers(1, &statsCounters);
+			glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, statsCounters);
+			glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(zeroes), zeroes, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+			glGenBuffers(PARTICLES_STATS_LATENCY, statsBuffers);
+			for (int i = 0; i < PARTICLES_STATS_LATENCY; i++)
+			{
+				glBindBuffer(GL_COPY_WRITE_BUFFER, statsBuffers[i]);
+				glBufferData(GL_COPY_WRITE_BUFFER, sizeof(zeroes), NULL, GL_STREAM_READ);
+			}
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+			glUseProgram(shader_compute);
+			glUniform1i(glGetUniformLocation(shader_compute, "collectStats"), 1);
+			glUseProgram(0);
+		}
+		else
+		{
+			printf("Statistics are disabled, they need atomic counters in the vertex shader (OpenGL 4.2)\n");
+			UseStats = false;
+		}
+	}
+
+	/// Start from the saved state if it was requested, so the simulation
+	/// doesn't have to warm up through the whole emission cycle.
+	if (localINIReader->GetBoolean("Snapshot", "LoadOnStart", false) == true)
+	{
+		LoadSnapshot(snapshotPath.c_str());
+	}
+
+	printf("%d particles created in %.1f ms, peak memory %.1f MB\n", particlesCount, (glfwGetTime() - startTime) * 1000.0, GetPeakMemory());
 }
 
 /**
@@ -190,9 +522,93 @@ Particles::Particles()
 */
 void Particles::Update(float deltaTime)
 {
+	/// Particles emitted during the last life time can be anywhere around emitter positions
+	/// from that time, so the trail shrinks only when the emitter stays in place that long.
+	emitterTrailTime -= deltaTime;
+	if (emitterTrailTime <= 0)
+	{
+		emitterTrailMin = emitterPosition;
+		emitterTrailMax = emitterPosition;
+	}
+
+	/// Invisible system isn't simulated, only the emitter can be moved (so it can be moved back to the view).
+	if (UseCullingSimulation == true && IsVisible(ENGINE->scene->camera) == false)
+	{
+		culledTime += deltaTime;
+		if (HandleInput() == true)
+		{
+			emitterPosition += (emitterMoveDir * emitterMoveSpeed * deltaTime);
+			if (UseCPU == false)
+			{
+				glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+				glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[1], 12, glm::value_ptr(emitterPosition));
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			}
+		}
+	}
+	else
+	{
+		/// Catch up the skipped time with coarse steps. Particles live only particleLifeTime,
+		/// so the older time doesn't change the visible state. The emitter was moved by the input
+		/// every tick of the skipped time already, so only particles are simulated here.
+		float catchUpTime = std::min(culledTime, particleLifeTime);
+		culledTime = 0;
+		isCatchingUp = true;
+		while (catchUpTime > 0)
+		{
+			float step = std::min(catchUpTime, catchUpStep);
+			Simulate(step);
+			catchUpTime -= step;
+		}
+		isCatchingUp = false;
+
+		/// Distant systems are simulated every 2^tier-th tick with the whole time that passed,
+		/// so switching tiers doesn't lose or add any time. Analytic mode is cheap anyway.
+		/// The CPU path with substeps waits for all ticks of its pass too.
+		lodTime += deltaTime;
+		lodTicks++;
+		int simulationTicks = (UseCPU == true && UseAnalytic == false) ? tickSubsteps : 1;
+		if (UseAnalytic == true || lodTicks >= (1 << lodTier) * simulationTicks)
+		{
+			Simulate(lodTime);
+			lodTime		= 0;
+			lodTicks	= 0;
+		}
+
+		if (UseLOD == true)
+		{
+			UpdateLOD(ENGINE->scene->camera, deltaTime);
+		}
+	}
+
+	/// Extend the trail with the current emitter position
+	if (emitterPosition != glm::clamp(emitterPosition, emitterTrailMin, emitterTrailMax))
+	{
+		emitterTrailMin		= glm::min(emitterTrailMin, emitterPosition);
+		emitterTrailMax		= glm::max(emitterTrailMax, emitterPosition);
+		emitterTrailTime	= particleLifeTime;
+	}
+}
+
+/**
+* Simulate one step of particles, on the GPU, on the CPU or in analytic mode.
+* @param deltaTime - the portion of time thas passed from previous update.
+*/
+void Particles::Simulate(float deltaTime)
+{
+	ticksCount++;
+
+	if (UseAnalytic == true)
+	{
+		UpdateAnalytic(deltaTime);
+		CaptureTrajectory();
+		return;
+	}
+
 	if (UseCPU == true)
 	{
 		UpdateCPU(deltaTime);
+		CaptureTrajectory();
 		return;
 	}
 	// Bind the uniform buffer, because we will update it and use it soon.
@@ -203,266 +619,1551 @@ void Particles::Update(float deltaTime)
 
 	/// Check if particle emitter position has to be update. If yes, then update it and also
 	/// update it in the uniform buffer.
+	emitterVelocity = glm::vec3(0);
 	if (HandleInput() == true)
 	{
-		emitterPosition += (emitterMoveDir * emitterMoveSpeed * deltaTime);
+		emitterVelocity = emitterMoveDir * emitterMoveSpeed;
+		emitterPosition += (emitterVelocity * deltaTime);
 		glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[1], 12, glm::value_ptr(emitterPosition));
 	}
 
 	/// Update the emitter current rotation position
 	emitterRotation += emitterRotationSpeed * deltaTime;
 	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[3], 4, &emitterRotation);
+
+	/// Move to the next random epoch, so newly emitted particles get new random numbers
+	randomEpoch++;
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[10], 4, &randomEpoch);
 	
 	// If all particles were emited zero the counter so particles will be emitted again.
-	if (particlesEmitted == particlesCount)
-	{
-		particlesEmitted = 0;
-	}
+	WrapEmission();
 	
 	/// Decrease time to nex emission and if this is a time for emission
 	/// increase the emitted particles counter. Update this counter in shader too.
-	timeToNextEmission -= deltaTime;
-	if (timeToNextEmission <= 0)
+	emitFrom = particlesEmitted;
+	int portions = CountEmissions(deltaTime);
+	if (portions > 0)
 	{
-		particlesEmitted += particlesEmitAtOnce;
+		particlesEmitted = std::min(particlesEmitted + portions * particlesEmitAtOnce, particlesCount);
 		glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[2], 4, &particlesEmitted);
+	}
 
-		if (particlesEmitted > particlesCount)
-		{
-			particlesEmitted = particlesCount;
-		}
-		timeToNextEmission = emitPeriod;
+	/// Bind textures of vector fields to their texture units
+	for (int i = 0; i < (int)vectorFields.size(); i++)
+	{
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_3D, vectorFields[i]->GetTexture());
 	}
+	glActiveTexture(GL_TEXTURE0);
 
 	/// Now it is time for computing, using the compute shader.
 	glUseProgram(shader_compute);
-		// Use our vertex array object
-		glBindVertexArray(VAO);
-
-			/// Attribute pointers has to be set in every update to the first vertex buffer, because after every update
-			/// buffers are swapped. So in fact we are setting attribute pointers to different buffer every update.
-			/// Swapping has to be done, because we can't save data in the same buffer.
-			char* pOffset = 0;
-			glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, particleDataSize, pOffset);
-			glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, particleDataSize, pOffset + glFloatSize * 3);
-			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, particleDataSize, pOffset + glFloatSize * 7);
-			glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, particleDataSize, pOffset + glFloatSize * 10);
-
-			// Enable rasterizer discard, because compute shader won't raster data
-			glEnable(GL_RASTERIZER_DISCARD);
-
-			// Bind the transform feedback buffer using the second vertex buffer object.
-			// All transformed data will be stored to it.
-			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, VBO[1]);
-	
+		glUniform1i(glGetUniformLocation(shader_compute, "emitStride"), emitStride);
+
+		/// Portions of this update are spawned at times they were due, so the shader
+		/// needs to know when they were due and where the emitter was then.
+		glUniform1i(glGetUniformLocation(shader_compute, "emitFrom"), emitFrom);
+		glUniform1f(glGetUniformLocation(shader_compute, "emitMark"), emitMark);
+		glUniform1i(glGetUniformLocation(shader_compute, "emitAtOnce"), particlesEmitAtOnce);
+		glUniform1f(glGetUniformLocation(shader_compute, "emitAge"), emitAge);
+		glUniform1f(glGetUniformLocation(shader_compute, "emitPeriod"), emitPeriod);
+		glUniform3fv(glGetUniformLocation(shader_compute, "emitterVelocity"), 1, glm::value_ptr(emitterVelocity));
+		glUniform1f(glGetUniformLocation(shader_compute, "emitterRotationSpeed"), emitterRotationSpeed);
+
+		// Enable rasterizer discard, because compute shader won't raster data
+		glEnable(GL_RASTERIZER_DISCARD);
+
+		/// Statistics are counted from zero in every update (summed over all chunks)
+		if (UseStats == true)
+		{
+			GLuint zeroes[3] = { 0, 0, 0 };
+			glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, statsCounters);
+			glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zeroes), zeroes);
+		}
+
+		/// Every chunk is updated with its own draw. The first vertex array reads the first buffers
+		/// and the first transform feedback writes to the second ones. Both were set up once, so
+		/// nothing has to be re-pointed after the swap. The shader gets the id of the first
+		/// particle of the chunk, because emission depends on ids.
+		for (size_t i = 0; i < bufferChunks.size(); i++)
+		{
+			ParticlesBufferChunk& chunk = bufferChunks[i];
+			glUniform1i(glGetUniformLocation(shader_compute, "firstId"), chunk.first);
+			glBindVertexArray(chunk.VAO[0]);
+			glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, chunk.transformFeedback[0]);
+
 			/// Draw Arrays using Transform Feedback
 			glBeginTransformFeedback(GL_POINTS);
-			glDrawArrays(GL_POINTS, 0, particlesCount);
+			glDrawArrays(GL_POINTS, 0, chunk.count);
 			glEndTransformFeedback();
+		}
+
+		if (UseStats == true)
+		{
+			glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, 0);
+		}
 
-			// Unbind the transform feedback for safety
-			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		// Unbind the transform feedback for safety
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
 
-			// Disable the rasterizer discard, because we need rasterization in drawing.
-			glDisable(GL_RASTERIZER_DISCARD);
+		// Disable the rasterizer discard, because we need rasterization in drawing.
+		glDisable(GL_RASTERIZER_DISCARD);
 
 		/// Unbind vertex array object and disable computing program
 		glBindVertexArray(0);
 	glUseProgram(0);
 
+	// Unbind textures of vector fields
+	for (int i = 0; i < (int)vectorFields.size(); i++)
+	{
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
 	// Swap buffers, so the newly computed data will be used to the rendering and
 	// they will be updated in next tick.
-	std::swap(VBO[0], VBO[1]);
+	// Vertex arrays and transform feedbacks are swapped together with buffers they use.
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		ParticlesBufferChunk& chunk = bufferChunks[i];
+		std::swap(chunk.VBO[0], chunk.VBO[1]);
+		std::swap(chunk.simulationVBO[0], chunk.simulationVBO[1]);
+		std::swap(chunk.VAO[0], chunk.VAO[1]);
+		std::swap(chunk.transformFeedback[0], chunk.transformFeedback[1]);
+	}
 
 	// Unbind uniform buffer, because we don't need it for now
 	glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
+
+	// Stream the newly computed data and read back statistics if needed
+	CaptureTrajectory();
+	CaptureStats();
 }
 
 /**
-* Update particles' state using the CPU.
-* @param deltaTime - the portion of time thas passed from previous update.
+* Get conservative world bounds of all particles of the system. They are derived from the
+* emitter positions during the last life time, speed, spread, gravity and the life time.
+* @param min - minimum corner of the bounds.
+* @param max - maximum corner of the bounds.
 */
-void Particles::UpdateCPU(float deltaTime)
+void Particles::GetBounds(glm::vec3& min, glm::vec3& max)
 {
-	/// First updating the states of the emitter
+	/// Streams are at most emitterRadius from the emitter and the horizontal velocity
+	/// is at most half of the spread in both axes (see the update shader).
+	float horizontal = emitterRadius + emitterSpread * 0.5f * particleLifeTime;
+
+	/// The vertical velocity is from speed to speed + 0.5. The height is linear in the velocity,
+	/// so its extremes are at both ends of that range, at the emission, at the end of life
+	/// or at the top of the parabola.
+	float minHeight = 0;
+	float maxHeight = 0;
+	float speeds[2] = { particleSpeed, particleSpeed + 0.5f };
+	for (int i = 0; i < 2; i++)
+	{
+		float times[3] = { 0.f, particleLifeTime, gravity != 0 ? glm::clamp(speeds[i] / gravity, 0.f, particleLifeTime) : 0.f };
+		for (int j = 0; j < 3; j++)
+		{
+			float height = speeds[i] * times[j] - 0.5f * gravity * times[j] * times[j];
+			minHeight = std::min(minHeight, height);
+			maxHeight = std::max(maxHeight, height);
+		}
+	}
 
-	if (HandleInput() == true)
+	min = emitterTrailMin + glm::vec3(-horizontal, minHeight, -horizontal) - cullingMargin;
+	max = emitterTrailMax + glm::vec3(horizontal, maxHeight, horizontal) + cullingMargin;
+}
+
+/**
+* Choose the LOD tier from the distance of the system bounds to the camera. Going back to
+* a nearer tier needs the distance smaller by PARTICLES_LOD_HYSTERESIS, so the system
+* doesn't switch every tick on the tier border.
+* @param camera		- the pointer to the camera.
+* @param deltaTime	- the portion of time thas passed from previous update.
+*/
+void Particles::UpdateLOD(Camera * camera, float deltaTime)
+{
+	glm::vec3 min, max;
+	GetBounds(min, max);
+	float distance = glm::length(camera->position - glm::clamp(camera->position, min, max));
+
+	int tier = 0;
+	while (tier < (int)lodDistances.size() && distance > lodDistances[tier] * (tier < lodTier ? 1.f - PARTICLES_LOD_HYSTERESIS : 1.f))
 	{
-		emitterPosition += (emitterMoveDir * emitterMoveSpeed * deltaTime);
+		tier++;
 	}
-	emitterRotation += emitterRotationSpeed * deltaTime;
+	lodTier = tier;
+
+	/// The farthest tier emits only every emitStride-th group of four particles (all streams stay).
+	/// Points are bigger to cover the same area, but only as fast as old particles die out,
+	/// so the size follows the real density and doesn't pop.
+	bool isDistant		= lodDistances.empty() == false && lodTier == (int)lodDistances.size();
+	emitStride			= isDistant == true ? (int)(1.f / lodEmission + 0.5f) : 1;
+	float targetScale	= sqrt((float)emitStride);
+	lodSizeScale		+= (targetScale - lodSizeScale) * std::min(deltaTime / std::max(particleLifeTime, 0.001f), 1.f);
+}
 
-	if (particlesEmitted == particlesCount)
+/**
+* Check if any particle of the system can be visible for the camera.
+* @param camera - the pointer to the camera.
+* @returns true if the system can be visible (always when culling is disabled).
+*/
+bool Particles::IsVisible(Camera * camera)
+{
+	if (UseCulling == false)
 	{
-		particlesEmitted = 0;
+		return true;
 	}
 
-	timeToNextEmission -= deltaTime;
-	if (timeToNextEmission <= 0)
+	glm::vec3 min, max;
+	GetBounds(min, max);
+	return camera->IsBoxVisible(min, max);
+}
+
+/**
+* Allocate the vertex buffer (immutable storage when available) and optionally fill it
+* with zeroes on the GPU. Without glClearBufferData it is filled piece by piece, so there
+* is no temporary array of the buffer size.
+* @param buffer	- the vertex buffer.
+* @param size	- size of the buffer in bytes.
+* @param clear	- true if the buffer is read before anything writes it.
+* @returns false if the driver is out of memory.
+*/
+bool Particles::AllocateBuffer(GLuint buffer, size_t size, bool clear)
+{
+	glGetError();
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if (UseBufferStorage == true)
+	{
+		glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)size, NULL, GL_DYNAMIC_STORAGE_BIT);
+	}
+	else
 	{
-		particlesEmitted += particlesEmitAtOnce;
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+	}
 
-		if (particlesEmitted > particlesCount)
+	/// NULL data of the clear means zeroes, so nothing is sent from the CPU at all
+	if (clear == true && (GLEW_VERSION_4_3 || GLEW_ARB_clear_buffer_object))
+	{
+		glClearBufferData(GL_ARRAY_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	}
+	else if (clear == true)
+	{
+		std::vector<char> nullData(std::min(size, (size_t)PARTICLES_CLEAR_BLOCK_SIZE), 0);
+		for (size_t offset = 0; offset < size; offset += nullData.size())
 		{
-			particlesEmitted = particlesCount;
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)offset, (GLsizeiptr)std::min(nullData.size(), size - offset), nullData.data());
 		}
-		timeToNextEmission = emitPeriod;
 	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return glGetError() != GL_OUT_OF_MEMORY;
+}
 
-	/// Below it is simply a copy of compute shader calculations but written in C++
-
-	/// Contants helping with "shader" writing
-	const float D120 = 2.09439510f;
-	const int POSITION = 0;
-	const int COLOR = 3;
-	const int VELOCITY = 7;
-	const int OTHERS = 10;
-
-	/// Random float number generators
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<float> particleSaturationRand(0.f, particleColorSaturation);
-	std::uniform_real_distribution<float> emitterSpreadRand(0.f, emitterSpread);
-	std::uniform_real_distribution<float> halfRand(0.f, 0.5f);
-
-	int id = 0;
-	for (int i = 0; i < particlesCount * particleSize; i += particleSize, id++)
+/**
+* Create buffers of the chunk of particles (filled with zeroes) and its vertex
+* arrays and transform feedbacks.
+* @param chunk	- the chunk to create.
+* @param first	- id of the first particle of the chunk.
+* @param count	- how many particles are in the chunk.
+* @returns false if the driver is out of memory (nothing is created then).
+*/
+bool Particles::CreateBufferChunk(ParticlesBufferChunk& chunk, int first, int count)
+{
+	chunk.first = first;
+	chunk.count = count;
+	glGenBuffers(2, chunk.VBO);
+	glGenBuffers(2, chunk.simulationVBO);
+
+	/// Only the first buffers are read before they are written. The second ones are the
+	/// target of the first update, which writes every particle, so they aren't cleared.
+	for (int i = 0; i < 2; i++)
 	{
-		if (VBOCPP[i + OTHERS] <= 0)
+		if (AllocateBuffer(chunk.VBO[i], (size_t)count * renderDataSize, i == 0) == false ||
+			AllocateBuffer(chunk.simulationVBO[i], (size_t)count * simulationDataSize, i == 0) == false)
 		{
-			VBOCPP[i + COLOR + 0] = 0;
-			VBOCPP[i + COLOR + 1] = 0;
-			VBOCPP[i + COLOR + 2] = 0;
-			VBOCPP[i + COLOR + 3] = 0;
-
-			if (particlesEmitted > id)
-			{
-				if (VBOCPP[i + OTHERS + 1] == 0)
-				{
-					VBOCPP[i + OTHERS] = particleLifeTime;
-
-					VBOCPP[i + OTHERS + 1] = 1;
-
-					VBOCPP[i + POSITION + 0] = emitterPosition.x;
-					VBOCPP[i + POSITION + 1] = emitterPosition.y;
-					VBOCPP[i + POSITION + 2] = emitterPosition.z;
-
-					int mod = id % 4;
-					
-					float deltaSaturation = particleSaturationRand(gen);
-					VBOCPP[i + COLOR + 0] = deltaSaturation;
-					VBOCPP[i + COLOR + 1] = deltaSaturation;
-					VBOCPP[i + COLOR + 2] = deltaSaturation;
-					VBOCPP[i + COLOR + 3] = 1;
+			glDeleteBuffers(2, chunk.VBO);
+			glDeleteBuffers(2, chunk.simulationVBO);
+			return false;
+		}
+	}
 
-					if (mod > 0)
-					{
-						VBOCPP[i + POSITION + 0] += (emitterRadius * sin(mod * D120 + emitterRotation));
-						VBOCPP[i + POSITION + 2] -= (emitterRadius * cos(mod * D120 + emitterRotation));
-
-						switch (mod)
-						{
-						case 1:
-							VBOCPP[i + COLOR + 0] = 1; break;
-						case 2:
-							VBOCPP[i + COLOR + 1] = 1; break;
-						case 3:
-							VBOCPP[i + COLOR + 2] = 1; break;
-						}
-					}
+	// Set up vertex arrays and transform feedbacks of both ping-pong buffers once
+	CreateVertexArrays(chunk);
+	return true;
+}
 
-					VBOCPP[i + VELOCITY + 0] = emitterSpread == 0 ? 0 : emitterSpreadRand(gen) - emitterSpread * 0.5f;
-					VBOCPP[i + VELOCITY + 2] = emitterSpread == 0 ? 0 : emitterSpreadRand(gen) - emitterSpread * 0.5f;
+/**
+* Allocate buffer chunks needed to hold exactly the given count of particles, without
+* touching current chunks: new buffers of the last kept chunk (when its count changes)
+* and new chunks behind it.
+* @param count	- the new number of particles.
+* @param resize	- output allocated chunks, which are put in place by CommitBufferChunks.
+* @returns false if the driver is out of memory (nothing stays allocated then).
+*/
+bool Particles::PrepareBufferChunks(int count, ParticlesBufferResize& resize)
+{
+	resize.keptChunks		= 0;
+	resize.isLastResized	= false;
+	resize.added.clear();
+	while (resize.keptChunks < (int)bufferChunks.size() && bufferChunks[resize.keptChunks].first < count)
+	{
+		resize.keptChunks++;
+	}
 
-					VBOCPP[i + VELOCITY + 1] = halfRand(gen) + particleSpeed;
-				}
-			}
-			else
+	/// Buffers can't change their size, so the last kept chunk gets new ones
+	int first = 0;
+	if (resize.keptChunks > 0)
+	{
+		const ParticlesBufferChunk& last = bufferChunks[resize.keptChunks - 1];
+		int lastCount = std::min(bufferChunkSize, count - last.first);
+		if (lastCount != last.count)
+		{
+			if (CreateBufferChunk(resize.last, last.first, lastCount) == false)
 			{
-				VBOCPP[i + OTHERS + 1] = 0;
+				return false;
 			}
+			resize.isLastResized = true;
 		}
-		else
-		{
-			VBOCPP[i + POSITION + 0] += VBOCPP[i + VELOCITY + 0] * deltaTime;
-			VBOCPP[i + POSITION + 1] += VBOCPP[i + VELOCITY + 1] * deltaTime;
-			VBOCPP[i + POSITION + 2] += VBOCPP[i + VELOCITY + 2] * deltaTime;
-
-			VBOCPP[i + VELOCITY + 0] -= gravity*deltaTime;
-			VBOCPP[i + VELOCITY + 1] -= gravity*deltaTime;
-			VBOCPP[i + VELOCITY + 2] -= gravity*deltaTime;
-
-			VBOCPP[i + OTHERS] -= deltaTime;
+		first = last.first + lastCount;
+	}
 
-			if (VBOCPP[i + OTHERS] < 1)
-			{
-				VBOCPP[i + COLOR + 3] -= deltaTime;
-			}
+	for (; first < count; first += bufferChunkSize)
+	{
+		ParticlesBufferChunk chunk;
+		if (CreateBufferChunk(chunk, first, std::min(bufferChunkSize, count - first)) == false)
+		{
+			DiscardBufferChunks(resize);
+			return false;
 		}
+		resize.added.push_back(chunk);
 	}
+	return true;
 }
 
 /**
-* Draw particles.
-* @param camera - the pointer to the currently used camera.
+* Put chunks allocated by PrepareBufferChunks in place: particles of the last kept chunk
+* are copied to its new buffers, chunks behind the new count are deleted and new ones are added.
+* Only the newest buffers (the first ones) are copied, the others are overwritten by the next update.
+* @param resize - allocated chunks.
 */
-void Particles::Draw(Camera * camera)
+void Particles::CommitBufferChunks(ParticlesBufferResize& resize)
 {
-	/// Use render shader and our vertex array object to render all particles
-	glUseProgram(shader_render);
-		glBindVertexArray(VAO);
+	if (resize.isLastResized == true)
+	{
+		ParticlesBufferChunk& last = bufferChunks[resize.keptChunks - 1];
+		int keptCount = std::min(last.count, resize.last.count);
+		glBindBuffer(GL_COPY_READ_BUFFER, last.VBO[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, resize.last.VBO[0]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)keptCount * renderDataSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, last.simulationVBO[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, resize.last.simulationVBO[0]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)keptCount * simulationDataSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		DeleteBufferChunk(last);
+		last = resize.last;
+	}
 
-			if (UseCPU == true)
-			{
-				DrawCPU(camera);
-			}
-			else
-			{
-				/// Because after swap in update attribute pointers are pointing to the old data. They have to be updated.
-				/// We can bind only these data we need, so the position and the color.
-				char* pOffset = 0;
-				glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-				glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, particleDataSize, pOffset);
-				glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, particleDataSize, pOffset + glFloatSize * 3);
-		
-				/// Set uniforms for rendering
-				glUniformMatrix4fv(glGetUniformLocation(shader_render, "viewProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(camera->GetViewProjectionMatrix()));
-				glUniform1f(glGetUniformLocation(shader_render, "pointSize"), particlePointSize);
-		
-				/// Draw particles as points.
-				glDrawArrays(GL_POINTS, 0, particlesCount);	
-			}
+	while ((int)bufferChunks.size() > resize.keptChunks)
+	{
+		DeleteBufferChunk(bufferChunks.back());
+		bufferChunks.pop_back();
+	}
+	bufferChunks.insert(bufferChunks.end(), resize.added.begin(), resize.added.end());
 
-		/// Unbind vertex array object and render program, it is no need for them now.
-		glBindVertexArray(0);
-	glUseProgram(0);
+	resize.isLastResized = false;
+	resize.added.clear();
 }
 
 /**
-* Draw particles from data used in updating using CPU.
-* @param camera - the pointer to the currently used camera.
+* Delete chunks allocated by PrepareBufferChunks which won't be put in place.
+* @param resize - allocated chunks.
 */
-void Particles::DrawCPU(Camera * camera)
+void Particles::DiscardBufferChunks(ParticlesBufferResize& resize)
 {
-	/// This is drawing particles by using data from VBOCPP
+	if (resize.isLastResized == true)
+	{
+		DeleteBufferChunk(resize.last);
+	}
+	for (size_t i = 0; i < resize.added.size(); i++)
+	{
+		DeleteBufferChunk(resize.added[i]);
+	}
+	resize.isLastResized = false;
+	resize.added.clear();
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-	glBufferData(GL_ARRAY_BUFFER, particlesCount * particleDataSize, VBOCPP, GL_STREAM_DRAW);
+/**
+* Read the range of particles from buffers with the newest data (it can span few chunks).
+* @param render		- output render stream from the first particle in the range (NULL - it isn't read).
+* @param simulation	- output simulation stream from the first particle in the range.
+* @param from		- id of the first particle to read.
+* @param to			- id after the last particle to read.
+*/
+void Particles::ReadBufferChunks(ParticleRender* render, ParticleSimulation* simulation, int from, int to)
+{
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		ParticlesBufferChunk& chunk = bufferChunks[i];
+		int chunkFrom	= std::max(from, chunk.first);
+		int chunkTo		= std::min(to, chunk.first + chunk.count);
+		if (chunkFrom >= chunkTo)
+		{
+			continue;
+		}
+		if (render != NULL)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO[0]);
+			glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(chunkFrom - chunk.first) * renderDataSize, (GLsizeiptr)(chunkTo - chunkFrom) * renderDataSize, render + (chunkFrom - from));
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.simulationVBO[0]);
+		glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(chunkFrom - chunk.first) * simulationDataSize, (GLsizeiptr)(chunkTo - chunkFrom) * simulationDataSize, simulation + (chunkFrom - from));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+* Copy the range of particles to another place in buffers with the newest data, on the GPU.
+* Both ranges can span few chunks, but they mustn't overlap.
+* @param from	- id of the first particle to copy.
+* @param to		- id of the place of the first particle.
+* @param count	- how many particles to copy.
+*/
+void Particles::CopyBufferChunks(int from, int to, int count)
+{
+	/// All chunks but the last one hold bufferChunkSize particles, so the chunk of the id is known.
+	/// The range is copied in parts which don't cross the border of any chunk.
+	while (count > 0)
+	{
+		const ParticlesBufferChunk& source		= bufferChunks[from / bufferChunkSize];
+		const ParticlesBufferChunk& destination	= bufferChunks[to / bufferChunkSize];
+		int part = std::min(count, std::min(source.first + source.count - from, destination.first + destination.count - to));
+
+		glBindBuffer(GL_COPY_READ_BUFFER, source.VBO[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination.VBO[0]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)(from - source.first) * renderDataSize,
+			(GLintptr)(to - destination.first) * renderDataSize, (GLsizeiptr)part * renderDataSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, source.simulationVBO[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination.simulationVBO[0]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)(from - source.first) * simulationDataSize,
+			(GLintptr)(to - destination.first) * simulationDataSize, (GLsizeiptr)part * simulationDataSize);
+
+		from	+= part;
+		to		+= part;
+		count	-= part;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/**
+* Upload the range of particles to buffers with the newest data (it can span few chunks).
+* @param render		- render stream of particles from the first one in the range.
+* @param simulation	- simulation stream of particles from the first one in the range.
+* @param from		- id of the first particle to upload.
+* @param to			- id after the last particle to upload.
+*/
+void Particles::UploadBufferChunks(const ParticleRender* render, const ParticleSimulation* simulation, int from, int to)
+{
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		ParticlesBufferChunk& chunk = bufferChunks[i];
+		int chunkFrom	= std::max(from, chunk.first);
+		int chunkTo		= std::min(to, chunk.first + chunk.count);
+		if (chunkFrom >= chunkTo)
+		{
+			continue;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(chunkFrom - chunk.first) * renderDataSize, (GLsizeiptr)(chunkTo - chunkFrom) * renderDataSize, render + (chunkFrom - from));
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.simulationVBO[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(chunkFrom - chunk.first) * simulationDataSize, (GLsizeiptr)(chunkTo - chunkFrom) * simulationDataSize, simulation + (chunkFrom - from));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+* Delete buffers, vertex arrays and transform feedbacks of the chunk.
+* @param chunk - the chunk to delete.
+*/
+void Particles::DeleteBufferChunk(ParticlesBufferChunk& chunk)
+{
+	glDeleteBuffers(2, chunk.VBO);
+	glDeleteBuffers(2, chunk.simulationVBO);
+	glDeleteVertexArrays(2, chunk.VAO);
+	glDeleteTransformFeedbacks(2, chunk.transformFeedback);
+}
 
+/**
+* Create vertex array objects reading both streams of every ping-pong buffer of the chunk
+* and transform feedback objects writing to the other ones. They are set up once, so
+* every update and draw only binds them.
+* @param chunk - the chunk with created buffers.
+*/
+void Particles::CreateVertexArrays(ParticlesBufferChunk& chunk)
+{
+	/// Locations 1 and 2 read the render stream (binding point 0), locations 3 and 4
+	/// read the simulation stream (binding point 1), the same as in shaders.
+	if (GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access)
+	{
+		glCreateVertexArrays(2, chunk.VAO);
+		glCreateTransformFeedbacks(2, chunk.transformFeedback);
+		for (int i = 0; i < 2; i++)
+		{
+			glVertexArrayVertexBuffer(chunk.VAO[i], 0, chunk.VBO[i], 0, renderDataSize);
+			glVertexArrayVertexBuffer(chunk.VAO[i], 1, chunk.simulationVBO[i], 0, simulationDataSize);
+			glVertexArrayAttribFormat(chunk.VAO[i], 1, 3, GL_FLOAT, GL_FALSE, offsetof(ParticleRender, position));
+			glVertexArrayAttribIFormat(chunk.VAO[i], 2, 1, GL_UNSIGNED_INT, offsetof(ParticleRender, color));
+			glVertexArrayAttribFormat(chunk.VAO[i], 3, 3, GL_FLOAT, GL_FALSE, offsetof(ParticleSimulation, velocity));
+			glVertexArrayAttribFormat(chunk.VAO[i], 4, 2, GL_FLOAT, GL_FALSE, offsetof(ParticleSimulation, others));
+			for (GLuint location = 1; location <= 4; location++)
+			{
+				glVertexArrayAttribBinding(chunk.VAO[i], location, location <= 2 ? 0 : 1);
+				glEnableVertexArrayAttrib(chunk.VAO[i], location);
+			}
+
+			glTransformFeedbackBufferBase(chunk.transformFeedback[i], 0, chunk.VBO[1 - i]);
+			glTransformFeedbackBufferBase(chunk.transformFeedback[i], 1, chunk.simulationVBO[1 - i]);
+		}
+		return;
+	}
+
+	/// Without direct state access the same state is set by binding every object once
+	glGenVertexArrays(2, chunk.VAO);
+	glGenTransformFeedbacks(2, chunk.transformFeedback);
 	char* pOffset = 0;
-	glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, particleDataSize, pOffset);
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, particleDataSize, pOffset + glFloatSize * 3);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindVertexArray(chunk.VAO[i]);
+			glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO[i]);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, renderDataSize, pOffset + offsetof(ParticleRender, position));
+			glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, renderDataSize, pOffset + offsetof(ParticleRender, color));
+			glBindBuffer(GL_ARRAY_BUFFER, chunk.simulationVBO[i]);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, simulationDataSize, pOffset + offsetof(ParticleSimulation, velocity));
+			glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, simulationDataSize, pOffset + offsetof(ParticleSimulation, others));
+			for (int location = 1; location <= 4; location++)
+			{
+				glEnableVertexAttribArray(location);
+			}
+		glBindVertexArray(0);
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, chunk.transformFeedback[i]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, chunk.VBO[1 - i]);
+			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, chunk.simulationVBO[1 - i]);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+* Update particles' state using the CPU.
+* @param deltaTime - the portion of time thas passed from previous update.
+*/
+void Particles::UpdateCPU(float deltaTime)
+{
+	/// First updating the states of the emitter, the rest is simulated by the core
+	emitterVelocity = glm::vec3(0);
+	if (HandleInput() == true)
+	{
+		emitterVelocity = emitterMoveDir * emitterMoveSpeed;
+		emitterPosition += (emitterVelocity * deltaTime);
+	}
 
-	glUniformMatrix4fv(glGetUniformLocation(shader_render, "viewProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(camera->GetViewProjectionMatrix()));
-	glUniform1f(glGetUniformLocation(shader_render, "pointSize"), particlePointSize);
+	SimulateCPU(deltaTime);
+	if (UseStats == true)
+	{
+		SetStats(GetUpdateStats());
+	}
+}
+/**
+* Update particles' state in analytic mode. Only the emitter is updated and
+* newly emitted particles are written, all others are evaluated in rendering.
+* @param deltaTime - the portion of time thas passed from previous update.
+*/
+void Particles::UpdateAnalytic(float deltaTime)
+{
+	emitterVelocity = glm::vec3(0);
+	if (HandleInput() == true)
+	{
+		emitterVelocity = emitterMoveDir * emitterMoveSpeed;
+		emitterPosition += (emitterVelocity * deltaTime);
+	}
+	emitterRotation += emitterRotationSpeed * deltaTime;
+	randomEpoch++;
+
+	// Wrap the time, so it won't lose the precision during the long run
+	analyticTime = fmod(analyticTime + deltaTime, PARTICLES_ANALYTIC_TIME_PERIOD);
+
+	WrapEmission();
+
+	/// Particles are emitted in the order of their ids, so the next portion is the oldest one.
+	/// It is overwritten even if it still lives (only when life time is longer than the emission cycle).
+	emitFrom = particlesEmitted;
+	int portions = CountEmissions(deltaTime);
+	if (portions > 0)
+	{
+		particlesEmitted = std::min(particlesEmitted + portions * particlesEmitAtOnce, particlesCount);
+		EmitAnalytic(emitFrom, particlesEmitted);
+	}
+}
+
+/**
+* Emit particles in analytic mode and upload them to the vertex buffers.
+* @param from	- id of the first particle to emit.
+* @param to		- id after the last particle to emit.
+*/
+void Particles::EmitAnalytic(int from, int to)
+{
+	/// On the CPU path particles are written straight to the CPU store,
+	/// on the GPU path only to the staging data for upload.
+	std::mt19937 gen(randomEpoch);
+	if (UseCPU == false && (int)analyticRenderStaging.size() < to - from)
+	{
+		analyticRenderStaging.resize(to - from);
+		analyticSimulationStaging.resize(to - from);
+	}
+	ParticleRender* render			= (UseCPU == true) ? renderCPU + from : analyticRenderStaging.data();
+	ParticleSimulation* simulation	= (UseCPU == true) ? simulationCPU + from : analyticSimulationStaging.data();
+	for (int id = from; id < to; id++)
+	{
+		// Particles skipped by the reduced emission stay not emitted (invisible)
+		if ((id / 4) % emitStride != 0)
+		{
+			render[id - from].color				= 0;
+			simulation[id - from].others[1]		= 0;
+			continue;
+		}
+
+		float age = GetEmissionAge(id, emitFrom, emitAge);
+		EmitParticleCPU(render[id - from], simulation[id - from], id, gen, age, emitMark);
+
+		// Remember the spawn time instead of the life time left (the time the particle was due)
+		simulation[id - from].others[0] = fmodf(analyticTime - age + PARTICLES_ANALYTIC_TIME_PERIOD, PARTICLES_ANALYTIC_TIME_PERIOD);
+	}
+
+	// Upload only the emitted particles, others don't change
+	UploadBufferChunks(render, simulation, from, to);
+}
+
+/**
+* Copy position, color and life time of every particle to the trajectory frame.
+* In analytic mode they are evaluated from the spawn state first.
+* @param render		- render stream of particles.
+* @param simulation	- simulation stream of particles.
+* @param frame		- trajectory frame (TRAJECTORY_PARTICLE_SIZE floats per particle).
+* @param time		- analytic time in which the data was captured.
+*/
+void Particles::GatherTrajectoryFrame(const ParticleRender* render, const ParticleSimulation* simulation, float* frame, float time)
+{
+	for (int i = 0; i < particlesCount; i++, render++, simulation++, frame += TRAJECTORY_PARTICLE_SIZE)
+	{
+		glm::vec4 color = UnpackColor(render->color);
 
-	glDrawArrays(GL_POINTS, 0, particlesCount);
+		if (UseAnalytic == true)
+		{
+			// The same calculations as in analytic render shader
+			float age = fmod(time - simulation->others[0] + PARTICLES_ANALYTIC_TIME_PERIOD, PARTICLES_ANALYTIC_TIME_PERIOD);
+			bool isAlive = simulation->others[1] != 0 && age < particleLifeTime;
+			float fade = std::max(0.f, age - std::max(particleLifeTime - 1.f, 0.f));
+
+			frame[0] = render->position[0] + simulation->velocity[0] * age;
+			frame[1] = render->position[1] + simulation->velocity[1] * age - 0.5f * gravity * age * age;
+			frame[2] = render->position[2] + simulation->velocity[2] * age;
+			for (int j = 0; j < 4; j++)
+			{
+				frame[3 + j] = isAlive == true ? color[j] : 0.f;
+			}
+			frame[6] = std::max(frame[6] - fade, 0.f);
+			frame[7] = isAlive == true ? particleLifeTime - age : 0.f;
+			continue;
+		}
+
+		for (int j = 0; j < 3; j++)
+		{
+			frame[j] = render->position[j];
+		}
+		for (int j = 0; j < 4; j++)
+		{
+			frame[3 + j] = color[j];
+		}
+		frame[7] = simulation->others[0];
+	}
 }
 
 /**
-* Handle the input controlling particle emitter position.
+* Capture particles data for the trajectory file every trajectoryTickInterval ticks.
+* On the GPU path data is copied to the read buffer and fetched few ticks later,
+* when the copy is finished, so the pipeline is never stalled.
+*/
+void Particles::CaptureTrajectory()
+{
+	if (trajectoryWriter == NULL)
+	{
+		return;
+	}
+
+	bool isCaptureTick = (ticksCount % trajectoryTickInterval) == 0;
+
+	/// On the CPU path data can be captured right away
+	if (UseCPU == true)
+	{
+		if (isCaptureTick == true)
+		{
+			// When the writer is busy the frame is dropped, the simulation doesn't wait
+			int slot = trajectoryWriter->AcquireFrame();
+			if (slot >= 0)
+			{
+				GatherTrajectoryFrame(renderCPU, simulationCPU, trajectoryWriter->GetFrame(slot), analyticTime);
+				trajectoryWriter->SubmitFrame(slot, ticksCount);
+			}
+		}
+		return;
+	}
+
+	/// Fetch data from every finished copy, starting from the oldest one
+	for (int i = 0; i < 2; i++)
+	{
+		int buffer = (trajectoryBufferIndex + i) % 2;
+		if (trajectoryFences[buffer] == NULL)
+		{
+			continue;
+		}
+
+		GLenum status = glClientWaitSync(trajectoryFences[buffer], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			continue;
+		}
+		glDeleteSync(trajectoryFences[buffer]);
+		trajectoryFences[buffer] = NULL;
+
+		int slot = trajectoryWriter->AcquireFrame();
+		if (slot >= 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, trajectoryBuffers[buffer]);
+			const char* data = (const char*)glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_ONLY);
+			if (data != NULL)
+			{
+				// The simulation stream is copied right after the render stream
+				GatherTrajectoryFrame((const ParticleRender*)data, (const ParticleSimulation*)(data + (size_t)particlesCount * renderDataSize),
+					trajectoryWriter->GetFrame(slot), trajectoryTimes[buffer]);
+				glUnmapBuffer(GL_COPY_READ_BUFFER);
+			}
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			trajectoryWriter->SubmitFrame(slot, trajectoryTicks[buffer]);
+		}
+	}
+
+	/// Copy the newest data to the free read buffer. If both are still busy the frame is dropped.
+	if (isCaptureTick == true && trajectoryFences[trajectoryBufferIndex] == NULL)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, trajectoryBuffers[trajectoryBufferIndex]);
+		for (size_t i = 0; i < bufferChunks.size(); i++)
+		{
+			ParticlesBufferChunk& chunk = bufferChunks[i];
+			glBindBuffer(GL_COPY_READ_BUFFER, chunk.VBO[0]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, (GLintptr)chunk.first * renderDataSize, (GLsizeiptr)chunk.count * renderDataSize);
+			glBindBuffer(GL_COPY_READ_BUFFER, chunk.simulationVBO[0]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, (GLintptr)particlesCount * renderDataSize + (GLintptr)chunk.first * simulationDataSize,
+				(GLsizeiptr)chunk.count * simulationDataSize);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		trajectoryFences[trajectoryBufferIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		trajectoryTicks[trajectoryBufferIndex] = ticksCount;
+		trajectoryTimes[trajectoryBufferIndex] = analyticTime;
+		trajectoryBufferIndex = (trajectoryBufferIndex + 1) % 2;
+	}
+}
+
+/**
+* Read back finished statistics of previous updates and copy counters of the current
+* update to the free read buffer. Read buffers are checked with fences, so the pipeline
+* is never stalled and statistics are just dropped when no buffer is free.
+*/
+void Particles::CaptureStats()
+{
+	if (UseStats == false)
+	{
+		return;
+	}
+
+	/// Fetch counters from every finished copy, starting from the oldest one
+	for (int i = 0; i < PARTICLES_STATS_LATENCY; i++)
+	{
+		int buffer = (statsBufferIndex + i) % PARTICLES_STATS_LATENCY;
+		if (statsFences[buffer] == NULL)
+		{
+			continue;
+		}
+
+		GLenum status = glClientWaitSync(statsFences[buffer], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			continue;
+		}
+		glDeleteSync(statsFences[buffer]);
+		statsFences[buffer] = NULL;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, statsBuffers[buffer]);
+		const GLuint* counters = (const GLuint*)glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_ONLY);
+		if (counters != NULL)
+		{
+			ParticlesStats updateStats;
+			updateStats.alive	= counters[0];
+			updateStats.emitted	= counters[1];
+			updateStats.died	= counters[2];
+			updateStats.tick	= statsTicks[buffer];
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			SetStats(updateStats);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	/// Copy counters of this update to the free read buffer. If all are still busy they are dropped.
+	if (statsFences[statsBufferIndex] == NULL)
+	{
+		/// Counters are written by atomic operations of the shader, they have to be visible to the copy
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, statsCounters);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, statsBuffers[statsBufferIndex]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 3 * sizeof(GLuint));
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		statsFences[statsBufferIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		statsTicks[statsBufferIndex] = ticksCount;
+		statsBufferIndex = (statsBufferIndex + 1) % PARTICLES_STATS_LATENCY;
+	}
+}
+
+/**
+* Remember the statistics of the update and print them every statsReportInterval ticks.
+* @param newStats - statistics of the update.
+*/
+void Particles::SetStats(const ParticlesStats& newStats)
+{
+	stats = newStats;
+	if (statsReportInterval > 0 && stats.tick >= statsReportTick + statsReportInterval)
+	{
+		printf("Tick %llu: %u particles alive, %u emitted, %u died\n", stats.tick, stats.alive, stats.emitted, stats.died);
+		statsReportTick = stats.tick;
+	}
+}
+
+/**
+* Draw particles.
+* @param camera - the pointer to the currently used camera.
+*/
+void Particles::Draw(Camera * camera)
+{
+	/// Nothing is drawn when the whole system is outside of the view
+	if (IsVisible(camera) == false)
+	{
+		return;
+	}
+
+	/// On the CPU path all particles have to be uploaded first. In analytic mode
+	/// only emitted particles are uploaded and it is done in the update.
+	if (UseCPU == true && UseAnalytic == false)
+	{
+		UploadCPU();
+	}
+
+	/// Sort particles by the distance from the camera every sortInterval frames. Particles
+	/// keep their ids between updates, so the old order is still nearly right in between.
+	/// The compute rasterizer doesn't depend on the order.
+	if (depthSorter != NULL && renderer != PARTICLES_RENDERER_COMPUTE && --framesToSort <= 0)
+	{
+		if (UseAnalytic == true)
+		{
+			glUseProgram(depthSorter->GetKeysProgram());
+			SetAnalyticUniforms(depthSorter->GetKeysProgram());
+		}
+		depthSorter->Sort(bufferChunks[0].VBO[0], bufferChunks[0].simulationVBO[0], camera->GetViewMatrix(), UseAnalytic);
+		framesToSort = sortInterval;
+	}
+
+	/// The compute rasterizer draws one pixel particles, so the fill rate doesn't limit it
+	/// and it always uses the full resolution.
+	if (GetRenderScale() < 1.f && renderer != PARTICLES_RENDERER_COMPUTE)
+	{
+		glm::ivec2 fullSize = renderSize;
+		renderSize = reducedResolution->GetSize();
+
+		reducedResolution->Begin();
+		DrawWithRenderer(renderer, camera, particlesCount, particlePointSize * lodSizeScale * reducedResolution->GetScale());
+		reducedResolution->End(camera->GetProjectionMatrix());
+
+		renderSize = fullSize;
+	}
+	else
+	{
+		DrawWithRenderer(renderer, camera, particlesCount, particlePointSize * lodSizeScale);
+	}
+}
+
+/**
+* Set the fraction of the render size in which particles are drawn.
+* @param scale - the scale, 1 draws particles straight to the main framebuffer.
+*/
+void Particles::SetRenderScale(float scale)
+{
+	if (reducedResolution != NULL)
+	{
+		reducedResolution->SetScale(scale);
+	}
+}
+
+/**
+* Get the fraction of the render size in which particles are drawn.
+*/
+float Particles::GetRenderScale()
+{
+	return (reducedResolution != NULL) ? reducedResolution->GetScale() : 1.f;
+}
+
+/**
+* Draw particles with the chosen renderer.
+* @param renderer	- the renderer to use.
+* @param camera		- the pointer to the currently used camera.
+* @param count		- how many particles (from the first one) to draw.
+* @param size		- size of the particle in pixels (compute rasterizer draws always one pixel).
+*/
+void Particles::DrawWithRenderer(ParticlesRenderer renderer, Camera * camera, int count, float size)
+{
+	switch (renderer)
+	{
+		case PARTICLES_RENDERER_BILLBOARDS:
+			DrawBillboards(camera, count, size);
+			break;
+		case PARTICLES_RENDERER_COMPUTE:
+			DrawCompute(camera, count);
+			break;
+		default:
+			DrawPoints(camera, count, size);
+			break;
+	}
+}
+
+/**
+* Upload the render stream of particles updated using CPU to the vertex buffer.
+* The simulation stream isn't needed in drawing, so it stays on the CPU.
+*/
+void Particles::UploadCPU()
+{
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, bufferChunks[i].VBO[0]);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)bufferChunks[i].count * renderDataSize, renderCPU + bufferChunks[i].first, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+* Set uniforms needed for evaluating particles from their spawn state in analytic mode.
+* @param program - the render program using these uniforms.
+*/
+void Particles::SetAnalyticUniforms(GLuint program)
+{
+	glUniform1f(glGetUniformLocation(program, "time"), analyticTime);
+	glUniform1f(glGetUniformLocation(program, "timePeriod"), PARTICLES_ANALYTIC_TIME_PERIOD);
+	glUniform1f(glGetUniformLocation(program, "lifeTime"), particleLifeTime);
+	glUniform1f(glGetUniformLocation(program, "gravity"), gravity);
+}
+
+/**
+* Draw particles as points.
+* @param camera	- the pointer to the currently used camera.
+* @param count	- how many particles (from the first one) to draw.
+* @param size	- size of the point in pixels.
+*/
+void Particles::DrawPoints(Camera * camera, int count, float size)
+{
+	/// In analytic mode position and alpha of every particle are evaluated
+	/// in the vertex shader from its spawn state.
+	GLuint program = (UseAnalytic == true) ? shader_render_analytic : shader_render;
+
+	/// Use render shader and our vertex array object to render all particles
+	glUseProgram(program);
+		if (UseAnalytic == true)
+		{
+			SetAnalyticUniforms(program);
+		}
+
+		/// Set uniforms for rendering (matrices come from the uniform buffer of the camera)
+		glUniform1f(glGetUniformLocation(program, "pointSize"), size);
+
+		/// Every chunk is drawn with its own draw. The first vertex array always reads the newest
+		/// data. The shader fetches only the render stream (analytic shader needs the simulation
+		/// stream with the spawn state too).
+		for (size_t i = 0; i < bufferChunks.size() && bufferChunks[i].first < count; i++)
+		{
+			ParticlesBufferChunk& chunk = bufferChunks[i];
+			glBindVertexArray(chunk.VAO[0]);
+
+			/// Draw particles as points. Sorted particles (only one chunk) are drawn back to
+			/// front, so they don't have to write the depth and occlude each other.
+			if (depthSorter != NULL)
+			{
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, depthSorter->GetIndexBuffer());
+				glDepthMask(GL_FALSE);
+				glDrawElements(GL_POINTS, count, GL_UNSIGNED_INT, 0);
+				glDepthMask(GL_TRUE);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			}
+			else
+			{
+				glDrawArrays(GL_POINTS, 0, std::min(chunk.count, count - chunk.first));
+			}
+		}
+
+		/// Unbind vertex array object and render program, it is no need for them now.
+		glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+/**
+* Draw particles as camera facing quads. Every quad is one instance of the triangle strip
+* and it reads its particle from the buffer texture, so it isn't limited by the point size.
+* @param camera	- the pointer to the currently used camera.
+* @param count	- how many particles (from the first one) to draw.
+* @param size	- size of the quad in pixels (at the attenuation distance when attenuation is used).
+*/
+void Particles::DrawBillboards(Camera * camera, int count, float size)
+{
+	glUseProgram(shader_billboard);
+		glBindVertexArray(bufferChunks[0].VAO[0]);
+
+			glUniform1f(glGetUniformLocation(shader_billboard, "pointSize"), size);
+			glUniform2f(glGetUniformLocation(shader_billboard, "viewportSize"), (float)renderSize.x, (float)renderSize.y);
+			glUniform1f(glGetUniformLocation(shader_billboard, "attenuationDistance"), billboardAttenuation);
+			glUniform1f(glGetUniformLocation(shader_billboard, "sizeVariation"), billboardSizeVariation);
+			glUniform1i(glGetUniformLocation(shader_billboard, "analytic"), UseAnalytic == true ? 1 : 0);
+			if (UseAnalytic == true)
+			{
+				SetAnalyticUniforms(shader_billboard);
+			}
+
+			/// Every chunk is drawn with its own draw. Buffers are swapped in every update, so the
+			/// current ones are attached to textures. The simulation stream is read only in analytic mode.
+			for (size_t i = 0; i < bufferChunks.size() && bufferChunks[i].first < count; i++)
+			{
+				ParticlesBufferChunk& chunk = bufferChunks[i];
+				if (UseAnalytic == true)
+				{
+					glActiveTexture(GL_TEXTURE2);
+					glBindTexture(GL_TEXTURE_BUFFER, simulationTexture);
+					glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, chunk.simulationVBO[0]);
+				}
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_BUFFER, particlesTexture);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, chunk.VBO[0]);
+				glUniform1i(glGetUniformLocation(shader_billboard, "firstId"), chunk.first);
+
+				/// Four vertices of the quad are generated from gl_VertexID. Sorted particles
+				/// (only one chunk) are drawn back to front, so they don't have to write the depth.
+				if (depthSorter != NULL)
+				{
+					glActiveTexture(GL_TEXTURE1);
+					glBindTexture(GL_TEXTURE_BUFFER, sortedIndicesTexture);
+					glDepthMask(GL_FALSE);
+					glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+					glDepthMask(GL_TRUE);
+					glBindTexture(GL_TEXTURE_BUFFER, 0);
+					glActiveTexture(GL_TEXTURE0);
+				}
+				else
+				{
+					glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, std::min(chunk.count, count - chunk.first));
+				}
+			}
+
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+			if (UseAnalytic == true)
+			{
+				glActiveTexture(GL_TEXTURE2);
+				glBindTexture(GL_TEXTURE_BUFFER, 0);
+				glActiveTexture(GL_TEXTURE0);
+			}
+
+		glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+/**
+* Draw one pixel particles with the compute rasterizer.
+* @param camera	- the pointer to the currently used camera.
+* @param count	- how many particles (from the first one) to draw.
+*/
+void Particles::DrawCompute(Camera * camera, int count)
+{
+	if (UseAnalytic == true)
+	{
+		glUseProgram(computeRasterizer->GetProgram());
+		SetAnalyticUniforms(computeRasterizer->GetProgram());
+	}
+
+	/// All chunks are rasterized into the same framebuffer
+	std::vector<GLuint> renderBuffers(bufferChunks.size());
+	std::vector<GLuint> simulationBuffers(bufferChunks.size());
+	std::vector<int> counts(bufferChunks.size());
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		renderBuffers[i]		= bufferChunks[i].VBO[0];
+		simulationBuffers[i]	= bufferChunks[i].simulationVBO[0];
+		counts[i]				= std::max(0, std::min(bufferChunks[i].count, count - bufferChunks[i].first));
+	}
+	computeRasterizer->Draw(renderBuffers.data(), simulationBuffers.data(), counts.data(), (int)bufferChunks.size(), camera->GetViewProjectionMatrix(), UseAnalytic);
+}
+
+/**
+* Check if the renderer can be used in the current OpenGL context.
+* @param renderer - the renderer to check.
+* @returns true if the renderer is available.
+*/
+bool Particles::IsRendererAvailable(ParticlesRenderer renderer)
+{
+	switch (renderer)
+	{
+		case PARTICLES_RENDERER_BILLBOARDS:
+			return shader_billboard != 0;
+		case PARTICLES_RENDERER_COMPUTE:
+			return computeRasterizer != NULL;
+		default:
+			return true;
+	}
+}
+
+/**
+* Switch to the next available renderer.
+*/
+void Particles::NextRenderer()
+{
+	do
+	{
+		renderer = (ParticlesRenderer)((renderer + 1) % PARTICLES_RENDERERS_COUNT);
+	} while (IsRendererAvailable(renderer) == false);
+	printf("Drawing particles with renderer: %s\n", rendererNames[renderer]);
+}
+
+/**
+* Measure the GPU time of drawing particles with every available renderer for every
+* configured particles count and size, and print the table with results.
+* @param camera - the pointer to the currently used camera.
+*/
+void Particles::RunRenderBenchmark(Camera * camera)
+{
+	if (UseCPU == true && UseAnalytic == false)
+	{
+		UploadCPU();
+	}
+
+	/// Depth test would reject repeated draws of the same particles, so it is disabled
+	/// and the result is just the cost of vertex processing and rasterisation.
+	glDisable(GL_DEPTH_TEST);
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	printf("%10s %8s", "Count", "Size");
+	for (int i = 0; i < PARTICLES_RENDERERS_COUNT; i++)
+	{
+		if (IsRendererAvailable((ParticlesRenderer)i) == true)
+		{
+			printf(" %11s [ms]", rendererNames[i]);
+		}
+	}
+	printf(" %11s\n", "Winner");
+
+	for (size_t c = 0; c < benchmarkCounts.size(); c++)
+	{
+		int count = std::min(benchmarkCounts[c], particlesCount);
+		for (size_t s = 0; s < benchmarkSizes.size(); s++)
+		{
+			printf("%10d %8.1f", count, benchmarkSizes[s]);
+			int winner = 0;
+			double bestTime = 0;
+			for (int i = 0; i < PARTICLES_RENDERERS_COUNT; i++)
+			{
+				if (IsRendererAvailable((ParticlesRenderer)i) == false)
+				{
+					continue;
+				}
+
+				// The first draw is a warm up (shader and state changes are not measured)
+				for (int r = 0; r <= benchmarkRepeats; r++)
+				{
+					if (r == 1)
+					{
+						glBeginQuery(GL_TIME_ELAPSED, query);
+					}
+					DrawWithRenderer((ParticlesRenderer)i, camera, count, benchmarkSizes[s]);
+				}
+				glEndQuery(GL_TIME_ELAPSED);
+
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+				double time = elapsed / 1000000.0 / benchmarkRepeats;
+				if (i == 0 || time < bestTime)
+				{
+					winner		= i;
+					bestTime	= time;
+				}
+				printf(" %16.3f", time);
+			}
+			printf(" %11s\n", rendererNames[winner]);
+		}
+	}
+
+	glDeleteQueries(1, &query);
+	glEnable(GL_DEPTH_TEST);
+}
+
+/**
+* Save the complete simulation state (particles data, emitter state, emission
+* counters and random epoch) to the snapshot file.
+* @param path - path to the snapshot file.
+* @returns true if the snapshot was saved.
+*/
+bool Particles::SaveSnapshot(const char* path)
+{
+	/// Remember the whole state which isn't stored in particles data
+	SnapshotHeader header = {};
+	header.particleSize			= particleSize;
+	header.renderParticleSize	= renderDataSize / glFloatSize;
+	header.particlesCount		= particlesCount;
+	header.particlesEmitted		= particlesEmitted;
+	header.emitMark				= emitMark;
+	header.randomEpoch			= randomEpoch;
+	header.timeToNextEmission	= timeToNextEmission;
+	header.emitterRotation		= emitterRotation;
+	header.emitterPosition[0]	= emitterPosition.x;
+	header.emitterPosition[1]	= emitterPosition.y;
+	header.emitterPosition[2]	= emitterPosition.z;
+	header.particleLifeTime		= particleLifeTime;
+	header.analytic				= UseAnalytic == true ? 1 : 0;
+	header.analyticTime			= analyticTime;
+
+	if (UseCPU == true)
+	{
+		return Snapshot::Save(path, header, renderCPU, simulationCPU);
+	}
+
+	/// Read buffers with the newest data (they are always the first ones after the swap)
+	/// of all chunks, so streams can be written to the file in one piece.
+	std::vector<ParticleRender> renderData(particlesCount);
+	std::vector<ParticleSimulation> simulationData(particlesCount);
+	ReadBufferChunks(renderData.data(), simulationData.data(), 0, particlesCount);
+
+	return Snapshot::Save(path, header, renderData.data(), simulationData.data());
+}
+
+/**
+* Load the complete simulation state from the snapshot file. The snapshot must
+* be saved with the same particles count.
+* @param path - path to the snapshot file.
+* @returns true if the snapshot was loaded.
+*/
+bool Particles::LoadSnapshot(const char* path)
+{
+	Snapshot snapshot;
+	if (snapshot.Open(path) == false)
+	{
+		return false;
+	}
+
+	const SnapshotHeader* header = snapshot.GetHeader();
+	if (header->particlesCount != (uint32_t)particlesCount || header->particleSize != (uint32_t)particleSize ||
+		header->renderParticleSize != (uint32_t)(renderDataSize / glFloatSize))
+	{
+		printf("Snapshot %s has %u particles, but %d are configured\n", path, header->particlesCount, particlesCount);
+		return false;
+	}
+	if ((header->analytic != 0) != UseAnalytic)
+	{
+		printf("Snapshot %s was saved in different analytic mode\n", path);
+		return false;
+	}
+
+	/// Restore the state which isn't stored in particles data
+	particlesEmitted	= header->particlesEmitted;
+	emitMark			= header->emitMark;
+	randomEpoch			= header->randomEpoch;
+	timeToNextEmission	= header->timeToNextEmission;
+	emitterRotation		= header->emitterRotation;
+	emitterPosition		= glm::vec3(header->emitterPosition[0], header->emitterPosition[1], header->emitterPosition[2]);
+	particleLifeTime	= header->particleLifeTime;
+	analyticTime		= header->analyticTime;
+
+	// Loaded particles were emitted around the saved emitter position, start the trail there
+	emitterTrailMin		= emitterPosition;
+	emitterTrailMax		= emitterPosition;
+	emitterTrailTime	= particleLifeTime;
+	culledTime			= 0;
+
+	/// Particles data can be used as it is, without any parsing.
+	/// In analytic mode the CPU path renders straight from the vertex buffer too.
+	if (UseCPU == true)
+	{
+		memcpy(renderCPU, snapshot.GetRenderData(), (size_t)header->renderDataSize);
+		memcpy(simulationCPU, snapshot.GetSimulationData(), (size_t)(header->dataSize - header->renderDataSize));
+		if (UseAnalytic == false)
+		{
+			return true;
+		}
+	}
+
+	// Upload data to buffers which will be used in the next update
+	UploadBufferChunks((const ParticleRender*)snapshot.GetRenderData(), (const ParticleSimulation*)snapshot.GetSimulationData(), 0, particlesCount);
+
+	// Restore the state in the uniform buffer too
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[1], 12, glm::value_ptr(emitterPosition));
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[2], 4, &particlesEmitted);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[3], 4, &emitterRotation);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[4], 4, &particleLifeTime);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[10], 4, &randomEpoch);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	return true;
+}
+
+/**
+* Change the number of particles without restarting. Buffers grow or shrink chunk by
+* chunk and only the last chunk is copied, the CPU store is reallocated. All new storage is
+* allocated before anything is changed. When shrinking, alive particles above the new count
+* are moved to free places below it (those which don't fit die). The trajectory file can't
+* change its count, so recording stops.
+* @param newCount - the new number of particles.
+* @returns false if the memory can't be allocated (the count stays the same).
+*/
+bool Particles::Resize(int newCount)
+{
+	newCount = std::max(1, newCount);
+	if (newCount == particlesCount)
+	{
+		return true;
+	}
+	double startTime = glfwGetTime();
+
+	/// All new storage is allocated before anything is moved or deleted, so on failure
+	/// it is just released and particles of the old count are untouched.
+	ParticlesBufferResize bufferResize;
+	if (PrepareBufferChunks(newCount, bufferResize) == false)
+	{
+		printf("Can't allocate vertex buffers of %d particles, the count stays %d\n", newCount, particlesCount);
+		return false;
+	}
+	Arena* oldArena = particlesArena;
+	if (UseCPU == true)
+	{
+		particlesArena = new Arena();
+		if (particlesArena->Init((size_t)newCount * (renderDataSize + simulationDataSize) + 2 * ARENA_ALIGNMENT, oldArena->GetPages()) == false)
+		{
+			printf("Can't allocate CPU streams of %d particles, the count stays %d\n", newCount, particlesCount);
+			delete particlesArena;
+			particlesArena = oldArena;
+			DiscardBufferChunks(bufferResize);
+			return false;
+		}
+	}
+
+	/// Alive particles are moved before the storage shrinks. On the GPU path they are
+	/// moved between buffers, only the simulation stream is read to find them.
+	int diedCount = 0;
+	if (newCount < particlesCount)
+	{
+		if (UseCPU == true)
+		{
+			diedCount = CompactParticles(renderCPU, simulationCPU, newCount);
+		}
+		else
+		{
+			diedCount = CompactBufferChunks(newCount);
+		}
+	}
+
+	CommitBufferChunks(bufferResize);
+	if (UseCPU == true)
+	{
+		ParticleRender* oldRender			= renderCPU;
+		ParticleSimulation* oldSimulation	= simulationCPU;
+		int oldCount						= particlesCount;
+
+		/// New memory is placed by threads owning its chunks first, then the kept particles are copied
+		renderCPU		= (ParticleRender*)particlesArena->Allocate((size_t)newCount * renderDataSize);
+		simulationCPU	= (ParticleSimulation*)particlesArena->Allocate((size_t)newCount * simulationDataSize);
+		particlesCount	= newCount;
+		PlaceCPUParticles();
+
+		memcpy(renderCPU, oldRender, (size_t)std::min(oldCount, newCount) * renderDataSize);
+		memcpy(simulationCPU, oldSimulation, (size_t)std::min(oldCount, newCount) * simulationDataSize);
+		delete oldArena;
+	}
+	particlesCount = newCount;
+
+	/// Emission goes on from the same place, unless it is behind the new count. The life time
+	/// is the configured one again, unless it is longer than the whole emit process of the pool.
+	particlesEmitted	= std::min(particlesEmitted, particlesCount);
+	particleLifeTime	= GetClampedLifeTime(particlesCount);
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[2], 4, &particlesEmitted);
+	glBufferSubData(GL_UNIFORM_BUFFER, uniformsOffset[4], 4, &particleLifeTime);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	/// Sorted indices point into one buffer, so sorting stops when the pool needs more chunks
+	if (depthSorter != NULL && bufferChunks.size() > 1)
+	{
+		printf("Depth sorting is disabled, it needs all particles in one buffer chunk ([Particles] BufferChunkSize)\n");
+		delete depthSorter;
+		depthSorter = NULL;
+		glDeleteTextures(1, &sortedIndicesTexture);
+		sortedIndicesTexture = 0;
+		if (shader_billboard != 0)
+		{
+			glUseProgram(shader_billboard);
+			glUniform1i(glGetUniformLocation(shader_billboard, "sorted"), 0);
+			glUseProgram(0);
+		}
+	}
+	else if (depthSorter != NULL)
+	{
+		depthSorter->Resize(particlesCount);
+		framesToSort = 0;
+	}
+
+	if (trajectoryWriter != NULL)
+	{
+		printf("Trajectory recording is stopped, the particles count changed\n");
+		delete trajectoryWriter;
+		trajectoryWriter = NULL;
+	}
+
+	printf("Particles resized to %d in %.1f ms (%d alive particles didn't fit)\n", particlesCount, (glfwGetTime() - startTime) * 1000.0, diedCount);
+	return true;
+}
+
+/**
+* Move alive particles from ids above the new count to places of dead particles below it.
+* @param render		- render stream of particles.
+* @param simulation	- simulation stream of particles.
+* @param newCount	- the new number of particles.
+* @returns how many alive particles didn't fit below the new count (they die).
+*/
+int Particles::CompactParticles(ParticleRender* render, ParticleSimulation* simulation, int newCount)
+{
+	/// Moved particles keep the "was emitted" flag, so they aren't emitted again before the
+	/// emission counter wraps, like all other alive particles.
+	int freeId = 0;
+	int diedCount = 0;
+	for (int id = newCount; id < particlesCount; id++)
+	{
+		if (IsParticleAlive(simulation[id]) == false)
+		{
+			continue;
+		}
+		while (freeId < newCount && IsParticleAlive(simulation[freeId]) == true)
+		{
+			freeId++;
+		}
+		if (freeId == newCount)
+		{
+			diedCount++;
+			continue;
+		}
+		render[freeId]		= render[id];
+		simulation[freeId]	= simulation[id];
+		freeId++;
+	}
+	return diedCount;
+}
+
+/**
+* Move alive particles from ids above the new count to places of dead particles below it,
+* in buffers on the GPU. The simulation stream is read back block by block, above the new
+* count to find alive particles and below it only until enough free places are found.
+* Runs of particles which go to the run of free places are copied at once.
+* @param newCount - the new number of particles.
+* @returns how many alive particles didn't fit below the new count (they die).
+*/
+int Particles::CompactBufferChunks(int newCount)
+{
+	std::vector<ParticleSimulation> tail(PARTICLES_COMPACT_BLOCK_SIZE);
+	std::vector<ParticleSimulation> head(PARTICLES_COMPACT_BLOCK_SIZE);
+	int headFrom = 0;
+	int headTo = 0;
+	int freeId = 0;
+	int diedCount = 0;
+	for (int tailFrom = newCount; tailFrom < particlesCount; tailFrom += PARTICLES_COMPACT_BLOCK_SIZE)
+	{
+		int tailTo = std::min(tailFrom + PARTICLES_COMPACT_BLOCK_SIZE, particlesCount);
+		ReadBufferChunks(NULL, tail.data(), tailFrom, tailTo);
+
+		int id = tailFrom;
+		while (id < tailTo)
+		{
+			if (IsParticleAlive(tail[id - tailFrom]) == false)
+			{
+				id++;
+				continue;
+			}
+
+			/// Places below freeId are taken, the next block below the new count is read when needed
+			while (freeId < newCount)
+			{
+				if (freeId >= headTo)
+				{
+					headFrom	= freeId;
+					headTo		= std::min(freeId + PARTICLES_COMPACT_BLOCK_SIZE, newCount);
+					ReadBufferChunks(NULL, head.data(), headFrom, headTo);
+				}
+				if (IsParticleAlive(head[freeId - headFrom]) == false)
+				{
+					break;
+				}
+				freeId++;
+			}
+			if (freeId == newCount)
+			{
+				diedCount++;
+				id++;
+				continue;
+			}
+
+			int run = 1;
+			while (id + run < tailTo && freeId + run < headTo &&
+				IsParticleAlive(tail[id + run - tailFrom]) == true && IsParticleAlive(head[freeId + run - headFrom]) == false)
+			{
+				run++;
+			}
+			CopyBufferChunks(id, freeId, run);
+			id		+= run;
+			freeId	+= run;
+		}
+	}
+	return diedCount;
+}
+
+/**
+* Check if the particle is alive (in analytic mode it is evaluated from its spawn time).
+* @param simulation - simulation data of the particle.
+*/
+bool Particles::IsParticleAlive(const ParticleSimulation& simulation)
+{
+	if (UseAnalytic == true)
+	{
+		float age = fmodf(analyticTime - simulation.others[0] + PARTICLES_ANALYTIC_TIME_PERIOD, PARTICLES_ANALYTIC_TIME_PERIOD);
+		return simulation.others[1] != 0 && age < particleLifeTime;
+	}
+	return simulation.others[0] > 0;
+}
+
+/**
+* Handle the input controlling particle emitter position. It is ignored while the skipped
+* simulation is caught up, because the emitter was moved during the skipped time already.
 * @returns true if there was an input.
 */
 bool Particles::HandleInput()
@@ -476,6 +2177,11 @@ bool Particles::HandleInput()
 	// Zero movement direction for now.
 	emitterMoveDir = glm::vec3(0);
 
+	if (isCatchingUp == true)
+	{
+		return false;
+	}
+
 	/// Below there are key bindings. Every key is setting movement direction and set
 	/// the movement state to true, so the light position will be updated.
 
@@ -536,12 +2242,54 @@ Particles::~Particles()
 	Shaders::DeleteShaders(shader_compute);
 	glDeleteProgram(shader_render);
 	glDeleteProgram(shader_compute);
-	glDeleteBuffers(2, VBO);
+	if (UseAnalytic == true)
+	{
+		Shaders::DeleteShaders(shader_render_analytic);
+		glDeleteProgram(shader_render_analytic);
+	}
+	if (shader_billboard != 0)
+	{
+		Shaders::DeleteShaders(shader_billboard);
+		glDeleteProgram(shader_billboard);
+		glDeleteTextures(1, &particlesTexture);
+		glDeleteTextures(1, &simulationTexture);
+	}
+	delete computeRasterizer;
+	delete reducedResolution;
+	if (depthSorter != NULL)
+	{
+		glDeleteTextures(1, &sortedIndicesTexture);
+		delete depthSorter;
+	}
+	for (size_t i = 0; i < bufferChunks.size(); i++)
+	{
+		DeleteBufferChunk(bufferChunks[i]);
+	}
 	glDeleteBuffers(1, &UBO);
-	glDeleteVertexArrays(1, &VAO);
 
-	if (UseCPU == true)
+	// Finish writing the trajectory file
+	delete trajectoryWriter;
+	for (int i = 0; i < 2; i++)
+	{
+		if (trajectoryFences[i] != NULL)
+		{
+			glDeleteSync(trajectoryFences[i]);
+		}
+	}
+	glDeleteBuffers(2, trajectoryBuffers);
+
+	// Delete statistics buffers
+	for (int i = 0; i < PARTICLES_STATS_LATENCY; i++)
 	{
-		delete[] VBOCPP;
+		if (statsFences[i] != NULL)
+		{
+			glDeleteSync(statsFences[i]);
+		}
 	}
+	if (statsCounters != 0)
+	{
+		glDeleteBuffers(1, &statsCounters);
+		glDeleteBuffers(PARTICLES_STATS_LATENCY, statsBuffers);
+	}
+
 }
\ No newline at end of file
@@ -9,15 +9,83 @@
 * (c) 2014 Damian Nowakowski
 */
 
+#include "ParticlesCore.h"
+
 #include <GL/glew.h>
+#include <GLM/glm.hpp>
+
+#include <string>
+#include <vector>
 
 // Define the uniform buffer elements of particles compute shader
-#define PARTICLES_UNIFORM_SIZE 10
+#define PARTICLES_UNIFORM_SIZE 11
+
+// Define the period after which the time of analytic mode wraps (it keeps float precision)
+#define PARTICLES_ANALYTIC_TIME_PERIOD 4096.f
+
+// Define the maximum number of distance thresholds of LOD tiers (tier N is updated every 2^N-th tick)
+#define PARTICLES_LOD_TIERS_MAX 3
+
+// Define how much nearer the system has to be to go back to the nearer LOD tier
+#define PARTICLES_LOD_HYSTERESIS 0.1f
+
+// Define after how many updates statistics of the GPU path are read back (number of read buffers)
+#define PARTICLES_STATS_LATENCY 3
+
+// Define the size of the block of zeroes with which vertex buffers are cleared piece by piece
+#define PARTICLES_CLEAR_BLOCK_SIZE (4 * 1024 * 1024)
+
+// Define how many particles are read back at once to find alive particles and free places in resizing
+#define PARTICLES_COMPACT_BLOCK_SIZE 65536
+
+
+/**
+* How particles are drawn.
+*/
+enum ParticlesRenderer
+{
+	PARTICLES_RENDERER_POINTS		= 0,	///< GL_POINTS with the uniform point size.
+	PARTICLES_RENDERER_BILLBOARDS	= 1,	///< Instanced camera facing quads.
+	PARTICLES_RENDERER_COMPUTE		= 2,	///< One pixel particles rasterized in the compute shader.
+	PARTICLES_RENDERERS_COUNT		= 3
+};
+
+/**
+* GPU storage of one chunk of particles. Every chunk has its own ping-pong buffers of both
+* streams, so no buffer is bigger than the chunk (drivers limit the size of one buffer)
+* and the pool can grow chunk by chunk.
+*/
+struct ParticlesBufferChunk
+{
+	int first;						///< Id of the first particle of the chunk.
+	int count;						///< How many particles are in the chunk.
+	GLuint VAO[2];					///< Vertex array objects reading VBO[i] and simulationVBO[i] (swapped together with them).
+	GLuint transformFeedback[2];	///< Transform feedback objects writing to VBO[1 - i] and simulationVBO[1 - i].
+	GLuint VBO[2];					///< Vertex buffer objects with the render stream (ParticleRender) of particles.
+									///< There are two, because computed data can't be saved into the same buffer.
+	GLuint simulationVBO[2];		///< Vertex buffer objects with the simulation stream (ParticleSimulation) of particles.
+};
+
+/**
+* Buffer chunks allocated for the new count of particles before they replace current ones,
+* so the resize can be abandoned without losing anything.
+*/
+struct ParticlesBufferResize
+{
+	int keptChunks;					///< How many current chunks hold particles below the new count.
+	bool isLastResized;				///< Tells if the last kept chunk gets new buffers.
+	ParticlesBufferChunk last;		///< New buffers of the last kept chunk.
+	std::vector<ParticlesBufferChunk> added;	///< New chunks behind the kept ones.
+};
 
 // Predefine class for visibility
 class Camera;
+class ComputeRasterizer;
+class ReducedResolution;
+class DepthSorter;
+class TrajectoryWriter;
 
-class Particles
+class Particles : public ParticlesCore
 {
 public:
 	/**
@@ -38,8 +106,99 @@ public:
 	*/
 	void Draw(Camera * camera);
 
+	/**
+	* Save the complete simulation state (particles data, emitter state, emission
+	* counters and random epoch) to the snapshot file.
+	* @param path - path to the snapshot file.
+	* @returns true if the snapshot was saved.
+	*/
+	bool SaveSnapshot(const char* path);
+
+	/**
+	* Load the complete simulation state from the snapshot file. The snapshot must
+	* be saved with the same particles count.
+	* @param path - path to the snapshot file.
+	* @returns true if the snapshot was loaded.
+	*/
+	bool LoadSnapshot(const char* path);
+
+	/**
+	* Get the path of the snapshot file from configuration ini file.
+	*/
+	const char* GetSnapshotPath() { return snapshotPath.c_str(); }
+
+	/**
+	* Change the number of particles without restarting. Buffers grow or shrink chunk by
+	* chunk and only the last chunk is copied, the CPU store is reallocated. All new storage is
+	* allocated before anything is changed. When shrinking, alive particles above the new count
+	* are moved to free places below it (those which don't fit die). The trajectory file can't
+	* change its count, so recording stops.
+	* @param newCount - the new number of particles.
+	* @returns false if the memory can't be allocated (the count stays the same).
+	*/
+	bool Resize(int newCount);
+
+	/**
+	* Set the fraction of the render size in which particles are drawn.
+	* @param scale - the scale, 1 draws particles straight to the main framebuffer.
+	*/
+	void SetRenderScale(float scale);
+
+	/**
+	* Get the fraction of the render size in which particles are drawn.
+	*/
+	float GetRenderScale();
+
+	/**
+	* Switch to the next available renderer.
+	*/
+	void NextRenderer();
+
+	/**
+	* Measure the GPU time of drawing particles with every available renderer for every
+	* configured particles count and size, and print the table with results.
+	* @param camera - the pointer to the currently used camera.
+	*/
+	void RunRenderBenchmark(Camera * camera);
+
+	/**
+	* Get the latest statistics of particles. On the GPU path they are few updates old
+	* (up to PARTICLES_STATS_LATENCY), because they are read back without waiting for the GPU.
+	*/
+	const ParticlesStats& GetStats() { return stats; }
+
 private:
 
+	/**
+	* Simulate one step of particles, on the GPU, on the CPU or in analytic mode.
+	* @param deltaTime - the portion of time thas passed from previous update.
+	*/
+	void Simulate(float deltaTime);
+
+	/**
+	* Get conservative world bounds of all particles of the system. They are derived from the
+	* emitter positions during the last life time, speed, spread, gravity and the life time.
+	* @param min - minimum corner of the bounds.
+	* @param max - maximum corner of the bounds.
+	*/
+	void GetBounds(glm::vec3& min, glm::vec3& max);
+
+	/**
+	* Choose the LOD tier from the distance of the system bounds to the camera. Going back to
+	* a nearer tier needs the distance smaller by PARTICLES_LOD_HYSTERESIS, so the system
+	* doesn't switch every tick on the tier border.
+	* @param camera		- the pointer to the camera.
+	* @param deltaTime	- the portion of time thas passed from previous update.
+	*/
+	void UpdateLOD(Camera * camera, float deltaTime);
+
+	/**
+	* Check if any particle of the system can be visible for the camera.
+	* @param camera - the pointer to the camera.
+	* @returns true if the system can be visible (always when culling is disabled).
+	*/
+	bool IsVisible(Camera * camera);
+
 	/**
 	* Update particles' state using the CPU.
 	* @param deltaTime - the portion of time thas passed from previous update.
@@ -47,51 +206,293 @@ private:
 	void UpdateCPU(float deltaTime);
 
 	/**
-	* Draw particles from data used in updating using CPU.
-	* @param camera - the pointer to the currently used camera.
+	* Create buffers of the chunk of particles (filled with zeroes) and its vertex
+	* arrays and transform feedbacks.
+	* @param chunk	- the chunk to create.
+	* @param first	- id of the first particle of the chunk.
+	* @param count	- how many particles are in the chunk.
+	* @returns false if the driver is out of memory (nothing is created then).
 	*/
-	void DrawCPU(Camera * camera);
+	bool CreateBufferChunk(ParticlesBufferChunk& chunk, int first, int count);
 
-	void UpdateCPUThread(int tid, float deltaTime, int from, int to);
+	/**
+	* Allocate buffer chunks needed to hold exactly the given count of particles, without
+	* touching current chunks: new buffers of the last kept chunk (when its count changes)
+	* and new chunks behind it.
+	* @param count	- the new number of particles.
+	* @param resize	- output allocated chunks, which are put in place by CommitBufferChunks.
+	* @returns false if the driver is out of memory (nothing stays allocated then).
+	*/
+	bool PrepareBufferChunks(int count, ParticlesBufferResize& resize);
+
+	/**
+	* Put chunks allocated by PrepareBufferChunks in place: particles of the last kept chunk
+	* are copied to its new buffers, chunks behind the new count are deleted and new ones are added.
+	* Only the newest buffers (the first ones) are copied, the others are overwritten by the next update.
+	* @param resize - allocated chunks.
+	*/
+	void CommitBufferChunks(ParticlesBufferResize& resize);
+
+	/**
+	* Delete chunks allocated by PrepareBufferChunks which won't be put in place.
+	* @param resize - allocated chunks.
+	*/
+	void DiscardBufferChunks(ParticlesBufferResize& resize);
+
+	/**
+	* Read the range of particles from buffers with the newest data (it can span few chunks).
+	* @param render		- output render stream from the first particle in the range (NULL - it isn't read).
+	* @param simulation	- output simulation stream from the first particle in the range.
+	* @param from		- id of the first particle to read.
+	* @param to			- id after the last particle to read.
+	*/
+	void ReadBufferChunks(ParticleRender* render, ParticleSimulation* simulation, int from, int to);
+
+	/**
+	* Copy the range of particles to another place in buffers with the newest data, on the GPU.
+	* Both ranges can span few chunks, but they mustn't overlap.
+	* @param from	- id of the first particle to copy.
+	* @param to		- id of the place of the first particle.
+	* @param count	- how many particles to copy.
+	*/
+	void CopyBufferChunks(int from, int to, int count);
+
+	/**
+	* Upload the range of particles to buffers with the newest data (it can span few chunks).
+	* @param render		- render stream of particles from the first one in the range.
+	* @param simulation	- simulation stream of particles from the first one in the range.
+	* @param from		- id of the first particle to upload.
+	* @param to			- id after the last particle to upload.
+	*/
+	void UploadBufferChunks(const ParticleRender* render, const ParticleSimulation* simulation, int from, int to);
+
+	/**
+	* Move alive particles from ids above the new count to places of dead particles below it.
+	* @param render		- render stream of particles.
+	* @param simulation	- simulation stream of particles.
+	* @param newCount	- the new number of particles.
+	* @returns how many alive particles didn't fit below the new count (they die).
+	*/
+	int CompactParticles(ParticleRender* render, ParticleSimulation* simulation, int newCount);
+
+	/**
+	* Move alive particles from ids above the new count to places of dead particles below it,
+	* in buffers on the GPU. The simulation stream is read back block by block, above the new
+	* count to find alive particles and below it only until enough free places are found.
+	* Runs of particles which go to the run of free places are copied at once.
+	* @param newCount - the new number of particles.
+	* @returns how many alive particles didn't fit below the new count (they die).
+	*/
+	int CompactBufferChunks(int newCount);
+
+	/**
+	* Check if the particle is alive (in analytic mode it is evaluated from its spawn time).
+	* @param simulation - simulation data of the particle.
+	*/
+	bool IsParticleAlive(const ParticleSimulation& simulation);
+
+	/**
+	* Delete buffers, vertex arrays and transform feedbacks of the chunk.
+	* @param chunk - the chunk to delete.
+	*/
+	void DeleteBufferChunk(ParticlesBufferChunk& chunk);
+
+	/**
+	* Create vertex array objects reading both streams of every ping-pong buffer of the chunk
+	* and transform feedback objects writing to the other ones. They are set up once, so
+	* every update and draw only binds them.
+	* @param chunk - the chunk with created buffers.
+	*/
+	void CreateVertexArrays(ParticlesBufferChunk& chunk);
+
+	/**
+	* Allocate the vertex buffer (immutable storage when available) and optionally fill it
+	* with zeroes on the GPU. Without glClearBufferData it is filled piece by piece, so there
+	* is no temporary array of the buffer size.
+	* @param buffer	- the vertex buffer.
+	* @param size	- size of the buffer in bytes.
+	* @param clear	- true if the buffer is read before anything writes it.
+	* @returns false if the driver is out of memory.
+	*/
+	bool AllocateBuffer(GLuint buffer, size_t size, bool clear);
+
+	/**
+	* Upload the render stream of particles updated using CPU to the vertex buffer.
+	* The simulation stream isn't needed in drawing, so it stays on the CPU.
+	*/
+	void UploadCPU();
+
+	/**
+	* Set uniforms needed for evaluating particles from their spawn state in analytic mode.
+	* @param program - the render program using these uniforms.
+	*/
+	void SetAnalyticUniforms(GLuint program);
+
+	/**
+	* Draw particles as points.
+	* @param camera	- the pointer to the currently used camera.
+	* @param count	- how many particles (from the first one) to draw.
+	* @param size	- size of the point in pixels.
+	*/
+	void DrawPoints(Camera * camera, int count, float size);
+
+	/**
+	* Draw particles as camera facing quads. Every quad is one instance of the triangle strip
+	* and it reads its particle from the buffer texture, so it isn't limited by the point size.
+	* @param camera	- the pointer to the currently used camera.
+	* @param count	- how many particles (from the first one) to draw.
+	* @param size	- size of the quad in pixels (at the attenuation distance when attenuation is used).
+	*/
+	void DrawBillboards(Camera * camera, int count, float size);
+
+	/**
+	* Draw one pixel particles with the compute rasterizer.
+	* @param camera	- the pointer to the currently used camera.
+	* @param count	- how many particles (from the first one) to draw.
+	*/
+	void DrawCompute(Camera * camera, int count);
+
+	/**
+	* Draw particles with the chosen renderer.
+	* @param renderer	- the renderer to use.
+	* @param camera		- the pointer to the currently used camera.
+	* @param count		- how many particles (from the first one) to draw.
+	* @param size		- size of the particle in pixels (compute rasterizer draws always one pixel).
+	*/
+	void DrawWithRenderer(ParticlesRenderer renderer, Camera * camera, int count, float size);
+
+	/**
+	* Check if the renderer can be used in the current OpenGL context.
+	* @param renderer - the renderer to check.
+	* @returns true if the renderer is available.
+	*/
+	bool IsRendererAvailable(ParticlesRenderer renderer);
+
+	/**
+	* Update particles' state in analytic mode. Only the emitter is updated and
+	* newly emitted particles are written, all others are evaluated in rendering.
+	* @param deltaTime - the portion of time thas passed from previous update.
+	*/
+	void UpdateAnalytic(float deltaTime);
+
+	/**
+	* Emit particles in analytic mode and upload them to the vertex buffers.
+	* @param from	- id of the first particle to emit.
+	* @param to		- id after the last particle to emit.
+	*/
+	void EmitAnalytic(int from, int to);
+
+	/**
+	* Copy position, color and life time of every particle to the trajectory frame.
+	* In analytic mode they are evaluated from the spawn state first.
+	* @param render		- render stream of particles.
+	* @param simulation	- simulation stream of particles.
+	* @param frame		- trajectory frame (TRAJECTORY_PARTICLE_SIZE floats per particle).
+	* @param time		- analytic time in which the data was captured.
+	*/
+	void GatherTrajectoryFrame(const ParticleRender* render, const ParticleSimulation* simulation, float* frame, float time);
+
+	/**
+	* Capture particles data for the trajectory file every trajectoryTickInterval ticks.
+	* On the GPU path data is copied to the read buffer and fetched few ticks later,
+	* when the copy is finished, so the pipeline is never stalled.
+	*/
+	void CaptureTrajectory();
+
+	/**
+	* Read back finished statistics of previous updates and copy counters of the current
+	* update to the free read buffer. Read buffers are checked with fences, so the pipeline
+	* is never stalled and statistics are just dropped when no buffer is free.
+	*/
+	void CaptureStats();
+
+	/**
+	* Remember the statistics of the update and print them every statsReportInterval ticks.
+	* @param newStats - statistics of the update.
+	*/
+	void SetStats(const ParticlesStats& newStats);
 
-	glm::vec3 emitterPosition;		///< Position of the particles emitter.
 	glm::vec3 emitterMoveDir;		///< Current direction of emitter movement.
 
-	float emitPeriod;				///< Period of emitting every portion of particles.
-									///< Thanks to that particles will be emitting systematically,
-									///< not at the same time.
-	float timeToNextEmission;		///< Time to nex emission of portion of particles.
 	float particlePointSize;		///< Size of the particle.
-	float particleLifeTime;			///< Time of life of one particle.
-	float particleColorSaturation;	///< Range of particle color saturation.
-	float particleSpeed;			///< Speed of particle in y-axis.
-	float emitterRotationSpeed;		///< Speed of emitter rotation.
-	float emitterRotation;			///< Current rotation angle of the emitter.
-	float emitterRadius;			///< Radius of the emitter (how far every stream is from the center).
-	float emitterSpread;			///< Spread of every stream.
-	float emitterMoveSpeed;			///< Speed of emitter movement.
-	float gravity;					///< The gravity of the enviroment.
-
-	int particlesEmitAtOnce;		///< How many particles will be emited with one portion.
-	int particlesEmitted;			///< How many particles were already emited.
-	int particlesCount;				///< How many particles are here at all (max amount of particles).
-
-	int threadsCount;
+	std::string snapshotPath;		///< Path to the snapshot file.
+
+	TrajectoryWriter* trajectoryWriter;	///< Writer of the trajectory file (NULL when disabled).
+	int trajectoryTickInterval;		///< Every which tick particles are captured to the trajectory file.
+	GLuint trajectoryBuffers[2];	///< Buffers to which particles are copied for reading on the GPU path.
+	GLsync trajectoryFences[2];		///< Fences telling if the copy to the read buffer is finished.
+	unsigned long long trajectoryTicks[2];	///< Ticks in which the read buffers were filled.
+	float trajectoryTimes[2];		///< Analytic times in which the read buffers were filled.
+	int trajectoryBufferIndex;		///< Read buffer which will be filled in next capture.
+
+	bool UseStats;					///< Tells if statistics of alive, emitted and died particles are gathered.
+	ParticlesStats stats;			///< The latest statistics.
+	int statsReportInterval;		///< Every which tick statistics are printed (0 - never).
+	unsigned long long statsReportTick;	///< Tick of the last printed statistics.
+	GLuint statsCounters;			///< Atomic counters buffer incremented by the update shader.
+	GLuint statsBuffers[PARTICLES_STATS_LATENCY];	///< Buffers to which counters are copied for reading.
+	GLsync statsFences[PARTICLES_STATS_LATENCY];		///< Fences telling if the copy to the read buffer is finished.
+	unsigned long long statsTicks[PARTICLES_STATS_LATENCY];	///< Ticks in which the read buffers were filled.
+	int statsBufferIndex;			///< Read buffer which will be filled in next capture.
 
 	GLuint shader_render;			///< Id of the render shader.
 	GLuint shader_compute;			///< Id of the compute shader.
-	GLuint VAO;						///< Vertex array object for handling data to compute and render.
-	GLuint VBO[2];					///< Vertex buffer object for handling data to compute and render.
-									///< There are two, because computed data can't be saved into the same buffer.
+	GLuint shader_render_analytic;	///< Id of the render shader evaluating particles in analytic mode.
+	GLuint shader_billboard;		///< Id of the render shader drawing particles as billboards (0 if not available).
+	GLuint particlesTexture;		///< Buffer texture through which billboards read the render stream.
+	GLuint simulationTexture;		///< Buffer texture through which billboards read the simulation stream in analytic mode.
+	std::vector<ParticlesBufferChunk> bufferChunks;	///< GPU storage of particles split into chunks.
+	int bufferChunkSize;			///< How many particles are stored in one chunk (the last one can be smaller).
 	GLuint UBO;						///< Uniform buffer object for computed shader.
 
 	GLint uniformsOffset[PARTICLES_UNIFORM_SIZE];	///< Array that stores offsets of values in uniform buffer.
 
-	GLfloat* VBOCPP;
 	bool UseCPU;
+	bool UseBufferStorage;			///< Tells if vertex buffers are immutable (glBufferStorage), only on the GPU path.
+	bool UseAnalytic;				///< Tells if particles store only the spawn state and are evaluated in rendering.
+									///< Others.x of the particle is the spawn time instead of the life time left.
+
+	float analyticTime;				///< Time of the analytic mode (wrapped by PARTICLES_ANALYTIC_TIME_PERIOD).
+	std::vector<ParticleRender> analyticRenderStaging;			///< Newly emitted particles for upload on the GPU path.
+	std::vector<ParticleSimulation> analyticSimulationStaging;	///< Newly emitted particles for upload on the GPU path.
+
+	ParticlesRenderer renderer;		///< How particles are drawn.
+	ComputeRasterizer* computeRasterizer;	///< Rasterizer of one pixel particles (NULL if not supported).
+	ReducedResolution* reducedResolution;	///< Offscreen target for drawing in the reduced resolution.
+	glm::ivec2 renderSize;			///< Size in pixels of the target particles are currently drawn to.
+
+	DepthSorter* depthSorter;		///< Sorter of particles by the distance from the camera (NULL if disabled).
+	GLuint sortedIndicesTexture;	///< Buffer texture through which billboards read sorted indices.
+	int sortInterval;				///< Every which frame particles are sorted.
+	int framesToSort;				///< How many frames are left to the next sort.
+	float billboardAttenuation;		///< Distance at which billboards have their configured size (0 - no attenuation).
+	float billboardSizeVariation;	///< How much smaller can be a billboard of single particle <0;1>.
+
+	bool UseCulling;				///< Tells if the system isn't drawn when its bounds are outside of the camera frustum.
+	bool UseCullingSimulation;		///< Tells if the system isn't simulated either when it isn't visible.
+	float cullingMargin;			///< Distance added to every side of the system bounds.
+	float culledTime;				///< Time for which the simulation was skipped, caught up when the system is visible again.
+	float catchUpStep;				///< The longest step of catching up the skipped simulation.
+	bool isCatchingUp;				///< Tells if the skipped simulation is caught up (the emitter was already moved then).
+	glm::vec3 emitterTrailMin;		///< Minimum corner of emitter positions during the last particle life time.
+	glm::vec3 emitterTrailMax;		///< Maximum corner of emitter positions during the last particle life time.
+	float emitterTrailTime;			///< Time after which the trail shrinks to the current emitter position.
+
+	bool UseLOD;					///< Tells if distant systems are simulated less often.
+	std::vector<float> lodDistances;	///< Distances from the camera at which next LOD tiers start.
+	int lodTier;					///< Current LOD tier, the system is simulated every 2^lodTier-th tick.
+	int lodTicks;					///< How many ticks passed since the last simulation step.
+	float lodTime;					///< Time that passed since the last simulation step.
+	float lodEmission;				///< Fraction of particles emitted in the farthest LOD tier.
+	float lodSizeScale;				///< Scale of the point size compensating the reduced emission.
+
+	std::vector<int> benchmarkCounts;	///< Particles counts compared by the render benchmark.
+	std::vector<float> benchmarkSizes;	///< Particles sizes compared by the render benchmark.
+	int benchmarkRepeats;			///< How many times every case of the render benchmark is drawn.
 	
 	/**
-	* Handle the input controlling particle emitter position.
+	* Handle the input controlling particle emitter position. It is ignored while the skipped
+	* simulation is caught up, because the emitter was moved during the skipped time already.
 	* @returns true if there was an input.
 	*/
 	bool HandleInput();
@@ -0,0 +1,716 @@
+/**
+* GPU Particles example.
+*
+* This is the core of the CPU particles path. It reads parameters of particles from the
+* configuration ini file, keeps the state of the emitter and both CPU streams, and emits
+* and integrates particles the same way as the update shader.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "ParticlesCore.h"
+#include "Engine.h"
+#include "SpatialGrid.h"
+#include "VectorField.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+/**
+* Pack the color in four unsigned normalized bytes, the same as packUnorm4x8 in shaders.
+* @param color - color rgba.
+* @returns packed color with red in the lowest byte.
+*/
+unsigned int ParticlesCore::PackColor(const glm::vec4& color)
+{
+	glm::uvec4 bytes = glm::uvec4(glm::round(glm::clamp(color, 0.f, 1.f) * 255.f));
+	return bytes.r | (bytes.g << 8) | (bytes.b << 16) | (bytes.a << 24);
+}
+
+/**
+* Unpack the color packed in four unsigned normalized bytes, the same as unpackUnorm4x8 in shaders.
+* @param color - packed color with red in the lowest byte.
+* @returns color rgba.
+*/
+glm::vec4 ParticlesCore::UnpackColor(unsigned int color)
+{
+	return glm::vec4(color & 0xFF, (color >> 8) & 0xFF, (color >> 16) & 0xFF, color >> 24) / 255.f;
+}
+
+/**
+* Simple constructor.
+*/
+ParticlesCore::ParticlesCore()
+{
+	emitterPosition			= glm::vec3(0);
+	emitterVelocity			= glm::vec3(0);
+	emitPeriod				= 0;
+	timeToNextEmission		= 0;
+	emitAge					= 0;
+	emitFrom				= 0;
+	particleLifeTime		= 0;
+	configuredLifeTime		= 0;
+	particleColorSaturation	= 0;
+	particleSpeed			= 0;
+	emitterRotationSpeed	= 0;
+	emitterRotation			= 0;
+	emitterRadius			= 0;
+	emitterSpread			= 0;
+	emitterMoveSpeed		= 0;
+	gravity					= 0;
+	particlesEmitAtOnce		= 1;
+	particlesEmitted		= 0;
+	emitMark				= 1;
+	particlesCount			= 0;
+	emitStride				= 1;
+	randomEpoch				= 0;
+	ticksCount				= 0;
+	threadsCount			= 1;
+	updateStats				= ParticlesStats();
+	updateSeconds			= 0;
+	tickSubsteps			= 1;
+	UseChunkBinding			= false;
+	throughputReportInterval	= 0;
+	throughputReportTick	= 0;
+	spatialGrid				= NULL;
+	interactionRadius		= 0;
+	interactionSeparation	= 0;
+	interactionCohesion		= 0;
+	UseInteractions			= false;
+	arenaPages				= ARENA_PAGES_NORMAL;
+	particlesArena			= NULL;
+	renderCPU				= NULL;
+	simulationCPU			= NULL;
+}
+
+/**
+* Read parameters of particles. This is the only place where their keys and defaults
+* are listed, so the application and the sweep always read them the same way.
+* @param config	- the configuration ini file reader.
+* @param read	- reader of [Particles] values, it can override them (the ini file when empty).
+* @returns read parameters.
+*/
+ParticlesParams ParticlesCore::LoadParams(INIReader* config, const ParticlesParamsReader& read)
+{
+	ParticlesParamsReader get = read;
+	if ((bool)get == false)
+	{
+		get = [config](const char* key, double defaultValue) { return config->GetReal("Particles", key, defaultValue); };
+	}
+
+	ParticlesParams params;
+	params.count				= std::max(1, (int)get("Count", 100));
+	params.emitAtOnce			= (int)get("EmitAtOnce", 100);
+	params.lifeTime				= (float)get("LifeTime", 1.f);
+	params.speed				= (float)get("Speed", 1.f);
+	params.colorSaturation		= (float)get("Saturation", 0.1f);
+	params.emitPeriod			= (float)get("Period", 0.1f);
+	params.emitterMoveSpeed		= (float)get("emitter_Speed", 1.f);
+	params.emitterRotationSpeed	= (float)get("Rot_Speed", 1.f);
+	params.gravity				= (float)get("Gravity", 0.f);
+	params.emitterPosition		= glm::vec3((float)get("emitter_X", 0.f), (float)get("emitter_Y", 0.f), (float)get("emitter_Z", 0.f));
+	params.emitterRadius		= (float)get("Radius", 1.f);
+	params.emitterSpread		= (float)get("Spread", 1.f);
+
+	/// Use all hardware threads for CPU calculations, unless configured otherwise
+	params.threadsCount			= (int)config->GetInteger("System", "Threads", 0);
+	if (params.threadsCount <= 0)
+	{
+		params.threadsCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	/// The CPU path can take few ticks in one pass over memory (temporal blocking). It is
+	/// simulated less often then, but the memory traffic per simulated second drops.
+	params.tickSubsteps				= glm::clamp((int)config->GetInteger("System", "Substeps", 1), 1, PARTICLES_MAX_SUBSTEPS);
+	params.throughputReportInterval	= std::max(0, (int)config->GetInteger("System", "ThroughputReportInterval", 0));
+
+	std::string pagesName = config->Get("System", "HugePages", "Transparent");
+	params.pages = ARENA_PAGES_NORMAL;
+	if (pagesName == "Transparent")
+	{
+		params.pages = ARENA_PAGES_TRANSPARENT;
+	}
+	else if (pagesName == "Explicit")
+	{
+		params.pages = ARENA_PAGES_EXPLICIT;
+	}
+
+	params.interactionRadius		= (float)config->GetReal("Interaction", "Radius", 0.1f);
+	params.interactionSeparation	= (float)config->GetReal("Interaction", "Separation", 0.f);
+	params.interactionCohesion		= (float)config->GetReal("Interaction", "Cohesion", 0.f);
+	return params;
+}
+
+/**
+* Set parameters and the starting state of the emitter. The life time is clamped to
+* the emit process of the pool. It needs the initialized job system.
+* @param params - parameters of particles.
+*/
+void ParticlesCore::Init(const ParticlesParams& params)
+{
+	particlesCount			= params.count;
+	particlesEmitAtOnce		= params.emitAtOnce;
+	configuredLifeTime		= params.lifeTime;
+	particleSpeed			= params.speed;
+	particleColorSaturation	= params.colorSaturation;
+	emitPeriod				= params.emitPeriod;
+	emitterMoveSpeed		= params.emitterMoveSpeed;
+	emitterRotationSpeed	= params.emitterRotationSpeed;
+	gravity					= params.gravity;
+	emitterPosition			= params.emitterPosition;
+	emitterRadius			= params.emitterRadius;
+	emitterSpread			= params.emitterSpread;
+	threadsCount			= params.threadsCount;
+	tickSubsteps			= params.tickSubsteps;
+	arenaPages				= params.pages;
+
+	/// When threads are pinned, every chunk is always updated by the thread which placed
+	/// it in memory, otherwise chunks are spread by work stealing.
+	UseChunkBinding				= JobSystem::Get()->GetAffinity() != JOB_AFFINITY_NONE;
+	throughputReportInterval	= params.throughputReportInterval;
+	throughputReportTick		= 0;
+	nodeParticles.assign(JobSystem::Get()->GetNodesCount(), 0.0);
+	nodeSeconds.assign(JobSystem::Get()->GetNodesCount(), 0.0);
+
+	interactionRadius		= params.interactionRadius;
+	interactionSeparation	= params.interactionSeparation;
+	interactionCohesion		= params.interactionCohesion;
+	UseInteractions			= interactionRadius > 0 && (interactionSeparation != 0 || interactionCohesion != 0);
+
+	/// Set initial values for some data
+	particlesEmitted		= 0;
+	emitMark				= 1;
+	timeToNextEmission		= 0;
+	emitAge					= 0;
+	emitFrom				= 0;
+	emitterVelocity			= glm::vec3(0);
+	emitterRotation			= 0;
+	randomEpoch				= 0;
+	ticksCount				= 0;
+
+	/// Calculate the maximum life time the particle can have.
+	/// If the life time is longer there might be some bugs, because the
+	/// particle will live longer than the whole emit process.
+	/// The configured life time is kept, so it comes back when the pool grows.
+	particleLifeTime = GetClampedLifeTime(particlesCount);
+}
+
+/**
+* Get the life time clamped to the emit process of the pool, shortened by PARTICLES_LIFE_TIME_MARGIN
+* updates, so every particle dies before the emission counter gets to it again.
+* @param count - number of particles in the pool.
+* @returns the life time of particles.
+*/
+float ParticlesCore::GetClampedLifeTime(int count)
+{
+	/// Very short processes keep at least half of their time
+	float emitProcess = count * emitPeriod / particlesEmitAtOnce;
+	float maxLifeTime = std::max(emitProcess - PARTICLES_LIFE_TIME_MARGIN * (float)UPDATE_PERIOD, 0.5f * emitProcess);
+	return std::min(configuredLifeTime, maxLifeTime);
+}
+
+/**
+* Zero the emission counter when all particles were emitted and start the next emit cycle.
+* Particles emitted in it get the other "was emitted" flag, so particles of the previous
+* cycle can be emitted again even if they died in the same step the counter got to them.
+*/
+void ParticlesCore::WrapEmission()
+{
+	if (particlesEmitted == particlesCount)
+	{
+		particlesEmitted	= 0;
+		emitMark			= 3.f - emitMark;
+	}
+}
+
+/**
+* Load all vector fields listed in [VectorFields].
+* @param config			- the configuration ini file reader.
+* @param createTextures - true if fields are uploaded to 3D textures for the GPU path.
+*/
+void ParticlesCore::LoadVectorFields(INIReader* config, bool createTextures)
+{
+	int vectorFieldsCount = std::min((int)config->GetInteger("VectorFields", "Count", 0), VECTOR_FIELDS_MAX);
+	for (int i = 0; i < vectorFieldsCount; i++)
+	{
+		std::string section = "VectorField" + std::to_string(i);
+		VectorField* vectorField = new VectorField();
+		vectorField->strength	= (float)config->GetReal(section, "Strength", 1.f);
+		vectorField->type		= config->Get(section, "Type", "Force") == "Velocity" ? VECTOR_FIELD_VELOCITY : VECTOR_FIELD_FORCE;
+		vectorField->SetBounds(
+			glm::vec3(	(float)config->GetReal(section, "Min_X", -1.f),
+						(float)config->GetReal(section, "Min_Y", -1.f),
+						(float)config->GetReal(section, "Min_Z", -1.f)),
+			glm::vec3(	(float)config->GetReal(section, "Max_X", 1.f),
+						(float)config->GetReal(section, "Max_Y", 1.f),
+						(float)config->GetReal(section, "Max_Z", 1.f)));
+
+		if (vectorField->Load(config->Get(section, "Path", "").c_str(), createTextures) == true)
+		{
+			vectorFields.push_back(vectorField);
+		}
+		else
+		{
+			delete vectorField;
+		}
+	}
+}
+
+/**
+* Allocate both CPU streams in the arena and place them in memory of threads owning
+* their chunks. They come zeroed (no particle is emitted yet).
+* @returns false if the memory can't be allocated.
+*/
+bool ParticlesCore::AllocateCPU()
+{
+	/// Both CPU streams are served from one arena backed by huge pages, so streaming through
+	/// gigabytes of particles doesn't thrash the TLB. The arena doesn't touch the memory,
+	/// arrays are cleared by threads owning their chunks.
+	size_t allRenderDataSize		= (size_t)particlesCount * sizeof(ParticleRender);
+	size_t allSimulationDataSize	= (size_t)particlesCount * sizeof(ParticleSimulation);
+	particlesArena = new Arena();
+	if (particlesArena->Init(allRenderDataSize + allSimulationDataSize + 2 * ARENA_ALIGNMENT, arenaPages) == false)
+	{
+		delete particlesArena;
+		particlesArena = NULL;
+		return false;
+	}
+	renderCPU		= (ParticleRender*)particlesArena->Allocate(allRenderDataSize);
+	simulationCPU	= (ParticleSimulation*)particlesArena->Allocate(allSimulationDataSize);
+	spatialGrid		= new SpatialGrid();
+	PlaceCPUParticles();
+	return true;
+}
+
+/**
+* Simulate one step of particles on the CPU. The emitter is moved by the caller before,
+* here it is rotated, emission of every substep is counted, interactions are applied
+* and chunks are updated on the job system.
+* @param deltaTime - the portion of time thas passed from previous update.
+*/
+void ParticlesCore::SimulateCPU(float deltaTime)
+{
+	emitterRotation += emitterRotationSpeed * deltaTime;
+	randomEpoch++;
+
+	/// The step is split into substeps of one tick (caught up ticks and LOD steps too).
+	/// Emission of every substep is counted here, so chunks only read it.
+	int substepsCount = glm::clamp((int)(deltaTime / UPDATE_PERIOD + 0.5), 1, PARTICLES_MAX_SUBSTEPS);
+	float substepTime = deltaTime / substepsCount;
+	updateSubsteps.resize(substepsCount);
+	for (int i = 0; i < substepsCount; i++)
+	{
+		WrapEmission();
+
+		ParticlesSubstep& substep = updateSubsteps[i];
+		substep.deltaTime	= substepTime;
+		substep.timeLeft	= substepTime * (substepsCount - 1 - i);
+		substep.emitFrom	= particlesEmitted;
+		int portions = CountEmissions(substepTime);
+		if (portions > 0)
+		{
+			particlesEmitted = std::min(particlesEmitted + portions * particlesEmitAtOnce, particlesCount);
+		}
+		substep.emitAge				= emitAge;
+		substep.particlesEmitted	= particlesEmitted;
+		substep.emitMark			= emitMark;
+	}
+
+	/// Particles interact with each other only when any interaction is enabled,
+	/// so the grid doesn't have to be built for independent ballistic particles.
+	if (UseInteractions == true)
+	{
+		spatialGrid->Build(renderCPU[0].position, (int)(sizeof(ParticleRender) / sizeof(float)), simulationCPU[0].others, (int)(sizeof(ParticleSimulation) / sizeof(float)),
+			particlesCount, interactionRadius, threadsCount);
+		ApplyInteractionsCPU(deltaTime);
+	}
+
+	/// Below it is simply a copy of compute shader calculations but written in C++.
+	/// Particles are updated in chunks of the fixed size, every chunk is one task of the
+	/// job system and statistics of chunks are reduced by the task waiting for all of them.
+	int chunksCount = (particlesCount + PARTICLES_CHUNK_SIZE - 1) / PARTICLES_CHUNK_SIZE;
+	chunkStats.assign(chunksCount, ParticlesStats());
+	chunkTimes.assign(chunksCount, 0.0);
+	chunkNodes.assign(chunksCount, 0);
+
+	updateGraph.Clear();
+	int reduceTask = updateGraph.Add([this, chunksCount]()
+	{
+		ReportThroughput();
+
+		updateStats = ParticlesStats();
+		updateStats.tick = ticksCount;
+		updateSeconds = 0;
+		for (int chunk = 0; chunk < chunksCount; chunk++)
+		{
+			updateSeconds		+= chunkTimes[chunk];
+			updateStats.alive	+= chunkStats[chunk].alive;
+			updateStats.emitted	+= chunkStats[chunk].emitted;
+			updateStats.died	+= chunkStats[chunk].died;
+		}
+	});
+	for (int chunk = 0; chunk < chunksCount; chunk++)
+	{
+		auto updateChunk = [this, chunk]()
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			UpdateCPUChunk(chunk);
+			chunkTimes[chunk] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			chunkNodes[chunk] = JobSystem::Get()->GetThreadNode(JobSystem::GetThreadIndex());
+		};
+		int chunkTask = (UseChunkBinding == true) ? updateGraph.AddOnThread(updateChunk, GetChunkThread(chunk)) : updateGraph.Add(updateChunk);
+		updateGraph.Depend(reduceTask, chunkTask);
+	}
+	JobSystem::Get()->Run(updateGraph);
+}
+
+/**
+* Get the thread of the job system owning the chunk. Chunks are split between threads
+* in equal contiguous ranges, so every thread keeps the same particles in every update.
+* @param chunk - index of the chunk (PARTICLES_CHUNK_SIZE particles).
+* @returns index of the thread.
+*/
+int ParticlesCore::GetChunkThread(int chunk)
+{
+	int chunksCount = (particlesCount + PARTICLES_CHUNK_SIZE - 1) / PARTICLES_CHUNK_SIZE;
+	return (int)((long long)chunk * JobSystem::Get()->GetThreadsCount() / chunksCount);
+}
+
+/**
+* Touch the memory of CPU particles by threads owning their chunks. Pages are placed
+* in the NUMA node of the thread which touches them first, so every thread later
+* updates particles from its local memory. They come zeroed from the system.
+*/
+void ParticlesCore::PlaceCPUParticles()
+{
+	int chunksCount = (particlesCount + PARTICLES_CHUNK_SIZE - 1) / PARTICLES_CHUNK_SIZE;
+	TaskGraph placeGraph;
+	for (int chunk = 0; chunk < chunksCount; chunk++)
+	{
+		placeGraph.AddOnThread([this, chunk]()
+		{
+			int from	= chunk * PARTICLES_CHUNK_SIZE;
+			int count	= std::min(PARTICLES_CHUNK_SIZE, particlesCount - from);
+			/// The arena memory is zeroed by the system when the page is touched, so writing
+			/// one byte of every page is enough and the pool isn't filled twice
+			char* render		= (char*)(renderCPU + from);
+			char* simulation	= (char*)(simulationCPU + from);
+			for (size_t offset = 0; offset < count * sizeof(ParticleRender); offset += PARTICLES_PAGE_SIZE)
+			{
+				render[offset] = 0;
+			}
+			for (size_t offset = 0; offset < count * sizeof(ParticleSimulation); offset += PARTICLES_PAGE_SIZE)
+			{
+				simulation[offset] = 0;
+			}
+		}, GetChunkThread(chunk));
+	}
+	JobSystem::Get()->Run(placeGraph);
+}
+
+/**
+* Add the time of chunk updates to the throughput of NUMA nodes and print it
+* every throughputReportInterval ticks.
+*/
+void ParticlesCore::ReportThroughput()
+{
+	if (throughputReportInterval == 0)
+	{
+		return;
+	}
+
+	for (size_t chunk = 0; chunk < chunkTimes.size(); chunk++)
+	{
+		int from = (int)chunk * PARTICLES_CHUNK_SIZE;
+		nodeParticles[chunkNodes[chunk]]	+= (double)std::min(PARTICLES_CHUNK_SIZE, particlesCount - from) * updateSubsteps.size();
+		nodeSeconds[chunkNodes[chunk]]		+= chunkTimes[chunk];
+	}
+
+	/// Throughput is per thread: particles divided by the time threads of the node spent on them
+	if (ticksCount >= throughputReportTick + throughputReportInterval)
+	{
+		for (size_t node = 0; node < nodeParticles.size(); node++)
+		{
+			if (nodeSeconds[node] > 0)
+			{
+				printf("Node %d: %.1f M particle substeps/s per thread\n", (int)node, nodeParticles[node] / nodeSeconds[node] / 1000000.0);
+			}
+			nodeParticles[node]	= 0;
+			nodeSeconds[node]	= 0;
+		}
+		throughputReportTick = ticksCount;
+	}
+}
+
+/**
+* Update one chunk of particles using the CPU. Every particle takes all substeps
+* of the update before the next one is loaded.
+* @param chunk - index of the chunk (PARTICLES_CHUNK_SIZE particles).
+*/
+void ParticlesCore::UpdateCPUChunk(int chunk)
+{
+	/// Random float number generator. It is seeded with the random epoch and the chunk, so
+	/// the simulation can be restored from the snapshot and it doesn't depend on threads count.
+	std::mt19937 gen(randomEpoch ^ ((unsigned int)chunk * 2654435769u));
+
+	ParticlesStats& stats = chunkStats[chunk];
+	int to = std::min((chunk + 1) * PARTICLES_CHUNK_SIZE, particlesCount);
+
+	for (int id = chunk * PARTICLES_CHUNK_SIZE; id < to; id++)
+	{
+		ParticleRender& render			= renderCPU[id];
+		ParticleSimulation& simulation	= simulationCPU[id];
+
+		/// All substeps of the particle are taken while it is in the cache, so the memory
+		/// is streamed once per update instead of once per substep.
+		bool isFading = false;
+		for (size_t i = 0; i < updateSubsteps.size(); i++)
+		{
+			const ParticlesSubstep& substep = updateSubsteps[i];
+			float deltaTime = substep.deltaTime;
+
+			if (simulation.others[0] <= 0)
+			{
+				render.color = 0;
+				isFading = false;
+
+				if (substep.particlesEmitted > id)
+				{
+					/// The particle waits only if it was emitted in this emit cycle already. The flag
+					/// of the previous cycle doesn't stop it, even if it died in this substep.
+					if (simulation.others[1] != substep.emitMark && (id / 4) % emitStride == 0)
+					{
+						/// The particle is moved by the time passed since it was due in this substep.
+						/// The emitter was where it was that long before the end of the whole update.
+						float age = GetEmissionAge(id, substep.emitFrom, substep.emitAge);
+						EmitParticleCPU(render, simulation, id, gen, age + substep.timeLeft, substep.emitMark);
+						render.position[0]		+= simulation.velocity[0] * age;
+						render.position[1]		+= simulation.velocity[1] * age;
+						render.position[2]		+= simulation.velocity[2] * age;
+						simulation.velocity[1]	-= gravity * age;
+						simulation.others[0]	-= age;
+						stats.emitted++;
+					}
+				}
+				else
+				{
+					simulation.others[1] = 0;
+				}
+			}
+			else
+			{
+				render.position[0] += simulation.velocity[0] * deltaTime;
+				render.position[1] += simulation.velocity[1] * deltaTime;
+				render.position[2] += simulation.velocity[2] * deltaTime;
+
+				simulation.velocity[1] -= gravity*deltaTime;
+
+				for (size_t f = 0; f < vectorFields.size(); f++)
+				{
+					vectorFields[f]->Apply(render.position, simulation.velocity, deltaTime);
+				}
+
+				simulation.others[0] -= deltaTime;
+				isFading = true;
+
+				if (simulation.others[0] <= 0)
+				{
+					stats.died++;
+				}
+			}
+		}
+
+		// Particles are counted as alive after the last substep
+		if (simulation.others[0] > 0)
+		{
+			stats.alive++;
+		}
+
+		/// Alpha is taken from the life time left (not decreased), so the byte precision
+		/// of the packed color doesn't add up. It is packed once after all substeps.
+		if (isFading == true && simulation.others[0] < 1)
+		{
+			glm::vec4 color = UnpackColor(render.color);
+			color.a = simulation.others[0];
+			render.color = PackColor(color);
+		}
+	}
+}
+
+/**
+* Advance the time to the next emission and count how many portions of particles have to be
+* emitted in this step. Long steps (distant LOD tiers, catching up) emit all portions that
+* were due in that time, so the density of particles is kept.
+* @param deltaTime - the portion of time thas passed from previous update.
+* @returns number of portions to emit.
+*/
+int ParticlesCore::CountEmissions(float deltaTime)
+{
+	timeToNextEmission -= deltaTime;
+	if (timeToNextEmission > 0)
+	{
+		return 0;
+	}
+
+	// Without the period one portion is emitted every step at its end
+	if (emitPeriod <= 0)
+	{
+		emitAge				= 0;
+		timeToNextEmission	= 0;
+		return 1;
+	}
+
+	/// The first portion was due when the time to it ran out, the next ones every period after it.
+	/// The accumulator goes back to (0, period], so the remainder counts to the next portion.
+	emitAge = std::min(-timeToNextEmission, deltaTime);
+	int portions = 1 + (int)(-timeToNextEmission / emitPeriod);
+	timeToNextEmission += portions * emitPeriod;
+	return portions;
+}
+
+/**
+* Get how long before the end of the step the particle was due to be emitted
+* (its portion is emitted at the time it was due, not at the end of the step).
+* @param id			- id of the particle emitted in the step.
+* @param from		- id of the first particle emitted in the step.
+* @param firstAge	- age of the first portion of the step at its end.
+* @returns the age of the particle (0 for particles of older steps).
+*/
+float ParticlesCore::GetEmissionAge(int id, int from, float firstAge)
+{
+	if (id < from || emitPeriod <= 0)
+	{
+		return 0;
+	}
+	return std::max(0.f, firstAge - ((id - from) / particlesEmitAtOnce) * emitPeriod);
+}
+
+/**
+* Emit the particle on the CPU. It sets the life time, "was emitted" flag, position,
+* color and velocity the same way as the compute shader does. The particle is placed
+* where the emitter was when it was due (it isn't moved by its age here).
+* @param render		- render data of the particle.
+* @param simulation	- simulation data of the particle.
+* @param id			- id of the particle (decides in which stream the particle is).
+* @param gen		- random numbers generator.
+* @param age		- how long before the end of this step the particle was due.
+* @param mark		- "was emitted" flag of the emit cycle in which the particle is emitted.
+*/
+void ParticlesCore::EmitParticleCPU(ParticleRender& render, ParticleSimulation& simulation, int id, std::mt19937& gen, float age, float mark)
+{
+	/// Contants helping with "shader" writing
+	const float D120 = 2.09439510f;
+
+	/// Random float number distributions
+	std::uniform_real_distribution<float> particleSaturationRand(0.f, particleColorSaturation);
+	std::uniform_real_distribution<float> emitterSpreadRand(0.f, emitterSpread);
+	std::uniform_real_distribution<float> halfRand(0.f, 0.5f);
+
+	simulation.others[0] = particleLifeTime;
+
+	simulation.others[1] = mark;
+
+	glm::vec3 position	= emitterPosition - emitterVelocity * age;
+	float rotation		= emitterRotation - emitterRotationSpeed * age;
+	render.position[0] = position.x;
+	render.position[1] = position.y;
+	render.position[2] = position.z;
+
+	int mod = id % 4;
+
+	float deltaSaturation = particleSaturationRand(gen);
+	glm::vec4 color(deltaSaturation, deltaSaturation, deltaSaturation, 1);
+
+	if (mod > 0)
+	{
+		render.position[0] += (emitterRadius * sin(mod * D120 + rotation));
+		render.position[2] -= (emitterRadius * cos(mod * D120 + rotation));
+
+		switch (mod)
+		{
+		case 1:
+			color.r = 1; break;
+		case 2:
+			color.g = 1; break;
+		case 3:
+			color.b = 1; break;
+		}
+	}
+
+	render.color = PackColor(color);
+
+	simulation.velocity[0] = emitterSpread == 0 ? 0 : emitterSpreadRand(gen) - emitterSpread * 0.5f;
+	simulation.velocity[2] = emitterSpread == 0 ? 0 : emitterSpreadRand(gen) - emitterSpread * 0.5f;
+
+	simulation.velocity[1] = halfRand(gen) + particleSpeed;
+}
+
+/**
+* Apply particle-particle interactions (separation and cohesion) to velocities of
+* alive particles, using neighbours found in the spatial grid.
+* @param deltaTime - the portion of time thas passed from previous update.
+*/
+void ParticlesCore::ApplyInteractionsCPU(float deltaTime)
+{
+	/// Every particle changes only its own velocity and reads neighbours positions
+	/// from the grid, so particles can be processed on many threads without locks.
+	ParallelFor(particlesCount, threadsCount, [&](int from, int to, int tid)
+	{
+		for (int id = from; id < to; id++)
+		{
+			ParticleSimulation& simulation = simulationCPU[id];
+			if (simulation.others[0] <= 0)
+			{
+				continue;
+			}
+
+			glm::vec3 position(renderCPU[id].position[0], renderCPU[id].position[1], renderCPU[id].position[2]);
+			glm::vec3 separation(0);
+			glm::vec3 center(0);
+			int neighboursCount = 0;
+
+			spatialGrid->ForEachNeighbour(position, interactionRadius, [&](int otherId, const glm::vec3& otherPosition, float distanceSquared)
+			{
+				if (otherId == id)
+				{
+					return;
+				}
+
+				// Push away stronger the closer the neighbour is
+				float distance = sqrt(distanceSquared);
+				if (distance > 0)
+				{
+					separation += (position - otherPosition) * ((1.f - distance / interactionRadius) / distance);
+				}
+				center += otherPosition;
+				neighboursCount++;
+			});
+
+			if (neighboursCount > 0)
+			{
+				glm::vec3 acceleration =	separation * interactionSeparation +
+											(center / (float)neighboursCount - position) * interactionCohesion;
+				simulation.velocity[0] += acceleration.x * deltaTime;
+				simulation.velocity[1] += acceleration.y * deltaTime;
+				simulation.velocity[2] += acceleration.z * deltaTime;
+			}
+		}
+	});
+}
+
+/**
+* Simple destructor.
+*/
+ParticlesCore::~ParticlesCore()
+{
+	for (size_t i = 0; i < vectorFields.size(); i++)
+	{
+		delete vectorFields[i];
+	}
+	delete particlesArena;
+	delete spatialGrid;
+}
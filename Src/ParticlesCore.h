@@ -0,0 +1,349 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is the core of the CPU particles path. It reads parameters of particles from the
+* configuration ini file, keeps the state of the emitter and both CPU streams, and emits
+* and integrates particles the same way as the update shader. It doesn't call OpenGL, so
+* the application (Particles) and the headless parameter sweep (Sweep) run the same code.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Arena.h"
+#include "JobSystem.h"
+
+#include <GLM/glm.hpp>
+
+#include <functional>
+#include <random>
+#include <vector>
+
+// Define the number of particles updated by one task on the CPU path (it is fixed,
+// so the random numbers of emitted particles don't depend on the threads count)
+#define PARTICLES_CHUNK_SIZE 16384
+
+// Define the maximum number of substeps the CPU path takes in one pass over particles
+// (longer steps are split into this many longer substeps)
+#define PARTICLES_MAX_SUBSTEPS 32
+
+// Define the size of the memory page, CPU particles are placed by touching every page once
+#define PARTICLES_PAGE_SIZE 4096
+
+// Define how many update periods the life time is shorter than the emit process of the pool
+// at most, so every particle dies before the emission counter gets to it again
+#define PARTICLES_LIFE_TIME_MARGIN 2
+
+/**
+* Render stream of one particle. It is the only data read in drawing, so it is
+* kept apart from the simulation stream. The color is packed in four unsigned
+* normalized bytes with red in the lowest one (the same as packUnorm4x8 in shaders).
+*/
+struct ParticleRender
+{
+	float position[3];				///< Position xyz.
+	unsigned int color;				///< Packed color rgba.
+};
+
+/**
+* Simulation stream of one particle. It is read only in updating (and in evaluating
+* particles in analytic mode).
+*/
+struct ParticleSimulation
+{
+	float velocity[3];				///< Velocity xyz.
+	float others[2];				///< Life time left (spawn time in analytic mode) and "was emitted" flag (0 or the emit mark).
+};
+
+/**
+* Statistics of one update of particles.
+*/
+struct ParticlesStats
+{
+	unsigned int alive;				///< Particles alive after the update.
+	unsigned int emitted;			///< Particles emitted in the update.
+	unsigned int died;				///< Particles which died in the update.
+	unsigned long long tick;		///< Update in which statistics were gathered (0 - no statistics yet).
+};
+
+/**
+* One substep of the CPU update. Emission of every substep is counted before chunks are
+* updated, so every chunk takes all substeps of its particles in one pass over memory.
+*/
+struct ParticlesSubstep
+{
+	float deltaTime;				///< Time of the substep.
+	float timeLeft;					///< Time from the end of the substep to the end of the update.
+	float emitAge;					///< Age of the first portion emitted in the substep at its end.
+	int emitFrom;					///< Id of the first particle emitted in the substep.
+	int particlesEmitted;			///< Emission counter in the substep.
+	float emitMark;					///< "Was emitted" flag of particles emitted in the emit cycle of the substep.
+};
+
+/**
+* Parameters of particles and of their CPU simulation read from the configuration ini file.
+*/
+struct ParticlesParams
+{
+	int count;						///< How many particles are here at all.
+	int emitAtOnce;					///< How many particles are emitted with one portion.
+	float lifeTime;					///< Configured time of life of one particle.
+	float speed;					///< Speed of particle in y-axis.
+	float colorSaturation;			///< Range of particle color saturation.
+	float emitPeriod;				///< Period of emitting every portion of particles.
+	float emitterMoveSpeed;			///< Speed of emitter movement.
+	float emitterRotationSpeed;		///< Speed of emitter rotation.
+	float gravity;					///< The gravity of the enviroment.
+	glm::vec3 emitterPosition;		///< Starting position of the emitter.
+	float emitterRadius;			///< Radius of the emitter.
+	float emitterSpread;			///< Spread of every stream.
+	int threadsCount;				///< How many threads are used for CPU calculations.
+	int tickSubsteps;				///< The CPU path is simulated every that many ticks with one substep per tick.
+	int throughputReportInterval;	///< Every which tick the throughput of NUMA nodes is printed (0 - never).
+	ArenaPages pages;				///< Pages backing CPU streams.
+	float interactionRadius;		///< Radius in which particles interact with each other.
+	float interactionSeparation;	///< Strength of pushing particles away from close neighbours.
+	float interactionCohesion;		///< Strength of pulling particles to the center of their neighbours.
+};
+
+/**
+* Reader of one [Particles] value, it gets the key and its default value.
+*/
+typedef std::function<double(const char* key, double defaultValue)> ParticlesParamsReader;
+
+// Predefine class for visibility
+class INIReader;
+class SpatialGrid;
+class VectorField;
+
+class ParticlesCore
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	ParticlesCore();
+	virtual ~ParticlesCore();
+
+	/**
+	* Read parameters of particles. This is the only place where their keys and defaults
+	* are listed, so the application and the sweep always read them the same way.
+	* @param config	- the configuration ini file reader.
+	* @param read	- reader of [Particles] values, it can override them (the ini file when empty).
+	* @returns read parameters.
+	*/
+	static ParticlesParams LoadParams(INIReader* config, const ParticlesParamsReader& read = ParticlesParamsReader());
+
+	/**
+	* Set parameters and the starting state of the emitter. The life time is clamped to
+	* the emit process of the pool. It needs the initialized job system.
+	* @param params - parameters of particles.
+	*/
+	void Init(const ParticlesParams& params);
+
+	/**
+	* Load all vector fields listed in [VectorFields].
+	* @param config			- the configuration ini file reader.
+	* @param createTextures - true if fields are uploaded to 3D textures for the GPU path.
+	*/
+	void LoadVectorFields(INIReader* config, bool createTextures);
+
+	/**
+	* Allocate both CPU streams in the arena and place them in memory of threads owning
+	* their chunks. They come zeroed (no particle is emitted yet).
+	* @returns false if the memory can't be allocated.
+	*/
+	bool AllocateCPU();
+
+	/**
+	* Simulate one step of particles on the CPU. The emitter is moved by the caller before,
+	* here it is rotated, emission of every substep is counted, interactions are applied
+	* and chunks are updated on the job system.
+	* @param deltaTime - the portion of time thas passed from previous update.
+	*/
+	void SimulateCPU(float deltaTime);
+
+	/**
+	* Get statistics of the last step simulated on the CPU.
+	*/
+	const ParticlesStats& GetUpdateStats() { return updateStats; }
+
+	/**
+	* Get the time threads spent updating chunks in the last step simulated on the CPU
+	* (summed over threads, in seconds).
+	*/
+	double GetUpdateSeconds() { return updateSeconds; }
+
+	/**
+	* Get the number of particles.
+	*/
+	int GetParticlesCount() { return particlesCount; }
+
+	/**
+	* Get the number of ticks simulated with one step on the CPU.
+	*/
+	int GetTickSubsteps() { return tickSubsteps; }
+
+	/**
+	* Get the memory reserved for both CPU streams in bytes.
+	*/
+	size_t GetMemorySize() { return particlesArena != NULL ? particlesArena->GetCapacity() : 0; }
+
+protected:
+	/**
+	* Pack the color in four unsigned normalized bytes, the same as packUnorm4x8 in shaders.
+	* @param color - color rgba.
+	* @returns packed color with red in the lowest byte.
+	*/
+	static unsigned int PackColor(const glm::vec4& color);
+
+	/**
+	* Unpack the color packed in four unsigned normalized bytes, the same as unpackUnorm4x8 in shaders.
+	* @param color - packed color with red in the lowest byte.
+	* @returns color rgba.
+	*/
+	static glm::vec4 UnpackColor(unsigned int color);
+
+	/**
+	* Advance the time to the next emission and count how many portions of particles have to be
+	* emitted in this step. Long steps (distant LOD tiers, catching up) emit all portions that
+	* were due in that time, so the density of particles is kept. The time left after the last
+	* portion is kept for the next step, so the rate doesn't depend on the tick rate. It also
+	* remembers the age of the first portion at the end of the step.
+	* @param deltaTime - the portion of time thas passed from previous update.
+	* @returns number of portions to emit.
+	*/
+	int CountEmissions(float deltaTime);
+
+	/**
+	* Zero the emission counter when all particles were emitted and start the next emit cycle.
+	* Particles emitted in it get the other "was emitted" flag, so particles of the previous
+	* cycle can be emitted again even if they died in the same step the counter got to them.
+	*/
+	void WrapEmission();
+
+	/**
+	* Get the life time clamped to the emit process of the pool, shortened by PARTICLES_LIFE_TIME_MARGIN
+	* updates, so every particle dies before the emission counter gets to it again.
+	* @param count - number of particles in the pool.
+	* @returns the life time of particles.
+	*/
+	float GetClampedLifeTime(int count);
+
+	/**
+	* Get how long before the end of the step the particle was due to be emitted
+	* (its portion is emitted at the time it was due, not at the end of the step).
+	* @param id			- id of the particle emitted in the step.
+	* @param from		- id of the first particle emitted in the step.
+	* @param firstAge	- age of the first portion of the step at its end.
+	* @returns the age of the particle (0 for particles of older steps).
+	*/
+	float GetEmissionAge(int id, int from, float firstAge);
+
+	/**
+	* Update one chunk of particles using the CPU. Every particle takes all substeps
+	* of the update before the next one is loaded.
+	* @param chunk - index of the chunk (PARTICLES_CHUNK_SIZE particles).
+	*/
+	void UpdateCPUChunk(int chunk);
+
+	/**
+	* Get the thread of the job system owning the chunk. Chunks are split between threads
+	* in equal contiguous ranges, so every thread keeps the same particles in every update.
+	* @param chunk - index of the chunk (PARTICLES_CHUNK_SIZE particles).
+	* @returns index of the thread.
+	*/
+	int GetChunkThread(int chunk);
+
+	/**
+	* Touch the memory of CPU particles by threads owning their chunks. Pages are placed
+	* in the NUMA node of the thread which touches them first, so every thread later
+	* updates particles from its local memory. They come zeroed from the system.
+	*/
+	void PlaceCPUParticles();
+
+	/**
+	* Add the time of chunk updates to the throughput of NUMA nodes and print it
+	* every throughputReportInterval ticks.
+	*/
+	void ReportThroughput();
+
+	/**
+	* Emit the particle on the CPU. It sets the life time, "was emitted" flag, position,
+	* color and velocity the same way as the compute shader does. The particle is placed
+	* where the emitter was when it was due (it isn't moved by its age here).
+	* @param render		- render data of the particle.
+	* @param simulation	- simulation data of the particle.
+	* @param id			- id of the particle (decides in which stream the particle is).
+	* @param gen		- random numbers generator.
+	* @param age		- how long before the end of this step the particle was due.
+	* @param mark		- "was emitted" flag of the emit cycle in which the particle is emitted.
+	*/
+	void EmitParticleCPU(ParticleRender& render, ParticleSimulation& simulation, int id, std::mt19937& gen, float age, float mark);
+
+	/**
+	* Apply particle-particle interactions (separation and cohesion) to velocities of
+	* alive particles, using neighbours found in the spatial grid.
+	* @param deltaTime - the portion of time thas passed from previous update.
+	*/
+	void ApplyInteractionsCPU(float deltaTime);
+
+	glm::vec3 emitterPosition;		///< Position of the particles emitter.
+	glm::vec3 emitterVelocity;		///< Velocity of the emitter in this step (spawn positions are moved back by it).
+
+	float emitPeriod;				///< Period of emitting every portion of particles.
+									///< Thanks to that particles will be emitting systematically,
+									///< not at the same time.
+	float timeToNextEmission;		///< Time to nex emission of portion of particles.
+	float emitAge;					///< Age of the first portion emitted in this step at the end of the step.
+	int emitFrom;					///< Id of the first particle emitted in this step.
+	float particleLifeTime;			///< Time of life of one particle.
+	float configuredLifeTime;		///< Time of life from the configuration (longer than the emit process of the pool it is shortened).
+	float particleColorSaturation;	///< Range of particle color saturation.
+	float particleSpeed;			///< Speed of particle in y-axis.
+	float emitterRotationSpeed;		///< Speed of emitter rotation.
+	float emitterRotation;			///< Current rotation angle of the emitter.
+	float emitterRadius;			///< Radius of the emitter (how far every stream is from the center).
+	float emitterSpread;			///< Spread of every stream.
+	float emitterMoveSpeed;			///< Speed of emitter movement.
+	float gravity;					///< The gravity of the enviroment.
+
+	int particlesEmitAtOnce;		///< How many particles will be emited with one portion.
+	int particlesEmitted;			///< How many particles were already emited.
+	float emitMark;					///< "Was emitted" flag of the current emit cycle (1 or 2, it changes with every cycle).
+	int particlesCount;				///< How many particles are here at all (max amount of particles).
+	int emitStride;					///< Only every emitStride-th group of four particles is emitted.
+
+	unsigned int randomEpoch;		///< Epoch of the random numbers generator. Increased every update,
+									///< so every emission gets different random numbers.
+	unsigned long long ticksCount;	///< How many updates were done.
+
+	int threadsCount;				///< How many threads are used for CPU calculations.
+	TaskGraph updateGraph;			///< Tasks updating chunks of particles on the CPU path.
+	std::vector<ParticlesStats> chunkStats;	///< Statistics of every chunk of the CPU update.
+	ParticlesStats updateStats;		///< Statistics of the last CPU update (reduced from chunks).
+	double updateSeconds;			///< Time threads spent updating chunks in the last CPU update (reduced from chunks).
+	std::vector<ParticlesSubstep> updateSubsteps;	///< Substeps of the CPU update.
+	int tickSubsteps;				///< The CPU path is simulated every that many ticks with one substep per tick.
+	bool UseChunkBinding;			///< Tells if chunks are always updated by their owner threads (threads are pinned).
+	std::vector<double> chunkTimes;	///< Time of the last update of every chunk in seconds.
+	std::vector<int> chunkNodes;	///< NUMA node of the thread which did the last update of every chunk.
+	std::vector<double> nodeParticles;	///< Particle substeps done by threads of every NUMA node since the last report.
+	std::vector<double> nodeSeconds;	///< Time spent by threads of every NUMA node since the last report.
+	int throughputReportInterval;	///< Every which tick the throughput of NUMA nodes is printed (0 - never).
+	unsigned long long throughputReportTick;	///< Tick of the last printed throughput.
+
+	SpatialGrid* spatialGrid;		///< Grid of alive particles for neighbour queries on the CPU path.
+	float interactionRadius;		///< Radius in which particles interact with each other.
+	float interactionSeparation;	///< Strength of pushing particles away from close neighbours.
+	float interactionCohesion;		///< Strength of pulling particles to the center of their neighbours.
+	bool UseInteractions;			///< Tells if particles interact with each other (CPU path only).
+
+	std::vector<VectorField*> vectorFields;	///< Sampled vector fields applied to particles velocity.
+
+	ArenaPages arenaPages;			///< Pages backing the arena of CPU streams.
+	Arena* particlesArena;			///< Memory of both CPU streams (backed by huge pages when available).
+	ParticleRender* renderCPU;		///< Render stream of particles updated using CPU.
+	ParticleSimulation* simulationCPU;	///< Simulation stream of particles updated using CPU.
+};
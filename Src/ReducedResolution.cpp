@@ -0,0 +1,158 @@
+/**
+* GPU Particles example.
+*
+* This is a reduced resolution pass class. Particles are drawn into the offscreen
+* target which is a fraction of the render size, then the target is upsampled and
+* composited over the main framebuffer.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "ReducedResolution.h"
+#include "Shaders.h"
+
+#include <cstdio>
+
+/**
+* Simple constructor
+*/
+ReducedResolution::ReducedResolution()
+{
+	width				= 0;
+	height				= 0;
+	minScale			= 1.f;
+	scale				= 1.f;
+	size				= glm::ivec2(0);
+	FBO					= 0;
+	colorTexture		= 0;
+	depthTexture		= 0;
+	shader_composite	= 0;
+	VAO					= 0;
+}
+
+/**
+* Create the offscreen target and the compositing shader.
+* @param width		- width of the main framebuffer in pixels.
+* @param height		- height of the main framebuffer in pixels.
+* @param minScale	- the smallest allowed scale.
+* @returns true if the offscreen target is complete.
+*/
+bool ReducedResolution::Init(int width, int height, float minScale)
+{
+	this->width		= width;
+	this->height	= height;
+	this->minScale	= glm::clamp(minScale, 0.01f, 1.f);
+	SetScale(1.f);
+
+	/// Both textures are sampled with texelFetch, so filtering doesn't matter
+	glGenTextures(1, &colorTexture);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Reduced resolution target is incomplete (status 0x%x)\n", status);
+		return false;
+	}
+
+	Shaders::AttachShader(shader_composite, GL_VERTEX_SHADER, "data/shaders/fullscreen_vs.glsl");
+	Shaders::AttachShader(shader_composite, GL_FRAGMENT_SHADER, "data/shaders/upsample_fs.glsl");
+	Shaders::LinkProgram(shader_composite);
+
+	glUseProgram(shader_composite);
+	glUniform1i(glGetUniformLocation(shader_composite, "colorTexture"), 0);
+	glUniform1i(glGetUniformLocation(shader_composite, "depthTexture"), 1);
+	glUseProgram(0);
+
+	glGenVertexArrays(1, &VAO);
+	return true;
+}
+
+/**
+* Set the fraction of the main framebuffer size used by the offscreen target.
+* @param scale - the scale, clamped to <minScale;1>.
+*/
+void ReducedResolution::SetScale(float scale)
+{
+	this->scale	= glm::clamp(scale, minScale, 1.f);
+	size		= glm::max(glm::ivec2(glm::vec2(width, height) * this->scale + 0.5f), glm::ivec2(1));
+}
+
+/**
+* Bind and clear the offscreen target. Everything drawn until End goes into it.
+*/
+void ReducedResolution::Begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, size.x, size.y);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	/// The target is transparent, so keep colors premultiplied and
+	/// accumulate the coverage in alpha for compositing.
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+/**
+* Bind back the main framebuffer and composite the offscreen target over it.
+* @param projection - projection matrix of the camera (used for linearizing depth).
+*/
+void ReducedResolution::End(const glm::mat4& projection)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+	/// Composite writes the depth of the closest particle, so it is tested against the main framebuffer
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(shader_composite);
+	glUniform2i(glGetUniformLocation(shader_composite, "targetSize"), size.x, size.y);
+	glUniform2f(glGetUniformLocation(shader_composite, "targetScale"), (float)size.x / width, (float)size.y / height);
+	glUniform2f(glGetUniformLocation(shader_composite, "projection"), projection[2][2], projection[3][2]);
+	glBindVertexArray(VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+* Simple destructor clearing all data.
+*/
+ReducedResolution::~ReducedResolution()
+{
+	if (shader_composite != 0)
+	{
+		Shaders::DeleteShaders(shader_composite);
+		glDeleteProgram(shader_composite);
+		glDeleteVertexArrays(1, &VAO);
+	}
+	glDeleteFramebuffers(1, &FBO);
+	glDeleteTextures(1, &colorTexture);
+	glDeleteTextures(1, &depthTexture);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a reduced resolution pass class. Particles are drawn into the offscreen
+* target which is a fraction of the render size, then the target is upsampled and
+* composited over the main framebuffer. Upsampling is depth-aware: from the four
+* closest texels those much farther than the closest covered one get lower weights,
+* so far particles don't bleed over the edges of near ones.
+*
+* Textures are allocated in the full render size and only their part is used,
+* so the scale can be changed every frame without any reallocation.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <GL/glew.h>
+#include <GLM/glm.hpp>
+
+class ReducedResolution
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	ReducedResolution();
+	~ReducedResolution();
+
+	/**
+	* Create the offscreen target and the compositing shader.
+	* @param width		- width of the main framebuffer in pixels.
+	* @param height		- height of the main framebuffer in pixels.
+	* @param minScale	- the smallest allowed scale.
+	* @returns true if the offscreen target is complete.
+	*/
+	bool Init(int width, int height, float minScale);
+
+	/**
+	* Set the fraction of the main framebuffer size used by the offscreen target.
+	* @param scale - the scale, clamped to <minScale;1>.
+	*/
+	void SetScale(float scale);
+
+	/**
+	* Get the fraction of the main framebuffer size used by the offscreen target.
+	*/
+	float GetScale() { return scale; }
+
+	/**
+	* Get the size of the used part of the offscreen target in pixels.
+	*/
+	glm::ivec2 GetSize() { return size; }
+
+	/**
+	* Bind and clear the offscreen target. Everything drawn until End goes into it.
+	*/
+	void Begin();
+
+	/**
+	* Bind back the main framebuffer and composite the offscreen target over it.
+	* @param projection - projection matrix of the camera (used for linearizing depth).
+	*/
+	void End(const glm::mat4& projection);
+
+private:
+	int width;						///< Width of the main framebuffer in pixels.
+	int height;						///< Height of the main framebuffer in pixels.
+	float minScale;					///< The smallest allowed scale.
+	float scale;					///< Current fraction of the main framebuffer size.
+	glm::ivec2 size;				///< Size of the used part of the offscreen target.
+
+	GLuint FBO;						///< Framebuffer object of the offscreen target.
+	GLuint colorTexture;			///< Color of particles (premultiplied alpha).
+	GLuint depthTexture;			///< Depth of particles.
+	GLuint shader_composite;		///< Id of the shader upsampling and compositing the target.
+	GLuint VAO;						///< Empty vertex array object for the full-screen pass.
+};
@@ -42,21 +42,29 @@ void Scene::Init()
 */
 void Scene::OnRun(double deltaTime)
 {
+	/// Camera and particles read the input and submit GL commands, so they are updated on
+	/// the main thread one after another. The CPU work of particles (chunks of the CPU update,
+	/// the spatial grid and interactions) is spread to the job system inside their update.
+
 	// When there was input in camera update it
 	if (camera->HandleInput() == true)
 	{
 		camera->Update((float)deltaTime);
 	}
 
-	// Always update particles data
+	// Always update particles data (culling and LOD need the updated camera)
 	particles->Update((float)deltaTime);
 }
 
 /**
 * Draw whole scene.
+* @param timeSinceUpdate - the time passed since the last update (used for predicting the camera).
 */
-void Scene::OnDraw()
+void Scene::OnDraw(double timeSinceUpdate)
 {
+	// Sample the newest input for the camera right before drawing
+	camera->LateLatch((float)timeSinceUpdate);
+
 	// Clear before rendering
 	glClearColor(bgColor[0], bgColor[1], bgColor[2], bgColor[3]);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -65,6 +73,56 @@ void Scene::OnDraw()
 	particles->Draw(camera);
 }
 
+/**
+* Handle the key action that isn't polled every tick (like saving a snapshot).
+* @param key	- the glfw key code.
+* @param action	- the glfw key action.
+*/
+void Scene::OnKey(int key, int action)
+{
+	// React only once for every key press
+	if (action != GLFW_PRESS)
+	{
+		return;
+	}
+
+	///Bindings:
+	// F2 - switch to the next particles renderer
+	// F3 - run the render benchmark (all renderers against each other)
+	// F5 - save the particles snapshot
+	// F7 - decrease the resolution of particles rendering
+	// F8 - increase the resolution of particles rendering
+	// F9 - load the particles snapshot
+	// F10 - halve the number of particles
+	// F11 - double the number of particles
+	if (key == GLFW_KEY_F2)
+	{
+		particles->NextRenderer();
+	}
+	else if (key == GLFW_KEY_F3)
+	{
+		particles->RunRenderBenchmark(camera);
+	}
+	else if (key == GLFW_KEY_F5)
+	{
+		particles->SaveSnapshot(particles->GetSnapshotPath());
+	}
+	else if (key == GLFW_KEY_F7 || key == GLFW_KEY_F8)
+	{
+		particles->SetRenderScale(particles->GetRenderScale() + (key == GLFW_KEY_F7 ? -0.125f : 0.125f));
+		printf("Particles render scale: %.3f\n", particles->GetRenderScale());
+	}
+	else if (key == GLFW_KEY_F9)
+	{
+		particles->LoadSnapshot(particles->GetSnapshotPath());
+	}
+	else if (key == GLFW_KEY_F10 || key == GLFW_KEY_F11)
+	{
+		int count = particles->GetParticlesCount();
+		particles->Resize(key == GLFW_KEY_F10 ? count / 2 : count * 2);
+	}
+}
+
 /**
 * Simple destructor clearing all data.
 */
@@ -43,8 +43,16 @@ public:
 
 	/**
 	* Draw whole scene.
+	* @param timeSinceUpdate - the time passed since the last update (used for predicting the camera).
 	*/
-	void OnDraw();
+	void OnDraw(double timeSinceUpdate);
+
+	/**
+	* Handle the key action that isn't polled every tick (like saving a snapshot).
+	* @param key	- the glfw key code.
+	* @param action	- the glfw key action.
+	*/
+	void OnKey(int key, int action);
 
 	
 };
@@ -0,0 +1,186 @@
+/**
+* GPU Particles example.
+*
+* This is a snapshot class. It saves and loads the complete particles simulation
+* state. The file is a small header followed by raw particles data which starts
+* at the page aligned offset, so the data can be mapped straight into memory and
+* copied to the CPU store or uploaded to the vertex buffers without any parsing.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+/**
+* Simple constructor
+*/
+Snapshot::Snapshot()
+{
+	mapping = NULL;
+	mappingSize = 0;
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	fileDescriptor = -1;
+#endif
+}
+
+/**
+* Write the snapshot file. Magic, version, data offset and data sizes of the
+* header are filled here.
+* @param path			- path to the snapshot file.
+* @param header			- header with the simulation state.
+* @param renderData		- pointer to the render stream (particlesCount * renderParticleSize floats).
+* @param simulationData	- pointer to the simulation stream (the rest of particleSize floats).
+* @returns true if the file was written.
+*/
+bool Snapshot::Save(const char* path, SnapshotHeader header, const void* renderData, const void* simulationData)
+{
+	header.magic			= SNAPSHOT_MAGIC;
+	header.version			= SNAPSHOT_VERSION;
+	header.dataOffset		= SNAPSHOT_DATA_OFFSET;
+	header.dataSize			= (uint64_t)header.particlesCount * header.particleSize * sizeof(float);
+	header.renderDataSize	= (uint64_t)header.particlesCount * header.renderParticleSize * sizeof(float);
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		printf("Can't open the snapshot file for writing: %s\n", path);
+		return false;
+	}
+
+	/// Write the header padded with zeroes up to the data offset, so the data
+	/// will start on the page boundary.
+	char headerBlock[SNAPSHOT_DATA_OFFSET] = {};
+	memcpy(headerBlock, &header, sizeof(SnapshotHeader));
+
+	bool result =	fwrite(headerBlock, SNAPSHOT_DATA_OFFSET, 1, file) == 1 &&
+					fwrite(renderData, (size_t)header.renderDataSize, 1, file) == 1 &&
+					fwrite(simulationData, (size_t)(header.dataSize - header.renderDataSize), 1, file) == 1;
+	fclose(file);
+
+	if (result == false)
+	{
+		printf("Can't write the snapshot file: %s\n", path);
+	}
+	return result;
+}
+
+/**
+* Map the snapshot file into memory and validate its header.
+* @param path - path to the snapshot file.
+* @returns true if the file was mapped and is a valid snapshot.
+*/
+bool Snapshot::Open(const char* path)
+{
+	Close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(fileHandle, &fileSize);
+		mappingSize = (size_t)fileSize.QuadPart;
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle != NULL)
+		{
+			mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		}
+	}
+#else
+	fileDescriptor = open(path, O_RDONLY);
+	if (fileDescriptor != -1)
+	{
+		struct stat fileStat;
+		fstat(fileDescriptor, &fileStat);
+		mappingSize = (size_t)fileStat.st_size;
+		if (mappingSize > 0)
+		{
+			mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+			if (mapping == MAP_FAILED)
+			{
+				mapping = NULL;
+			}
+		}
+	}
+#endif
+
+	if (mapping == NULL)
+	{
+		printf("Can't open the snapshot file: %s\n", path);
+		Close();
+		return false;
+	}
+
+	/// Validate the header, so we won't read any junk data.
+	const SnapshotHeader* header = GetHeader();
+	if (mappingSize < SNAPSHOT_DATA_OFFSET ||
+		header->magic != SNAPSHOT_MAGIC ||
+		header->version != SNAPSHOT_VERSION ||
+		header->renderDataSize > header->dataSize ||
+		header->dataOffset + header->dataSize > mappingSize)
+	{
+		printf("Invalid snapshot file: %s\n", path);
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+* Unmap the snapshot file. It is also done in destructor.
+*/
+void Snapshot::Close()
+{
+#ifdef _WIN32
+	if (mapping != NULL)
+	{
+		UnmapViewOfFile(mapping);
+	}
+	if (mappingHandle != NULL)
+	{
+		CloseHandle(mappingHandle);
+		mappingHandle = NULL;
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (mapping != NULL)
+	{
+		munmap(mapping, mappingSize);
+	}
+	if (fileDescriptor != -1)
+	{
+		close(fileDescriptor);
+		fileDescriptor = -1;
+	}
+#endif
+	mapping = NULL;
+	mappingSize = 0;
+}
+
+/**
+* Simple destructor unmapping the file.
+*/
+Snapshot::~Snapshot()
+{
+	Close();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a snapshot class. It saves and loads the complete particles simulation
+* state. The file is a small header followed by raw particles data which starts
+* at the page aligned offset, so the data can be mapped straight into memory and
+* copied to the CPU store or uploaded to the vertex buffers without any parsing.
+* The data is the render stream of all particles followed by the simulation stream.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+// Define the magic number at the beginning of every snapshot file ("GPPS")
+#define SNAPSHOT_MAGIC			0x53505047
+
+// Define the version of the snapshot file format. Increase it whenever the header
+// or the particle layout changes, so old snapshots will be rejected.
+#define SNAPSHOT_VERSION		4
+
+// Define the offset of the particles data in the file (page aligned for mapping)
+#define SNAPSHOT_DATA_OFFSET	4096
+
+/**
+* Header stored at the beginning of every snapshot file.
+*/
+struct SnapshotHeader
+{
+	uint32_t magic;					///< Must be SNAPSHOT_MAGIC.
+	uint32_t version;				///< Must be SNAPSHOT_VERSION.
+	uint32_t particleSize;			///< Number of floats in one particle (both streams).
+	uint32_t renderParticleSize;	///< Number of floats in one particle of the render stream.
+	uint32_t particlesCount;		///< Number of particles stored in the file.
+	int32_t particlesEmitted;		///< Emission counter of the emitter.
+	float emitMark;					///< "Was emitted" flag of the current emit cycle.
+	uint32_t randomEpoch;			///< Epoch of the random numbers generator.
+	float timeToNextEmission;		///< Time to the next emission of portion of particles.
+	float emitterRotation;			///< Current rotation angle of the emitter.
+	float emitterPosition[3];		///< Position of the particles emitter.
+	float particleLifeTime;			///< Time of life of one particle.
+	uint32_t analytic;				///< 1 if particles store the spawn state (analytic mode).
+	float analyticTime;				///< Time of the analytic mode.
+	uint64_t dataOffset;			///< Offset of the particles data from the beginning of the file.
+	uint64_t dataSize;				///< Size in bytes of the particles data.
+	uint64_t renderDataSize;		///< Size in bytes of the render stream (the simulation stream follows it).
+};
+
+class Snapshot
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	Snapshot();
+	~Snapshot();
+
+	/**
+	* Write the snapshot file. Magic, version, data offset and data sizes of the
+	* header are filled here.
+	* @param path			- path to the snapshot file.
+	* @param header			- header with the simulation state.
+	* @param renderData		- pointer to the render stream (particlesCount * renderParticleSize floats).
+	* @param simulationData	- pointer to the simulation stream (the rest of particleSize floats).
+	* @returns true if the file was written.
+	*/
+	static bool Save(const char* path, SnapshotHeader header, const void* renderData, const void* simulationData);
+
+	/**
+	* Map the snapshot file into memory and validate its header.
+	* @param path - path to the snapshot file.
+	* @returns true if the file was mapped and is a valid snapshot.
+	*/
+	bool Open(const char* path);
+
+	/**
+	* Unmap the snapshot file. It is also done in destructor.
+	*/
+	void Close();
+
+	/**
+	* Get the header of the opened snapshot.
+	*/
+	const SnapshotHeader* GetHeader() { return (const SnapshotHeader*)mapping; }
+
+	/**
+	* Get the render stream of the opened snapshot.
+	*/
+	const void* GetRenderData() { return (const char*)mapping + GetHeader()->dataOffset; }
+
+	/**
+	* Get the simulation stream of the opened snapshot.
+	*/
+	const void* GetSimulationData() { return (const char*)mapping + GetHeader()->dataOffset + GetHeader()->renderDataSize; }
+
+private:
+	void* mapping;				///< Address of the mapped file.
+	size_t mappingSize;			///< Size of the mapped file.
+
+#ifdef _WIN32
+	void* fileHandle;			///< Handle of the opened file.
+	void* mappingHandle;		///< Handle of the file mapping.
+#else
+	int fileDescriptor;			///< Descriptor of the opened file.
+#endif
+};
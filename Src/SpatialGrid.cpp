@@ -0,0 +1,154 @@
+/**
+* GPU Particles example.
+*
+* This is a spatial grid class. It sorts alive particles of the CPU data store
+* into cells of the uniform grid (hashed into the fixed size table), so the update
+* kernel can iterate over neighbours of any point for particle-particle effects
+* like separation, cohesion or SPH-style density.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "SpatialGrid.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+/**
+* Simple constructor
+*/
+SpatialGrid::SpatialGrid()
+{
+	cellSize		= 1.f;
+	inverseCellSize	= 1.f;
+	tableMask		= 0;
+	cellStart.assign(2, 0);
+}
+
+/**
+* Sort alive particles into the grid cells.
+* @param positions		- positions of particles (xyz of the first particle).
+* @param positionStride	- number of floats between positions of two particles.
+* @param lives			- life time left of particles, particles with life <= 0 are skipped.
+* @param lifeStride		- number of floats between lives of two particles.
+* @param count			- number of particles.
+* @param cellSize		- size of one cell, it must be at least the biggest query radius.
+* @param threadsCount	- number of threads used for building.
+*/
+void SpatialGrid::Build(const float* positions, int positionStride, const float* lives, int lifeStride, int count, float cellSize, int threadsCount)
+{
+	this->cellSize	= cellSize;
+	inverseCellSize	= 1.f / cellSize;
+	threadsCount	= glm::max(threadsCount, 1);
+
+	/// Use at least as many buckets as particles (power of two for cheap hashing).
+	/// Buffers are reallocated only when the particles count changes.
+	int bucketsCount = 1;
+	int keyBits = 1;
+	while (bucketsCount < count)
+	{
+		bucketsCount <<= 1;
+		keyBits++;
+	}
+	if ((unsigned int)bucketsCount != tableMask + 1 || (int)sortedBuckets.size() != count)
+	{
+		tableMask = (unsigned int)bucketsCount - 1;
+		sortedBuckets.resize(count);
+		sortedIds.resize(count);
+		scratchBuckets.resize(count);
+		scratchIds.resize(count);
+		scratchPositions.resize(count);
+		cellStart.resize(bucketsCount + 1);
+		sortedPositions.resize(count);
+	}
+	histograms.resize(threadsCount * SPATIAL_GRID_RADIX_SIZE);
+
+	// Dead particles get the key after all buckets, so they are sorted to the end
+	const unsigned int deadBucket = tableMask + 1;
+
+	/// Find the bucket of every particle. Positions are copied next to the keys and moved
+	/// with them in every pass, so they end up in sorted order without random reads.
+	ParallelFor(count, threadsCount, [&](int from, int to, int tid)
+	{
+		for (int i = from; i < to; i++)
+		{
+			const float* particle = positions + (size_t)i * positionStride;
+			glm::vec3 position(particle[0], particle[1], particle[2]);
+			unsigned int bucket = deadBucket;
+			if (lives[(size_t)i * lifeStride] > 0)
+			{
+				glm::ivec3 cell = GetCell(position);
+				bucket = HashCell(cell.x, cell.y, cell.z);
+			}
+			sortedBuckets[i]	= bucket;
+			sortedIds[i]		= i;
+			sortedPositions[i]	= position;
+		}
+	});
+
+	/// Sort by buckets using counting sort on every digit of the key. Every thread
+	/// counts digits of its range, the offsets are scanned in (digit, thread) order and
+	/// every thread scatters its range, so the sort is stable and needs no atomics.
+	for (int shift = 0; shift < keyBits; shift += SPATIAL_GRID_RADIX_BITS)
+	{
+		ParallelFor(count, threadsCount, [&](int from, int to, int tid)
+		{
+			int* histogram = histograms.data() + tid * SPATIAL_GRID_RADIX_SIZE;
+			std::fill(histogram, histogram + SPATIAL_GRID_RADIX_SIZE, 0);
+			for (int i = from; i < to; i++)
+			{
+				histogram[(sortedBuckets[i] >> shift) & (SPATIAL_GRID_RADIX_SIZE - 1)]++;
+			}
+		});
+
+		int offset = 0;
+		for (int digit = 0; digit < SPATIAL_GRID_RADIX_SIZE; digit++)
+		{
+			for (int tid = 0; tid < threadsCount; tid++)
+			{
+				int digitCount = histograms[tid * SPATIAL_GRID_RADIX_SIZE + digit];
+				histograms[tid * SPATIAL_GRID_RADIX_SIZE + digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		ParallelFor(count, threadsCount, [&](int from, int to, int tid)
+		{
+			int* histogram = histograms.data() + tid * SPATIAL_GRID_RADIX_SIZE;
+			for (int i = from; i < to; i++)
+			{
+				int slot = histogram[(sortedBuckets[i] >> shift) & (SPATIAL_GRID_RADIX_SIZE - 1)]++;
+				scratchBuckets[slot]	= sortedBuckets[i];
+				scratchIds[slot]		= sortedIds[i];
+				scratchPositions[slot]	= sortedPositions[i];
+			}
+		});
+
+		sortedBuckets.swap(scratchBuckets);
+		sortedIds.swap(scratchIds);
+		sortedPositions.swap(scratchPositions);
+	}
+
+	// Dead particles are at the end, skip them
+	int aliveCount = (int)(std::lower_bound(sortedBuckets.begin(), sortedBuckets.end(), deadBucket) - sortedBuckets.begin());
+
+	/// The bucket range starts where the sorted key changes. Every bucket between the previous
+	/// and the current key starts here (empty buckets have empty ranges), so every bucket is
+	/// written exactly once.
+	ParallelFor(aliveCount, threadsCount, [&](int from, int to, int tid)
+	{
+		for (int s = from; s < to; s++)
+		{
+			unsigned int firstBucket = (s == 0) ? 0 : sortedBuckets[s - 1] + 1;
+			for (unsigned int bucket = firstBucket; bucket <= sortedBuckets[s]; bucket++)
+			{
+				cellStart[bucket] = s;
+			}
+		}
+	});
+	unsigned int lastBucket = (aliveCount == 0) ? 0 : sortedBuckets[aliveCount - 1] + 1;
+	for (unsigned int bucket = lastBucket; bucket <= deadBucket; bucket++)
+	{
+		cellStart[bucket] = aliveCount;
+	}
+}
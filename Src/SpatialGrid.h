@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a spatial grid class. It sorts alive particles of the CPU data store
+* into cells of the uniform grid (hashed into the fixed size table), so the update
+* kernel can iterate over neighbours of any point for particle-particle effects
+* like separation, cohesion or SPH-style density.
+*
+* The grid is rebuilt every tick with the parallel counting sort (LSD radix sort of
+* bucket keys, every pass counts digits per thread, scans counts and scatters stable),
+* then ranges of buckets are found on boundaries of sorted keys.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+// Define the number of key bits sorted in one counting sort pass
+#define SPATIAL_GRID_RADIX_BITS	11
+#define SPATIAL_GRID_RADIX_SIZE	(1 << SPATIAL_GRID_RADIX_BITS)
+
+class SpatialGrid
+{
+public:
+	/**
+	* Simple constructor
+	*/
+	SpatialGrid();
+
+	/**
+	* Sort alive particles into the grid cells.
+	* @param positions		- positions of particles (xyz of the first particle).
+	* @param positionStride	- number of floats between positions of two particles.
+	* @param lives			- life time left of particles, particles with life <= 0 are skipped.
+	* @param lifeStride		- number of floats between lives of two particles.
+	* @param count			- number of particles.
+	* @param cellSize		- size of one cell, it must be at least the biggest query radius.
+	* @param threadsCount	- number of threads used for building.
+	*/
+	void Build(const float* positions, int positionStride, const float* lives, int lifeStride, int count, float cellSize, int threadsCount);
+
+	/**
+	* Call the function for every particle closer to the position than the radius
+	* (the particle at the position itself is included too).
+	* @param position	- center of the query.
+	* @param radius		- radius of the query (clamped to the cell size).
+	* @param function	- function(int particleId, const glm::vec3& particlePosition, float distanceSquared).
+	*/
+	template<typename Function>
+	void ForEachNeighbour(const glm::vec3& position, float radius, Function function) const
+	{
+		radius = glm::min(radius, cellSize);
+		float radiusSquared = radius * radius;
+
+		/// Gather buckets of all cells touched by the query. Different cells can fall into
+		/// the same bucket, so skip repeated ones to not visit particles twice.
+		glm::ivec3 minCell = GetCell(position - radius);
+		glm::ivec3 maxCell = GetCell(position + radius);
+		unsigned int buckets[27];
+		int bucketsCount = 0;
+		for (int x = minCell.x; x <= maxCell.x; x++)
+		{
+			for (int y = minCell.y; y <= maxCell.y; y++)
+			{
+				for (int z = minCell.z; z <= maxCell.z; z++)
+				{
+					unsigned int bucket = HashCell(x, y, z);
+					bool isNew = true;
+					for (int i = 0; i < bucketsCount; i++)
+					{
+						isNew = isNew && buckets[i] != bucket;
+					}
+					if (isNew == true)
+					{
+						buckets[bucketsCount++] = bucket;
+					}
+				}
+			}
+		}
+
+		/// Particles of one bucket are stored together, so only the distance has to be checked.
+		for (int i = 0; i < bucketsCount; i++)
+		{
+			for (int s = cellStart[buckets[i]]; s < cellStart[buckets[i] + 1]; s++)
+			{
+				glm::vec3 offset = sortedPositions[s] - position;
+				float distanceSquared = glm::dot(offset, offset);
+				if (distanceSquared <= radiusSquared)
+				{
+					function(sortedIds[s], sortedPositions[s], distanceSquared);
+				}
+			}
+		}
+	}
+
+private:
+	/**
+	* Get the cell containing the position.
+	*/
+	glm::ivec3 GetCell(const glm::vec3& position) const
+	{
+		return glm::ivec3(glm::floor(position * inverseCellSize));
+	}
+
+	/**
+	* Get the bucket of the table to which the cell belongs.
+	*/
+	unsigned int HashCell(int x, int y, int z) const
+	{
+		return (((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u) ^ ((unsigned int)z * 83492791u)) & tableMask;
+	}
+
+	float cellSize;								///< Size of one cell.
+	float inverseCellSize;						///< 1 / cellSize (multiplying is faster).
+	unsigned int tableMask;						///< Number of buckets - 1 (number of buckets is power of two).
+
+	std::vector<unsigned int> sortedBuckets;	///< Bucket of every particle (tableMask + 1 if dead), sorted.
+	std::vector<int> sortedIds;					///< Ids of particles sorted by buckets.
+	std::vector<unsigned int> scratchBuckets;	///< Destination of buckets in the sorting pass.
+	std::vector<int> scratchIds;				///< Destination of ids in the sorting pass.
+	std::vector<glm::vec3> scratchPositions;	///< Destination of positions in the sorting pass.
+	std::vector<int> histograms;				///< Digits counts of every thread in the sorting pass.
+	std::vector<int> cellStart;					///< Range of sorted particles of every bucket (bucketsCount + 1).
+	std::vector<glm::vec3> sortedPositions;		///< Positions of particles sorted by buckets.
+};
@@ -0,0 +1,237 @@
+/**
+* GPU Particles example.
+*
+* This is a parameter sweep class. It runs headless simulations of the CPU particles
+* path for every combination of swept values and writes their results to the CSV file.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Sweep.h"
+#include "Engine.h"
+#include "JobSystem.h"
+#include "ParticlesCore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+/**
+* Simple constructor.
+*/
+Sweep::Sweep()
+{
+	config			= NULL;
+	jobs			= NULL;
+	ticksCount		= 0;
+	sampleInterval	= 1;
+}
+
+/**
+* Read the configuration and build runs from all combinations of swept values.
+* Keys of [Sweep] with the names of [Particles] keys list values separated with commas.
+* @param configPath - path to the configuration ini file.
+* @returns false if the configuration can't be read.
+*/
+bool Sweep::Init(const char* configPath)
+{
+	config = new INIReader(configPath);
+	if (config->ParseError() < 0)
+	{
+		printf("Can't read the configuration file %s\n", configPath);
+		return false;
+	}
+
+	ticksCount		= std::max(1, (int)config->GetInteger("Sweep", "Ticks", 600));
+	sampleInterval	= glm::clamp((int)config->GetInteger("Sweep", "SampleInterval", 30), 1, ticksCount);
+	outputPath		= config->Get("Sweep", "Output", "Data/sweep.csv");
+
+	/// Keys are found by the loader of particles parameters, so every [Particles] key it reads
+	/// can be swept. Every swept key multiplies runs by the number of its values. Values are kept
+	/// as they are written, so they are parsed like [Particles] values and written back exactly.
+	runs.assign(1, SweepRun());
+	ParticlesCore::LoadParams(config, [this](const char* key, double defaultValue)
+	{
+		std::vector<std::string> values;
+		std::stringstream list(config->Get("Sweep", key, ""));
+		std::string value;
+		while (std::getline(list, value, ','))
+		{
+			size_t first	= value.find_first_not_of(" \t");
+			size_t last		= value.find_last_not_of(" \t");
+			if (first != std::string::npos)
+			{
+				values.push_back(value.substr(first, last - first + 1));
+			}
+		}
+		if (values.empty() == false)
+		{
+			keys.push_back(key);
+			std::vector<SweepRun> combinations;
+			for (size_t run = 0; run < runs.size(); run++)
+			{
+				for (size_t i = 0; i < values.size(); i++)
+				{
+					combinations.push_back(runs[run]);
+					combinations.back().values.push_back(values[i]);
+				}
+			}
+			runs.swap(combinations);
+		}
+		return config->GetReal("Particles", key, defaultValue);
+	});
+
+	/// Particles of every run are updated on the job system, the same way as in the application
+	int threadsCount = (int)config->GetInteger("System", "Threads", 0);
+	if (threadsCount <= 0)
+	{
+		threadsCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	jobs = new JobSystem();
+	jobs->Init(threadsCount, JOB_AFFINITY_NONE);
+	return true;
+}
+
+/**
+* Simulate all runs at the same time on the job system.
+*/
+void Sweep::Run()
+{
+	printf("Sweep: %d runs of %d updates on %d threads\n", (int)runs.size(), ticksCount, jobs->GetThreadsCount());
+
+	/// Every run is one task with its own results. Threads waiting for chunks of their run
+	/// help with other runs, so runs of few chunks don't leave threads idle.
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	TaskGraph runsGraph;
+	for (size_t run = 0; run < runs.size(); run++)
+	{
+		runsGraph.Add([this, run]() { Simulate(runs[run]); });
+	}
+	jobs->Run(runsGraph);
+	printf("Sweep: all runs simulated in %.3f s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+* Read the [Particles] value of the run: the swept value or the value from the ini file.
+* @param run			- the run.
+* @param key			- the [Particles] key.
+* @param defaultValue	- value of the key which isn't in the ini file.
+*/
+double Sweep::GetValue(const SweepRun& run, const char* key, double defaultValue)
+{
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		/// Parsed the same way as [Particles] values (the default when it isn't a number)
+		if (keys[i] == key)
+		{
+			const char* value = run.values[i].c_str();
+			char* end;
+			double parsed = strtod(value, &end);
+			return end > value ? parsed : defaultValue;
+		}
+	}
+	return config->GetReal("Particles", key, defaultValue);
+}
+
+/**
+* Simulate one run. It is the task of the job system, chunks of its particles are
+* updated by tasks of the same job system.
+* @param run - the run with set values, its results are filled.
+*/
+void Sweep::Simulate(SweepRun& run)
+{
+	run.particlesCount	= 0;
+	run.substeps		= 0;
+	run.seconds			= 0;
+	run.memory			= 0;
+
+	/// Swept values override [Particles], all other keys are read by the same loader as in the application
+	ParticlesCore core;
+	core.Init(ParticlesCore::LoadParams(config, [this, &run](const char* key, double defaultValue)
+	{
+		return GetValue(run, key, defaultValue);
+	}));
+	core.LoadVectorFields(config, false);
+	if (core.AllocateCPU() == false)
+	{
+		printf("Sweep: can't allocate CPU streams of %d particles, the run is skipped\n", core.GetParticlesCount());
+		return;
+	}
+	run.particlesCount	= core.GetParticlesCount();
+	run.memory			= core.GetMemorySize() / (1024.0 * 1024.0);
+
+	/// Like in the application, the CPU path takes Substeps ticks in one step. The alive
+	/// particles are sampled after the last simulated step. Only the time of chunks of this
+	/// run is counted, other runs are simulated by the same threads at the same time.
+	int stepTicks = core.GetTickSubsteps();
+	for (int tick = 0; tick < ticksCount; tick++)
+	{
+		if ((tick + 1) % stepTicks == 0)
+		{
+			core.SimulateCPU((float)(stepTicks * UPDATE_PERIOD));
+			run.substeps	+= (double)run.particlesCount * stepTicks;
+			run.seconds		+= core.GetUpdateSeconds();
+		}
+		if ((tick + 1) % sampleInterval == 0)
+		{
+			run.aliveCurve.push_back((int)core.GetUpdateStats().alive);
+		}
+	}
+}
+
+/**
+* Write results of all runs to the CSV file (one row per sample of the alive curve).
+* @returns false if the file can't be written.
+*/
+bool Sweep::Save()
+{
+	FILE* file = fopen(outputPath.c_str(), "w");
+	if (file == NULL)
+	{
+		printf("Can't write the sweep results to %s\n", outputPath.c_str());
+		return false;
+	}
+
+	/// Seconds are summed over threads updating chunks of the run, so throughput (millions of particle
+	/// substeps per second) is per thread. All runs share threads (their number is in the threads column).
+	fprintf(file, "run");
+	for (size_t key = 0; key < keys.size(); key++)
+	{
+		fprintf(file, ",%s", keys[key].c_str());
+	}
+	fprintf(file, ",threads,seconds,throughput,memory,tick,alive\n");
+	for (size_t run = 0; run < runs.size(); run++)
+	{
+		const SweepRun& result = runs[run];
+		double throughput = (result.seconds > 0) ? result.substeps / result.seconds / 1000000.0 : 0;
+		for (size_t sample = 0; sample < result.aliveCurve.size(); sample++)
+		{
+			fprintf(file, "%d", (int)run);
+			for (size_t key = 0; key < keys.size(); key++)
+			{
+				fprintf(file, ",%s", result.values[key].c_str());
+			}
+			fprintf(file, ",%d,%.6f,%.3f,%.3f,%d,%d\n", jobs->GetThreadsCount(), result.seconds, throughput, result.memory, (int)(sample + 1) * sampleInterval, result.aliveCurve[sample]);
+		}
+	}
+
+	bool isWritten = ferror(file) == 0;
+	fclose(file);
+	if (isWritten == true)
+	{
+		printf("Sweep: results of %d runs written to %s\n", (int)runs.size(), outputPath.c_str());
+	}
+	return isWritten;
+}
+
+/**
+* Simple destructor.
+*/
+Sweep::~Sweep()
+{
+	delete jobs;
+	delete config;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a parameter sweep class. It runs headless simulations of the CPU particles
+* path for every combination of values listed in the [Sweep] section and writes throughput,
+* the curve of alive particles and memory of every run to one CSV file. Every run is the
+* particles core (ParticlesCore) read by the same loader as in the application, swept keys
+* only override [Particles], so results match the production config. Runs are simulated at
+* the same time: every run is one task of the job system and chunks of its particles are
+* tasks too, so small runs fill all threads together and big runs spread over all of them.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <string>
+#include <vector>
+
+class INIReader;
+class JobSystem;
+
+/**
+* One simulation of the sweep: its parameters and results.
+*/
+struct SweepRun
+{
+	std::vector<std::string> values;	///< Values of swept keys as written in [Sweep] (in order of Sweep::keys).
+	int particlesCount;				///< Number of particles of the run.
+	double substeps;				///< Particle substeps simulated in the run.
+	double seconds;					///< Time threads spent updating chunks of the run (summed over threads).
+	double memory;					///< Memory of both particle streams in megabytes.
+	std::vector<int> aliveCurve;	///< Alive particles after every sampleInterval-th update.
+};
+
+class Sweep
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	Sweep();
+	~Sweep();
+
+	/**
+	* Read the configuration and build runs from all combinations of swept values.
+	* Keys of [Sweep] with the names of [Particles] keys list values separated with commas.
+	* @param configPath - path to the configuration ini file.
+	* @returns false if the configuration can't be read.
+	*/
+	bool Init(const char* configPath);
+
+	/**
+	* Simulate all runs at the same time on the job system.
+	*/
+	void Run();
+
+	/**
+	* Write results of all runs to the CSV file (one row per sample of the alive curve).
+	* @returns false if the file can't be written.
+	*/
+	bool Save();
+
+private:
+	/**
+	* Simulate one run. It is the task of the job system, chunks of its particles are
+	* updated by tasks of the same job system.
+	* @param run - the run with set values, its results are filled.
+	*/
+	void Simulate(SweepRun& run);
+
+	/**
+	* Read the [Particles] value of the run: the swept value or the value from the ini file.
+	* @param run			- the run.
+	* @param key			- the [Particles] key.
+	* @param defaultValue	- value of the key which isn't in the ini file.
+	*/
+	double GetValue(const SweepRun& run, const char* key, double defaultValue);
+
+	INIReader* config;				///< The configuration ini file reader.
+	JobSystem* jobs;				///< Job system simulating particles of every run.
+	std::vector<std::string> keys;	///< [Particles] keys with values listed in [Sweep].
+	std::vector<SweepRun> runs;		///< All combinations of swept values.
+	int ticksCount;					///< How many updates every run takes.
+	int sampleInterval;				///< Every which update the alive particles are sampled.
+	std::string outputPath;			///< Path of the CSV file.
+};
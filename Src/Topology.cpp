@@ -0,0 +1,138 @@
+/**
+* GPU Particles example.
+*
+* This is a CPU topology class. It finds NUMA nodes of the machine and logical
+* CPUs belonging to them, and pins threads to chosen CPUs.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Topology.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+/**
+* Find NUMA nodes and their CPUs.
+*/
+void Topology::Detect()
+{
+	nodeCpus.clear();
+
+#ifdef _WIN32
+	/// Every node has the mask of its processors (in the first processor group)
+	ULONG highestNode = 0;
+	if (GetNumaHighestNodeNumber(&highestNode) != FALSE)
+	{
+		for (ULONG node = 0; node <= highestNode; node++)
+		{
+			ULONGLONG mask = 0;
+			std::vector<int> cpus;
+			if (GetNumaNodeProcessorMask((UCHAR)node, &mask) != FALSE)
+			{
+				for (int cpu = 0; cpu < 64; cpu++)
+				{
+					if ((mask >> cpu) & 1)
+					{
+						cpus.push_back(cpu);
+					}
+				}
+			}
+			if (cpus.empty() == false)
+			{
+				nodeCpus.push_back(cpus);
+			}
+		}
+	}
+#elif defined(__linux__)
+	/// Online nodes are listed as ranges, like "0,2-3" (their ids can have gaps),
+	/// and every node lists its CPUs the same way, like "0-7,16-23"
+	std::vector<int> nodes = ReadList("/sys/devices/system/node/online");
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		std::vector<int> cpus = ReadList("/sys/devices/system/node/node" + std::to_string(nodes[i]) + "/cpulist");
+		if (cpus.empty() == false)
+		{
+			nodeCpus.push_back(cpus);
+		}
+	}
+#endif
+
+	/// Without the topology all CPUs are one node
+	if (nodeCpus.empty() == true)
+	{
+		int cpusCount = (int)std::thread::hardware_concurrency();
+		nodeCpus.push_back(std::vector<int>());
+		for (int cpu = 0; cpu < (cpusCount > 0 ? cpusCount : 1); cpu++)
+		{
+			nodeCpus[0].push_back(cpu);
+		}
+	}
+}
+
+/**
+* Read the list of ranges, like "0-7,16-23", from the system file.
+* @param path - path to the file.
+* @returns all numbers of the list (empty if the file can't be read).
+*/
+std::vector<int> Topology::ReadList(const std::string& path)
+{
+	std::vector<int> numbers;
+	std::ifstream file(path);
+	std::string list;
+	if (file.is_open() == false || std::getline(file, list).fail() == true)
+	{
+		return numbers;
+	}
+
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ','))
+	{
+		int first = 0;
+		int last = 0;
+		int count = sscanf(range.c_str(), "%d-%d", &first, &last);
+		if (count < 1)
+		{
+			continue;
+		}
+		if (count == 1)
+		{
+			last = first;
+		}
+		for (int number = first; number <= last; number++)
+		{
+			numbers.push_back(number);
+		}
+	}
+	return numbers;
+}
+
+/**
+* Pin the calling thread to the logical CPU.
+* @param cpu - index of the logical CPU.
+* @returns true if the thread was pinned.
+*/
+bool Topology::PinCurrentThread(int cpu)
+{
+#ifdef _WIN32
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#else
+	return false;
+#endif
+}
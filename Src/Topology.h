@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a CPU topology class. It finds NUMA nodes of the machine and logical
+* CPUs belonging to them, and pins threads to chosen CPUs. When the topology can't
+* be read, all CPUs are reported as one node.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <string>
+#include <vector>
+
+class Topology
+{
+public:
+	/**
+	* Find NUMA nodes and their CPUs.
+	*/
+	void Detect();
+
+	/**
+	* Get the number of NUMA nodes (at least 1).
+	*/
+	int GetNodesCount() { return (int)nodeCpus.size(); }
+
+	/**
+	* Get logical CPUs of the NUMA node.
+	* @param node - index of the node.
+	*/
+	const std::vector<int>& GetNodeCpus(int node) { return nodeCpus[node]; }
+
+	/**
+	* Pin the calling thread to the logical CPU.
+	* @param cpu - index of the logical CPU.
+	* @returns true if the thread was pinned.
+	*/
+	static bool PinCurrentThread(int cpu);
+
+private:
+	/**
+	* Read the list of ranges, like "0-7,16-23", from the system file.
+	* @param path - path to the file.
+	* @returns all numbers of the list (empty if the file can't be read).
+	*/
+	static std::vector<int> ReadList(const std::string& path);
+
+	std::vector<std::vector<int>> nodeCpus;	///< Logical CPUs of every NUMA node.
+};
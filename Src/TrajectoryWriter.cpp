@@ -0,0 +1,412 @@
+/**
+* GPU Particles example.
+*
+* This is a trajectory writer class. It streams particles positions, colors and
+* life time of chosen ticks into the chunked binary file. Frames are encoded and
+* written on the background thread, so the simulation is never waiting for the disk.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "TrajectoryWriter.h"
+
+#include <cstdio>
+#include <cstring>
+
+/**
+* Encode bytes using zero bytes run length encoding.
+* Control byte 0..127 means that 1..128 literal bytes follow it,
+* control byte 128..255 means a run of 2..129 zero bytes.
+* @param in		- data to encode.
+* @param size	- size of data to encode.
+* @param out	- buffer to which encoded data is appended.
+*/
+static void EncodeZeroRuns(const uint8_t* in, size_t size, std::vector<uint8_t>& out)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		// Count zeroes, runs shorter than two bytes are cheaper as literals
+		size_t run = 0;
+		while (i + run < size && in[i + run] == 0 && run < 129)
+		{
+			run++;
+		}
+		if (run >= 2)
+		{
+			out.push_back((uint8_t)(126 + run));
+			i += run;
+			continue;
+		}
+
+		// Copy literals until the next zeroes run
+		size_t start = i;
+		while (i < size && i - start < 128 && (in[i] != 0 || i + 1 >= size || in[i + 1] != 0))
+		{
+			i++;
+		}
+		out.push_back((uint8_t)(i - start - 1));
+		out.insert(out.end(), in + start, in + i);
+	}
+}
+
+/**
+* Decode bytes encoded with EncodeZeroRuns.
+* @param in		- encoded data.
+* @param inSize	- size of encoded data.
+* @param out	- buffer for decoded data.
+* @param outSize- expected size of decoded data.
+* @returns true if the data was decoded to exactly outSize bytes.
+*/
+static bool DecodeZeroRuns(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize)
+{
+	size_t i = 0;
+	size_t o = 0;
+	while (i < inSize)
+	{
+		uint8_t control = in[i++];
+		if (control < 128)
+		{
+			size_t count = (size_t)control + 1;
+			if (i + count > inSize || o + count > outSize)
+			{
+				return false;
+			}
+			memcpy(out + o, in + i, count);
+			i += count;
+			o += count;
+		}
+		else
+		{
+			size_t count = (size_t)control - 126;
+			if (o + count > outSize)
+			{
+				return false;
+			}
+			memset(out + o, 0, count);
+			o += count;
+		}
+	}
+	return o == outSize;
+}
+
+/**
+* Simple constructor
+*/
+TrajectoryWriter::TrajectoryWriter()
+{
+	header				= TrajectoryHeader();
+	chunkFramesCount	= 0;
+	stopping			= false;
+	droppedFrames		= 0;
+	encodedBytes		= 0;
+}
+
+/**
+* Open the trajectory file and start the writer thread.
+* @param path			- path to the trajectory file.
+* @param particlesCount	- number of particles in every frame.
+* @param tickInterval	- every which update tick the frame is captured (stored in header).
+* @param framesPerChunk	- maximum number of frames in one chunk.
+* @param queueSize		- number of frame buffers waiting for writing. When all are
+*						  busy new frames are dropped instead of waiting.
+* @returns true if the file was opened.
+*/
+bool TrajectoryWriter::Open(const char* path, int particlesCount, int tickInterval, int framesPerChunk, int queueSize)
+{
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (file.is_open() == false)
+	{
+		printf("Can't open the trajectory file: %s\n", path);
+		return false;
+	}
+
+	header.magic			= TRAJECTORY_MAGIC;
+	header.version			= TRAJECTORY_VERSION;
+	header.particlesCount	= (uint32_t)particlesCount;
+	header.particleSize		= TRAJECTORY_PARTICLE_SIZE;
+	header.framesPerChunk	= (uint32_t)(framesPerChunk > 0 ? framesPerChunk : 1);
+	header.tickInterval		= (uint32_t)tickInterval;
+
+	// Write the header now, it will be rewritten with final values when closing
+	file.write((const char*)&header, sizeof(TrajectoryHeader));
+
+	/// Prepare all buffers at once, so nothing will be allocated while streaming
+	size_t frameSize = (size_t)particlesCount * TRAJECTORY_PARTICLE_SIZE;
+	frames.resize(queueSize > 0 ? queueSize : 1);
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		frames[i].resize(frameSize);
+		freeFrames.push_back((int)i);
+	}
+	previousFrame.resize(frameSize);
+	shuffledFrame.resize(frameSize * sizeof(uint32_t));
+
+	stopping = false;
+	thread = std::thread(&TrajectoryWriter::WriterThread, this);
+
+	return true;
+}
+
+/**
+* Write all queued frames, the index, stop the writer thread and close the file.
+*/
+void TrajectoryWriter::Close()
+{
+	if (thread.joinable() == false)
+	{
+		return;
+	}
+
+	// Let the writer thread finish the queue
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_one();
+	thread.join();
+
+	// Write the last chunk, the index and update the header
+	WriteChunk();
+	header.indexOffset = (uint64_t)file.tellp();
+	header.chunksCount = index.size();
+	file.write((const char*)index.data(), index.size() * sizeof(TrajectoryIndexEntry));
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(TrajectoryHeader));
+	file.close();
+
+	uint64_t rawBytes = header.framesCount * header.particlesCount * TRAJECTORY_PARTICLE_SIZE * sizeof(float);
+	printf("Trajectory: %llu frames written (%llu dropped), %llu MB encoded from %llu MB\n",
+		(unsigned long long)header.framesCount, (unsigned long long)droppedFrames,
+		(unsigned long long)(encodedBytes >> 20), (unsigned long long)(rawBytes >> 20));
+}
+
+/**
+* Get the free frame buffer for filling.
+* @returns the slot of the frame buffer or -1 if the queue is full (frame is dropped).
+*/
+int TrajectoryWriter::AcquireFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (freeFrames.empty() == true)
+	{
+		droppedFrames++;
+		return -1;
+	}
+	int slot = freeFrames.front();
+	freeFrames.pop_front();
+	return slot;
+}
+
+/**
+* Queue the filled frame buffer for writing.
+* @param slot - the slot returned by AcquireFrame.
+* @param tick - update tick in which the frame was captured.
+*/
+void TrajectoryWriter::SubmitFrame(int slot, uint64_t tick)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queuedFrames.push_back(std::make_pair(slot, tick));
+	}
+	condition.notify_one();
+}
+
+/**
+* Main function of the writer thread. Encodes and writes queued frames.
+*/
+void TrajectoryWriter::WriterThread()
+{
+	while (true)
+	{
+		std::pair<int, uint64_t> queued;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping == true || queuedFrames.empty() == false; });
+			if (queuedFrames.empty() == true)
+			{
+				return;
+			}
+			queued = queuedFrames.front();
+			queuedFrames.pop_front();
+		}
+
+		EncodeFrame(queued.first, queued.second);
+
+		// The frame buffer can be filled again
+		std::lock_guard<std::mutex> lock(mutex);
+		freeFrames.push_back(queued.first);
+	}
+}
+
+/**
+* Encode the frame into the current chunk. Writes the chunk when it is full.
+* @param slot - the slot of the frame buffer.
+* @param tick - update tick in which the frame was captured.
+*/
+void TrajectoryWriter::EncodeFrame(int slot, uint64_t tick)
+{
+	const uint32_t* current = (const uint32_t*)frames[slot].data();
+	size_t wordsCount = frames[slot].size();
+
+	// The first frame of the chunk is encoded against zeroes
+	if (chunkFramesCount == 0)
+	{
+		std::fill(previousFrame.begin(), previousFrame.end(), 0);
+	}
+
+	/// Xor with the previous frame (unchanged values become zeroes) and split words into
+	/// byte planes, so similar high bytes of neighbouring values form long zero runs.
+	for (size_t i = 0; i < wordsCount; i++)
+	{
+		uint32_t delta = current[i] ^ previousFrame[i];
+		shuffledFrame[i]					= (uint8_t)(delta);
+		shuffledFrame[i + wordsCount]		= (uint8_t)(delta >> 8);
+		shuffledFrame[i + wordsCount * 2]	= (uint8_t)(delta >> 16);
+		shuffledFrame[i + wordsCount * 3]	= (uint8_t)(delta >> 24);
+		previousFrame[i] = current[i];
+	}
+
+	/// Append the frame header and encoded data to the current chunk. The header is
+	/// filled after encoding, when the size is known.
+	size_t headerOffset = chunkData.size();
+	chunkData.resize(headerOffset + sizeof(TrajectoryFrameHeader));
+	EncodeZeroRuns(shuffledFrame.data(), shuffledFrame.size(), chunkData);
+
+	TrajectoryFrameHeader frameHeader;
+	frameHeader.tick		= tick;
+	frameHeader.encodedSize	= chunkData.size() - headerOffset - sizeof(TrajectoryFrameHeader);
+	memcpy(chunkData.data() + headerOffset, &frameHeader, sizeof(TrajectoryFrameHeader));
+
+	encodedBytes += frameHeader.encodedSize;
+	chunkFramesCount++;
+
+	if (chunkFramesCount == header.framesPerChunk)
+	{
+		WriteChunk();
+	}
+}
+
+/**
+* Write the current chunk to the file and add it to the index.
+*/
+void TrajectoryWriter::WriteChunk()
+{
+	if (chunkFramesCount == 0)
+	{
+		return;
+	}
+
+	TrajectoryIndexEntry entry;
+	entry.offset		= (uint64_t)file.tellp();
+	entry.firstFrame	= header.framesCount;
+	entry.framesCount	= chunkFramesCount;
+	index.push_back(entry);
+
+	TrajectoryChunkHeader chunkHeader;
+	chunkHeader.magic		= TRAJECTORY_CHUNK_MAGIC;
+	chunkHeader.framesCount	= chunkFramesCount;
+	chunkHeader.dataSize	= chunkData.size();
+	file.write((const char*)&chunkHeader, sizeof(TrajectoryChunkHeader));
+	file.write((const char*)chunkData.data(), chunkData.size());
+
+	header.framesCount += chunkFramesCount;
+	chunkFramesCount = 0;
+	chunkData.clear();
+}
+
+/**
+* Read one frame from the closed trajectory file. Only the chunk with the frame is read.
+* @param path		- path to the trajectory file.
+* @param frameIndex	- number of the frame to read.
+* @param frame		- output particles data (particlesCount * particleSize floats).
+* @param tick		- output update tick of the frame.
+* @returns true if the frame was read.
+*/
+bool TrajectoryWriter::ReadFrame(const char* path, uint64_t frameIndex, std::vector<float>& frame, uint64_t& tick)
+{
+	std::ifstream input(path, std::ios::binary);
+	TrajectoryHeader fileHeader;
+	if (input.read((char*)&fileHeader, sizeof(TrajectoryHeader)).good() == false ||
+		fileHeader.magic != TRAJECTORY_MAGIC ||
+		fileHeader.version != TRAJECTORY_VERSION ||
+		fileHeader.indexOffset == 0)
+	{
+		printf("Invalid trajectory file: %s\n", path);
+		return false;
+	}
+	if (frameIndex >= fileHeader.framesCount)
+	{
+		return false;
+	}
+
+	/// Find the chunk with the frame in the index
+	std::vector<TrajectoryIndexEntry> fileIndex((size_t)fileHeader.chunksCount);
+	input.seekg((std::streamoff)fileHeader.indexOffset);
+	input.read((char*)fileIndex.data(), fileIndex.size() * sizeof(TrajectoryIndexEntry));
+
+	size_t chunk = 0;
+	while (chunk < fileIndex.size() && fileIndex[chunk].firstFrame + fileIndex[chunk].framesCount <= frameIndex)
+	{
+		chunk++;
+	}
+	if (chunk == fileIndex.size())
+	{
+		return false;
+	}
+
+	/// Read the whole chunk
+	TrajectoryChunkHeader chunkHeader;
+	input.seekg((std::streamoff)fileIndex[chunk].offset);
+	input.read((char*)&chunkHeader, sizeof(TrajectoryChunkHeader));
+	if (chunkHeader.magic != TRAJECTORY_CHUNK_MAGIC)
+	{
+		printf("Invalid trajectory chunk in file: %s\n", path);
+		return false;
+	}
+	std::vector<uint8_t> data((size_t)chunkHeader.dataSize);
+	if (input.read((char*)data.data(), data.size()).good() == false)
+	{
+		return false;
+	}
+
+	/// Decode frames from the beginning of the chunk up to the asked one,
+	/// because every frame is a delta of the previous one.
+	size_t wordsCount = (size_t)fileHeader.particlesCount * fileHeader.particleSize;
+	std::vector<uint32_t> words(wordsCount, 0);
+	std::vector<uint8_t> shuffled(wordsCount * sizeof(uint32_t));
+	size_t offset = 0;
+	for (uint64_t i = fileIndex[chunk].firstFrame; i <= frameIndex; i++)
+	{
+		TrajectoryFrameHeader frameHeader;
+		memcpy(&frameHeader, data.data() + offset, sizeof(TrajectoryFrameHeader));
+		offset += sizeof(TrajectoryFrameHeader);
+		if (DecodeZeroRuns(data.data() + offset, (size_t)frameHeader.encodedSize, shuffled.data(), shuffled.size()) == false)
+		{
+			printf("Corrupted trajectory frame in file: %s\n", path);
+			return false;
+		}
+		offset += (size_t)frameHeader.encodedSize;
+
+		for (size_t w = 0; w < wordsCount; w++)
+		{
+			words[w] ^=	(uint32_t)shuffled[w] |
+						((uint32_t)shuffled[w + wordsCount] << 8) |
+						((uint32_t)shuffled[w + wordsCount * 2] << 16) |
+						((uint32_t)shuffled[w + wordsCount * 3] << 24);
+		}
+		tick = frameHeader.tick;
+	}
+
+	frame.resize(wordsCount);
+	memcpy(frame.data(), words.data(), wordsCount * sizeof(uint32_t));
+	return true;
+}
+
+/**
+* Simple destructor closing the file.
+*/
+TrajectoryWriter::~TrajectoryWriter()
+{
+	Close();
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a trajectory writer class. It streams particles positions, colors and
+* life time of chosen ticks into the chunked binary file. Frames are encoded and
+* written on the background thread, so the simulation is never waiting for the disk.
+*
+* File layout:
+* - TrajectoryHeader (rewritten with final counters and index offset when closed).
+* - Chunks: TrajectoryChunkHeader followed by framesCount frames. Every frame is
+*   TrajectoryFrameHeader followed by encoded data. The first frame of a chunk is
+*   encoded against zeroes, every other against the previous frame (xor of float bits),
+*   so only the chunk has to be read to decode any of its frames.
+* - Index: chunksCount TrajectoryIndexEntry, used to seek the chunk of any frame.
+*
+* Frame encoding: xor delta -> byte planes shuffle -> zero bytes run length encoding.
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Define the number of floats stored for one particle (position xyz, color rgba, life time)
+#define TRAJECTORY_PARTICLE_SIZE	8
+
+// Define the magic numbers of the trajectory file ("GPTR") and its chunks ("CHNK")
+#define TRAJECTORY_MAGIC			0x52545047
+#define TRAJECTORY_CHUNK_MAGIC		0x4B4E4843
+
+// Define the version of the trajectory file format
+#define TRAJECTORY_VERSION			1
+
+/**
+* Header stored at the beginning of the trajectory file.
+*/
+struct TrajectoryHeader
+{
+	uint32_t magic;					///< Must be TRAJECTORY_MAGIC.
+	uint32_t version;				///< Must be TRAJECTORY_VERSION.
+	uint32_t particlesCount;		///< Number of particles in every frame.
+	uint32_t particleSize;			///< Number of floats of one particle in frame.
+	uint32_t framesPerChunk;		///< Maximum number of frames in one chunk.
+	uint32_t tickInterval;			///< Every which update tick the frame was captured.
+	uint64_t framesCount;			///< Number of frames in the file.
+	uint64_t chunksCount;			///< Number of chunks in the file.
+	uint64_t indexOffset;			///< Offset of the chunks index (0 if file wasn't closed properly).
+};
+
+/**
+* Header stored at the beginning of every chunk.
+*/
+struct TrajectoryChunkHeader
+{
+	uint32_t magic;					///< Must be TRAJECTORY_CHUNK_MAGIC.
+	uint32_t framesCount;			///< Number of frames in this chunk.
+	uint64_t dataSize;				///< Size in bytes of all frames in this chunk.
+};
+
+/**
+* Header stored before every encoded frame.
+*/
+struct TrajectoryFrameHeader
+{
+	uint64_t tick;					///< Update tick in which the frame was captured.
+	uint64_t encodedSize;			///< Size in bytes of the encoded frame data.
+};
+
+/**
+* One entry of the chunks index.
+*/
+struct TrajectoryIndexEntry
+{
+	uint64_t offset;				///< Offset of the chunk from the beginning of the file.
+	uint64_t firstFrame;			///< Number of the first frame in this chunk.
+	uint64_t framesCount;			///< Number of frames in this chunk.
+};
+
+class TrajectoryWriter
+{
+public:
+	/**
+	* Simple constructor and destructor. Destructor closes the file.
+	*/
+	TrajectoryWriter();
+	~TrajectoryWriter();
+
+	/**
+	* Open the trajectory file and start the writer thread.
+	* @param path			- path to the trajectory file.
+	* @param particlesCount	- number of particles in every frame.
+	* @param tickInterval	- every which update tick the frame is captured (stored in header).
+	* @param framesPerChunk	- maximum number of frames in one chunk.
+	* @param queueSize		- number of frame buffers waiting for writing. When all are
+	*						  busy new frames are dropped instead of waiting.
+	* @returns true if the file was opened.
+	*/
+	bool Open(const char* path, int particlesCount, int tickInterval, int framesPerChunk, int queueSize);
+
+	/**
+	* Write all queued frames, the index, stop the writer thread and close the file.
+	*/
+	void Close();
+
+	/**
+	* Get the free frame buffer for filling.
+	* @returns the slot of the frame buffer or -1 if the queue is full (frame is dropped).
+	*/
+	int AcquireFrame();
+
+	/**
+	* Get the data of the frame buffer (particlesCount * TRAJECTORY_PARTICLE_SIZE floats).
+	* @param slot - the slot returned by AcquireFrame.
+	*/
+	float* GetFrame(int slot) { return frames[slot].data(); }
+
+	/**
+	* Queue the filled frame buffer for writing.
+	* @param slot - the slot returned by AcquireFrame.
+	* @param tick - update tick in which the frame was captured.
+	*/
+	void SubmitFrame(int slot, uint64_t tick);
+
+	/**
+	* Read one frame from the closed trajectory file. Only the chunk with the frame is read.
+	* @param path		- path to the trajectory file.
+	* @param frameIndex	- number of the frame to read.
+	* @param frame		- output particles data (particlesCount * particleSize floats).
+	* @param tick		- output update tick of the frame.
+	* @returns true if the frame was read.
+	*/
+	static bool ReadFrame(const char* path, uint64_t frameIndex, std::vector<float>& frame, uint64_t& tick);
+
+private:
+	/**
+	* Main function of the writer thread. Encodes and writes queued frames.
+	*/
+	void WriterThread();
+
+	/**
+	* Encode the frame into the current chunk. Writes the chunk when it is full.
+	* @param slot - the slot of the frame buffer.
+	* @param tick - update tick in which the frame was captured.
+	*/
+	void EncodeFrame(int slot, uint64_t tick);
+
+	/**
+	* Write the current chunk to the file and add it to the index.
+	*/
+	void WriteChunk();
+
+	std::ofstream file;							///< The trajectory file.
+	TrajectoryHeader header;					///< Header of the file (updated when closing).
+
+	std::vector<std::vector<float>> frames;		///< Frame buffers filled by the simulation.
+	std::deque<int> freeFrames;					///< Slots of frame buffers ready for filling.
+	std::deque<std::pair<int, uint64_t>> queuedFrames;	///< Slots and ticks of frames waiting for writing.
+
+	std::vector<uint32_t> previousFrame;		///< Previous frame in the current chunk (delta base).
+	std::vector<uint8_t> shuffledFrame;			///< Scratch buffer for the byte planes.
+	std::vector<uint8_t> chunkData;				///< Encoded frames of the current chunk.
+	uint32_t chunkFramesCount;					///< Number of frames in the current chunk.
+	std::vector<TrajectoryIndexEntry> index;	///< Index of all written chunks.
+
+	std::thread thread;							///< The writer thread.
+	std::mutex mutex;							///< Guards the frames queues and stopping flag.
+	std::condition_variable condition;			///< Wakes the writer thread.
+	bool stopping;								///< Tells the writer thread to finish.
+
+	uint64_t droppedFrames;						///< Frames dropped because the queue was full.
+	uint64_t encodedBytes;						///< Size of all encoded frames (for statistics).
+};
@@ -0,0 +1,170 @@
+/**
+* GPU Particles example.
+*
+* This is a vector field class. It loads the dense 3D grid of vectors from the binary
+* file and applies it to particles inside its bounds, either as a force (acceleration)
+* or as a velocity which particles are pulled to (like the wind).
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "VectorField.h"
+
+#include <cstdio>
+#include <fstream>
+
+// Use SSE for sampling when it is available, it is always available on x64.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define VECTOR_FIELD_SSE
+	#include <xmmintrin.h>
+#endif
+
+/**
+* Simple constructor
+*/
+VectorField::VectorField()
+{
+	strength	= 1.f;
+	type		= VECTOR_FIELD_FORCE;
+	size		= glm::ivec3(0);
+	texture		= 0;
+	SetBounds(glm::vec3(-1.f), glm::vec3(1.f));
+}
+
+/**
+* Set the box in the world in which the field is applied.
+* @param min - minimum corner of the box.
+* @param max - maximum corner of the box.
+*/
+void VectorField::SetBounds(const glm::vec3& min, const glm::vec3& max)
+{
+	boundsMin			= min;
+	boundsMax			= max;
+	inverseBoundsSize	= 1.f / glm::max(max - min, glm::vec3(0.0001f));
+}
+
+/**
+* Load the field from the binary file.
+* @param path			- path to the vector field file.
+* @param createTexture	- true if the 3D texture for the GPU path has to be created.
+* @returns true if the field was loaded.
+*/
+bool VectorField::Load(const char* path, bool createTexture)
+{
+	std::ifstream file(path, std::ios::binary);
+	VectorFieldHeader header;
+	if (file.read((char*)&header, sizeof(VectorFieldHeader)).good() == false ||
+		header.magic != VECTOR_FIELD_MAGIC ||
+		header.version != VECTOR_FIELD_VERSION ||
+		header.size[0] == 0 || header.size[1] == 0 || header.size[2] == 0)
+	{
+		printf("Invalid vector field file: %s\n", path);
+		return false;
+	}
+
+	size = glm::ivec3(header.size[0], header.size[1], header.size[2]);
+	size_t pointsCount = (size_t)size.x * size.y * size.z;
+
+	/// Read vectors and pad every one to four floats
+	std::vector<float> vectors(pointsCount * 3);
+	if (file.read((char*)vectors.data(), vectors.size() * sizeof(float)).good() == false)
+	{
+		printf("Vector field file is too short: %s\n", path);
+		return false;
+	}
+	data.assign(pointsCount * 4, 0.f);
+	for (size_t i = 0; i < pointsCount; i++)
+	{
+		data[i * 4 + 0] = vectors[i * 3 + 0];
+		data[i * 4 + 1] = vectors[i * 3 + 1];
+		data[i * 4 + 2] = vectors[i * 3 + 2];
+	}
+
+	/// The texture uses linear filtering and clamping to the edge, so the hardware
+	/// fetch gives the same values as the CPU sampler.
+	if (createTexture == true)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_3D, texture);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, size.x, size.y, size.z, 0, GL_RGBA, GL_FLOAT, data.data());
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+
+	return true;
+}
+
+/**
+* Sample the field with trilinear filtering. Grid points lie in texel centers and
+* coordinates are clamped to the edge, the same as the linear 3D texture fetch.
+* @param uvw	- normalized coordinates in the field bounds <0;1>.
+* @param value	- sampled vector (four floats, the last one is always 0).
+*/
+void VectorField::Sample(const glm::vec3& uvw, float* value) const
+{
+	/// Find the grid cell and the position inside it
+	glm::vec3 coordinates	= glm::clamp(uvw * glm::vec3(size) - 0.5f, glm::vec3(0.f), glm::vec3(size - 1));
+	glm::ivec3 cell0		= glm::ivec3(coordinates);
+	glm::ivec3 cell1		= glm::min(cell0 + 1, size - 1);
+	glm::vec3 fraction		= coordinates - glm::vec3(cell0);
+
+	// Offsets of the cell corners in floats
+	size_t x0 = (size_t)cell0.x * 4;
+	size_t x1 = (size_t)cell1.x * 4;
+	size_t y0 = (size_t)cell0.y * size.x * 4;
+	size_t y1 = (size_t)cell1.y * size.x * 4;
+	size_t z0 = (size_t)cell0.z * size.x * size.y * 4;
+	size_t z1 = (size_t)cell1.z * size.x * size.y * 4;
+	const float* points = data.data();
+
+#ifdef VECTOR_FIELD_SSE
+	/// Every corner is one load of all channels, so the whole interpolation
+	/// is seven lerps of four floats at once.
+	__m128 fx = _mm_set1_ps(fraction.x);
+	__m128 fy = _mm_set1_ps(fraction.y);
+	__m128 fz = _mm_set1_ps(fraction.z);
+
+	__m128 c000 = _mm_loadu_ps(points + x0 + y0 + z0);
+	__m128 c100 = _mm_loadu_ps(points + x1 + y0 + z0);
+	__m128 c010 = _mm_loadu_ps(points + x0 + y1 + z0);
+	__m128 c110 = _mm_loadu_ps(points + x1 + y1 + z0);
+	__m128 c001 = _mm_loadu_ps(points + x0 + y0 + z1);
+	__m128 c101 = _mm_loadu_ps(points + x1 + y0 + z1);
+	__m128 c011 = _mm_loadu_ps(points + x0 + y1 + z1);
+	__m128 c111 = _mm_loadu_ps(points + x1 + y1 + z1);
+
+	__m128 c00 = _mm_add_ps(c000, _mm_mul_ps(_mm_sub_ps(c100, c000), fx));
+	__m128 c10 = _mm_add_ps(c010, _mm_mul_ps(_mm_sub_ps(c110, c010), fx));
+	__m128 c01 = _mm_add_ps(c001, _mm_mul_ps(_mm_sub_ps(c101, c001), fx));
+	__m128 c11 = _mm_add_ps(c011, _mm_mul_ps(_mm_sub_ps(c111, c011), fx));
+
+	__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), fy));
+	__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), fy));
+
+	_mm_storeu_ps(value, _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), fz)));
+#else
+	for (int i = 0; i < 4; i++)
+	{
+		float c00 = glm::mix(points[x0 + y0 + z0 + i], points[x1 + y0 + z0 + i], fraction.x);
+		float c10 = glm::mix(points[x0 + y1 + z0 + i], points[x1 + y1 + z0 + i], fraction.x);
+		float c01 = glm::mix(points[x0 + y0 + z1 + i], points[x1 + y0 + z1 + i], fraction.x);
+		float c11 = glm::mix(points[x0 + y1 + z1 + i], points[x1 + y1 + z1 + i], fraction.x);
+		value[i] = glm::mix(glm::mix(c00, c10, fraction.y), glm::mix(c01, c11, fraction.y), fraction.z);
+	}
+#endif
+}
+
+/**
+* Simple destructor clearing all data.
+*/
+VectorField::~VectorField()
+{
+	if (texture != 0)
+	{
+		glDeleteTextures(1, &texture);
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/**
+* GPU Particles example.
+*
+* This is a vector field class. It loads the dense 3D grid of vectors from the binary
+* file and applies it to particles inside its bounds, either as a force (acceleration)
+* or as a velocity which particles are pulled to (like the wind).
+* On the CPU path the field is sampled with the SIMD trilinear sampler, on the GPU path
+* it is uploaded to the 3D texture and fetched in the update shader.
+*
+* File layout:
+* - VectorFieldHeader.
+* - sizeX * sizeY * sizeZ vectors of three floats (x changes fastest, then y, then z).
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include <GL/glew.h>
+#include <GLM/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Define the maximum number of vector fields (must match MAX_VECTOR_FIELDS in point_update_vs.glsl)
+#define VECTOR_FIELDS_MAX		4
+
+// Define the magic number at the beginning of every vector field file ("GPVF")
+#define VECTOR_FIELD_MAGIC		0x46565047
+
+// Define the version of the vector field file format
+#define VECTOR_FIELD_VERSION	1
+
+/**
+* Header stored at the beginning of every vector field file.
+*/
+struct VectorFieldHeader
+{
+	uint32_t magic;				///< Must be VECTOR_FIELD_MAGIC.
+	uint32_t version;			///< Must be VECTOR_FIELD_VERSION.
+	uint32_t size[3];			///< Number of grid points in every axis.
+};
+
+/**
+* How the sampled vector changes the particle velocity.
+*/
+enum VectorFieldType
+{
+	VECTOR_FIELD_FORCE		= 0,	///< Vector is an acceleration added to the velocity.
+	VECTOR_FIELD_VELOCITY	= 1		///< Velocity is pulled to the vector (strength is the pull rate).
+};
+
+class VectorField
+{
+public:
+	/**
+	* Simple constructor and destructor.
+	*/
+	VectorField();
+	~VectorField();
+
+	float strength;				///< Multiplier of the sampled vector.
+	VectorFieldType type;		///< How the sampled vector changes the particle velocity.
+
+	/**
+	* Set the box in the world in which the field is applied.
+	* @param min - minimum corner of the box.
+	* @param max - maximum corner of the box.
+	*/
+	void SetBounds(const glm::vec3& min, const glm::vec3& max);
+
+	/**
+	* Get the minimum corner of the field bounds.
+	*/
+	glm::vec3 GetBoundsMin() { return boundsMin; }
+
+	/**
+	* Get the maximum corner of the field bounds.
+	*/
+	glm::vec3 GetBoundsMax() { return boundsMax; }
+
+	/**
+	* Load the field from the binary file.
+	* @param path			- path to the vector field file.
+	* @param createTexture	- true if the 3D texture for the GPU path has to be created.
+	* @returns true if the field was loaded.
+	*/
+	bool Load(const char* path, bool createTexture);
+
+	/**
+	* Get the 3D texture of this field (0 if it wasn't created).
+	*/
+	GLuint GetTexture() { return texture; }
+
+	/**
+	* Apply the field to the particle, if the particle is inside the field bounds.
+	* @param position	- position of the particle (three floats).
+	* @param velocity	- velocity of the particle (three floats), updated here.
+	* @param deltaTime	- the portion of time thas passed from previous update.
+	*/
+	void Apply(const float* position, float* velocity, float deltaTime) const
+	{
+		glm::vec3 uvw = (glm::vec3(position[0], position[1], position[2]) - boundsMin) * inverseBoundsSize;
+		if (uvw.x < 0 || uvw.y < 0 || uvw.z < 0 || uvw.x > 1 || uvw.y > 1 || uvw.z > 1)
+		{
+			return;
+		}
+
+		float value[4];
+		Sample(uvw, value);
+
+		if (type == VECTOR_FIELD_FORCE)
+		{
+			float scale = strength * deltaTime;
+			velocity[0] += value[0] * scale;
+			velocity[1] += value[1] * scale;
+			velocity[2] += value[2] * scale;
+		}
+		else
+		{
+			float pull = glm::min(strength * deltaTime, 1.f);
+			velocity[0] += (value[0] - velocity[0]) * pull;
+			velocity[1] += (value[1] - velocity[1]) * pull;
+			velocity[2] += (value[2] - velocity[2]) * pull;
+		}
+	}
+
+private:
+	/**
+	* Sample the field with trilinear filtering. Grid points lie in texel centers and
+	* coordinates are clamped to the edge, the same as the linear 3D texture fetch.
+	* @param uvw	- normalized coordinates in the field bounds <0;1>.
+	* @param value	- sampled vector (four floats, the last one is always 0).
+	*/
+	void Sample(const glm::vec3& uvw, float* value) const;
+
+	glm::vec3 boundsMin;		///< Minimum corner of the field in the world.
+	glm::vec3 boundsMax;		///< Maximum corner of the field in the world.
+	glm::vec3 inverseBoundsSize;	///< 1 / (boundsMax - boundsMin).
+	glm::ivec3 size;			///< Number of grid points in every axis.
+	std::vector<float> data;	///< Vectors padded to four floats, so one grid point is one SIMD load.
+	GLuint texture;				///< 3D texture with the field for the GPU path.
+};
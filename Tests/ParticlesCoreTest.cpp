@@ -0,0 +1,84 @@
+/**
+* GPU Particles example.
+*
+* This is the test of the particles core. It simulates the CPU path headless and checks
+* that the number of alive particles stays steady once the pool is filled, also when the
+* life time is as long as the whole emit process of the pool (it is clamped then).
+*
+* (c) 2014 Damian Nowakowski
+*/
+
+#include "Engine.h"
+#include "JobSystem.h"
+#include "ParticlesCore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+* Simulate the pool with the given life time and check the alive particles of every update
+* after the first two emit processes. Portions come every period, so the alive count can only
+* move by the particles emitted in one update around the count expected from the life time.
+* @param config		- the configuration ini file reader (only [System] keys are read).
+* @param lifeTime	- configured life time of particles.
+* @returns true if the alive count stayed steady.
+*/
+bool CheckSteadyAlive(INIReader* config, double lifeTime)
+{
+	ParticlesCore core;
+	core.Init(ParticlesCore::LoadParams(config, [lifeTime](const char* key, double defaultValue)
+	{
+		if (strcmp(key, "Count") == 0)			return 100000.0;
+		if (strcmp(key, "EmitAtOnce") == 0)		return 2000.0;
+		if (strcmp(key, "Period") == 0)			return 0.01;
+		if (strcmp(key, "LifeTime") == 0)		return lifeTime;
+		return defaultValue;
+	}));
+	if (core.AllocateCPU() == false)
+	{
+		printf("LifeTime %.2f: can't allocate CPU streams\n", lifeTime);
+		return false;
+	}
+
+	/// The emit process is Count * Period / EmitAtOnce = 0.5 s, the life time is clamped to it
+	double emitProcess	= 100000.0 * 0.01 / 2000.0;
+	double expected		= std::min(lifeTime, emitProcess - PARTICLES_LIFE_TIME_MARGIN * UPDATE_PERIOD) / 0.01 * 2000.0;
+	double tolerance	= UPDATE_PERIOD / 0.01 * 2000.0 + 2000.0;
+	int warmUpTicks		= (int)(2 * emitProcess / UPDATE_PERIOD) + 1;
+
+	int minAlive = core.GetParticlesCount();
+	int maxAlive = 0;
+	for (int tick = 0; tick < 600; tick++)
+	{
+		core.SimulateCPU((float)UPDATE_PERIOD);
+		if (tick >= warmUpTicks)
+		{
+			minAlive = std::min(minAlive, (int)core.GetUpdateStats().alive);
+			maxAlive = std::max(maxAlive, (int)core.GetUpdateStats().alive);
+		}
+	}
+
+	bool isSteady = minAlive >= expected - tolerance && maxAlive <= expected + tolerance;
+	printf("LifeTime %.2f: alive %d - %d, expected %.0f +- %.0f %s\n", lifeTime, minAlive, maxAlive, expected, tolerance, isSteady == true ? "OK" : "FAILED");
+	return isSteady;
+}
+
+/**
+* Run the test with life times below, next to, equal to and above the clamp.
+*/
+int main(int argc, char** argv)
+{
+	INIReader config(argc > 1 ? argv[1] : "");
+	JobSystem jobs;
+	jobs.Init(4, JOB_AFFINITY_NONE);
+
+	const double lifeTimes[] = { 0.4, 0.49, 0.5, 2.0 };
+	bool isPassed = true;
+	for (size_t i = 0; i < sizeof(lifeTimes) / sizeof(lifeTimes[0]); i++)
+	{
+		isPassed = CheckSteadyAlive(&config, lifeTimes[i]) && isPassed;
+	}
+	return isPassed == true ? EXIT_SUCCESS : EXIT_FAILURE;
+}